@@ -33,6 +33,10 @@
 
 static int nodeCount = 4;
 static bool useTextures = false;
+static bool opaque = false;
+static bool opaquePass = false;
+static bool compare = false;
+static const int compareFrames = 120;
 
 class CreateFractalJob : public WorkQueue::Job
 {
@@ -89,7 +93,7 @@ public:
                 workQueue()->schedule(sjob);
 
             } else {
-                *rotation << RectangleNode::create(geometry, vec4(rnd(), rnd(), rnd(), 0.5));
+                *rotation << RectangleNode::create(geometry, vec4(rnd(), rnd(), rnd(), opaque ? 1.0 : 0.5));
             }
             animation_rotateZ(animationManager(), rotation, 4 + i);
         }
@@ -101,13 +105,16 @@ public:
 
         requestRender();
 
+        OpenGLRenderer *glRenderer = static_cast<OpenGLRenderer *>(renderer());
+        glRenderer->setOpaquePassEnabled(compare ? m_compareMode == 1 : opaquePass);
+
         // Check for completed jobs and perform the texture upload if so..
         while (!m_pendingJobs.empty() && m_pendingJobs.front()->hasCompleted()) {
             shared_ptr<WorkQueue::Job> job = m_pendingJobs.front();
             m_pendingJobs.pop_front();
 
             CreateFractalJob *fractalJob = static_cast<CreateFractalJob *>(job.get());
-            Texture *texture = renderer()->createTextureFromImageData(fractalJob->size, Texture::RGBA_32, fractalJob->bits.data());
+            Texture *texture = renderer()->createTextureFromImageData(fractalJob->size, opaque ? Texture::RGBx_32 : Texture::RGBA_32, fractalJob->bits.data());
             fractalJob->node->setTexture(texture);
 
             cout << "update: texture for node" << fractalJob->index
@@ -122,14 +129,48 @@ public:
         }
 
         // Only report FPS once all textures are created..
-        if (m_pendingJobs.empty())
+        if (m_pendingJobs.empty() && !compare)
             rengine_countFps();
 
         return root;
     }
 
+    // With --compare, the opaque pass is switched on and off and the time
+    // it takes to finish each frame is reported for both.
+    void onBeforeRender() override
+    {
+        if (!compare || !m_pendingJobs.empty())
+            return;
+        glFinish();
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    void onAfterRender() override
+    {
+        if (!compare || !m_pendingJobs.empty())
+            return;
+        glFinish();
+        m_time[m_compareMode] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+        if (++m_frame < compareFrames)
+            return;
+        m_frame = 0;
+        m_compareMode = !m_compareMode;
+        if (m_compareMode == 0) {
+            double off = m_time[0] / compareFrames;
+            double on = m_time[1] / compareFrames;
+            cout << "opaque pass off: " << off << " ms/frame, on: " << on << " ms/frame, saved: "
+                 << (1 - on / off) * 100 << "%, "
+                 << static_cast<OpenGLRenderer *>(renderer())->opaquePassElements() << " elements in the opaque pass" << endl;
+            m_time[0] = m_time[1] = 0;
+        }
+    }
+
 private:
     list<shared_ptr<WorkQueue::Job>> m_pendingJobs;
+    std::chrono::steady_clock::time_point m_start;
+    double m_time[2] = { 0, 0 };
+    int m_compareMode = 0;
+    int m_frame = 0;
 };
 
 RENGINE_DEFINE_GLOBALS
@@ -142,13 +183,23 @@ int main(int argc, char **argv) {
             nodeCount = atoi(argv[++i]);
         } else if (arg == "--textures") {
             useTextures = true;
+        } else if (arg == "--opaque") {
+            opaque = true;
+        } else if (arg == "--opaque-pass") {
+            opaquePass = true;
+        } else if (arg == "--compare") {
+            compare = true;
         } else if (arg == "-h" || arg == "--help") {
             cout << "Usage: " << endl
                  << " > " << argv[0] << " [options]" << endl
                  << endl
                  << "Options:" << endl
                  << "  --count [x]      Number of layers" << endl
-                 << "  --textures       Use textures rather than solid fills" << endl;
+                 << "  --textures       Use textures rather than solid fills" << endl
+                 << "  --opaque         Make the layers opaque" << endl
+                 << "  --opaque-pass    Draw opaque layers front-to-back with depth testing" << endl
+                 << "  --compare        Alternate with and without the opaque pass and report" << endl
+                 << "                   the time per frame for both" << endl;
         }
     }
 
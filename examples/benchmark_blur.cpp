@@ -0,0 +1,150 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+#include "examples.h"
+
+#include <chrono>
+
+#define  STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+RENGINE_DEFINE_GLOBALS
+
+static int frameCount = 50;
+static int warmupFrames = 5;
+
+static const unsigned radii[] = { 2, 4, 8, 16, 32, 64 };
+static const unsigned radiusCount = sizeof(radii) / sizeof(unsigned);
+
+static const OpenGLRenderer::BlurMode modes[] = { OpenGLRenderer::FullResolutionBlur, OpenGLRenderer::DownsampledBlur };
+static const char *modeNames[] = { "full", "downsampled" };
+
+/*!
+    Blurs a large texture with every radius in 'radii' using both the full
+    resolution and the downsampled blur, and prints the average time per
+    frame. Each frame ends with glFinish(), so the time includes the GPU
+    work.
+ */
+class BlurBench : public StandardSurface
+{
+public:
+    Node *build() override
+    {
+        vec2 s = size();
+        rect2d geometry(s * 0.1f, s * 0.9f);
+        m_blur = BlurNode::create(radii[0]);
+        Node *root = Node::create();
+        *root << &(*m_blur << TextureNode::create(geometry, rengine_fractalTexture(renderer(), geometry.size())));
+        return root;
+    }
+
+    Node *update(Node *root) override
+    {
+        OpenGLRenderer *glRenderer = static_cast<OpenGLRenderer *>(renderer());
+        // Every frame must blur, so nothing is reused from the last one
+        glRenderer->setLayerCachingEnabled(false);
+        glRenderer->setBlurMode(modes[m_mode]);
+        m_blur->setRadius(radii[m_radius]);
+        requestRender();
+        return root;
+    }
+
+    void onBeforeRender() override
+    {
+        glFinish();
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    void onAfterRender() override
+    {
+        glFinish();
+        if (m_frame++ >= warmupFrames)
+            m_time += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+
+        if (m_frame < warmupFrames + frameCount)
+            return;
+
+        m_results[m_mode][m_radius] = m_time / frameCount;
+        m_frame = 0;
+        m_time = 0;
+        if (++m_radius == radiusCount) {
+            m_radius = 0;
+            if (++m_mode == 2) {
+                report();
+                Backend::get()->quit();
+            }
+        }
+    }
+
+    void report()
+    {
+        cout << std::setw(8) << "radius";
+        for (unsigned m=0; m<2; ++m)
+            cout << std::setw(16) << modeNames[m];
+        cout << " (ms/frame, " << size().x << "x" << size().y << ")" << endl;
+        for (unsigned r=0; r<radiusCount; ++r) {
+            cout << std::setw(8) << radii[r];
+            for (unsigned m=0; m<2; ++m)
+                cout << std::setw(16) << std::fixed << std::setprecision(3) << m_results[m][r];
+            cout << endl;
+        }
+    }
+
+private:
+    BlurNode *m_blur = nullptr;
+    unsigned m_mode = 0;
+    unsigned m_radius = 0;
+    int m_frame = 0;
+    double m_time = 0;
+    double m_results[2][radiusCount];
+    std::chrono::steady_clock::time_point m_start;
+};
+
+int main(int argc, char **argv) {
+
+    for (int i=0; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 < argc && arg == "--frames") {
+            frameCount = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-h" || arg == "--help") {
+            cout << "Usage: " << endl
+                 << " > " << argv[0] << " [options]" << endl
+                 << endl
+                 << "Options:" << endl
+                 << "  --frames [x]     Number of frames to time for each radius and mode" << endl;
+            return 0;
+        }
+    }
+
+    RENGINE_BACKEND backend;
+
+    BlurBench surface;
+    surface.show();
+
+    backend.run();
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+
+#include <chrono>
+#include <iomanip>
+#include <vector>
+
+#define  STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+RENGINE_DEFINE_GLOBALS
+
+using namespace std;
+RENGINE_USE_NAMESPACE
+
+static int rectCount = 100000;
+static int iterations = 50;
+
+/*!
+    Compares transforming the corners of rectangles one at a time with
+    mat4::operator* against the quad kernels in mathtypes.h, both for the 2D
+    transform done for every rectangle and texture node and for the 3D
+    projection done below a projection. Prints the average time for one pass
+    over all the rectangles.
+ */
+
+static double msSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Function>
+static void bench(const char *name, std::vector<vec2> &out, Function function)
+{
+    function(); // warm up
+    auto start = std::chrono::steady_clock::now();
+    for (int i=0; i<iterations; ++i)
+        function();
+    double ms = msSince(start) / iterations;
+
+    // Use the result, so the work isn't optimized away
+    float sum = 0;
+    for (vec2 v : out)
+        sum += v.x + v.y;
+    cout << "  " << std::left << std::setw(24) << name << std::right << std::setw(10) << std::fixed << std::setprecision(3)
+         << ms << " ms (" << sum << ")" << endl;
+}
+
+int main(int argc, char **argv) {
+
+    for (int i=0; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 < argc && arg == "--rects") {
+            rectCount = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--iterations") {
+            iterations = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-h" || arg == "--help") {
+            cout << "Usage: " << endl
+                 << " > " << argv[0] << " [options]" << endl
+                 << endl
+                 << "Options:" << endl
+                 << "  --rects [x]      Number of rectangles to transform" << endl
+                 << "  --iterations [x] Number of passes over the rectangles to time" << endl;
+            return 0;
+        }
+    }
+
+    std::vector<rect2d> rects(rectCount);
+    for (int i=0; i<rectCount; ++i)
+        rects[i] = rect2d::fromXywh(i % 317, (i / 317) % 241, 5 + i % 13, 3 + i % 7);
+    std::vector<vec2> out(rectCount * 4);
+
+    mat4 m2d = mat4::translate2D(100, 50) * mat4::rotate2D(0.3) * mat4::scale2D(1.5, 1.5);
+    mat4 m3d = mat4::translate(10, 20, -5) * mat4::rotateAroundY(0.5);
+    float farPlane = 1000;
+
+    cout << rectCount << " rectangles, " << iterations << " iterations:" << endl;
+#if defined(RENGINE_MATH_SSE2)
+    cout << "  kernels use SSE2" << endl;
+#elif defined(RENGINE_MATH_NEON)
+    cout << "  kernels use NEON" << endl;
+#else
+    cout << "  kernels use scalar code" << endl;
+#endif
+
+    bench("2d mat4 * vec2", out, [&] {
+        vec2 *v = out.data();
+        for (const rect2d &r : rects) {
+            v[0] = m2d * r.tl;
+            v[1] = m2d * vec2(r.tl.x, r.br.y);
+            v[2] = m2d * vec2(r.br.x, r.tl.y);
+            v[3] = m2d * r.br;
+            v += 4;
+        }
+    });
+    bench("2d transformQuad2D", out, [&] {
+        vec2 *v = out.data();
+        for (const rect2d &r : rects) {
+            transformQuad2D(m2d, r, v);
+            v += 4;
+        }
+    });
+    bench("2d transformQuads2D", out, [&] {
+        transformQuads2D(m2d, rects.data(), rects.size(), out.data());
+    });
+    bench("3d mat4 * vec3", out, [&] {
+        vec2 *v = out.data();
+        for (const rect2d &r : rects) {
+            v[0] = m2d * ((m3d * vec3(r.tl))                 .project2D(farPlane));
+            v[1] = m2d * ((m3d * vec3(r.tl.x, r.br.y, 0.0f)).project2D(farPlane));
+            v[2] = m2d * ((m3d * vec3(r.br.x, r.tl.y, 0.0f)).project2D(farPlane));
+            v[3] = m2d * ((m3d * vec3(r.br))                 .project2D(farPlane));
+            v += 4;
+        }
+    });
+    bench("3d projectQuad", out, [&] {
+        vec2 *v = out.data();
+        for (const rect2d &r : rects) {
+            projectQuad(m3d, farPlane, m2d, r, v);
+            v += 4;
+        }
+    });
+
+    return 0;
+}
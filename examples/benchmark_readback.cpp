@@ -0,0 +1,217 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+#include "examples.h"
+
+#include <chrono>
+#include <deque>
+#include <iomanip>
+
+#define  STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+RENGINE_DEFINE_GLOBALS
+
+static int frameCount = 100;
+static int warmupFrames = 5;
+static vec2 frameSize(1920, 1080);
+
+enum Mode {
+    RowByRow,
+    SingleCall,
+    Async,
+    ModeCount
+};
+static const char *modeNames[] = { "row by row", "single call", "async" };
+
+/*!
+    Reads back every frame of a full surface scene, 1920x1080 unless told
+    otherwise, and prints the average time per frame, how long each
+    readback call blocked the render thread and the throughput of the
+    readback. "row by row" is one glReadPixels() call per row, the way
+    readPixels() used to do it, "single call" is readPixels() and "async"
+    is readPixelsAsync(), which also prints how many frames it took for a
+    readback to become ready.
+
+    Run it with the headless backend to not be limited by vsync.
+ */
+class ReadbackBench : public StandardSurface
+{
+public:
+    Node *build() override
+    {
+        vec2 s = size();
+        Node *root = Node::create();
+        *root << TextureNode::create(rect2d(vec2(), s), rengine_fractalTexture(renderer(), s));
+        return root;
+    }
+
+    Node *update(Node *root) override
+    {
+        requestRender();
+        return root;
+    }
+
+    void onBeforeRender() override
+    {
+        // Readbacks complete in the order they were started
+        while (!m_pending.empty() && m_pending.front().first->isReady()) {
+            m_latency += m_frame - m_pending.front().second;
+            ++m_completed;
+            m_pending.pop_front();
+        }
+
+        if (m_frame == warmupFrames) {
+            m_start = std::chrono::steady_clock::now();
+            m_completed = 0;
+            m_latency = 0;
+            m_readTime = 0;
+        }
+    }
+
+    void onAfterRender() override
+    {
+        int w = size().x;
+        int h = size().y;
+        if (m_pixels.size() != unsigned(w * h))
+            m_pixels.resize(w * h);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        switch (m_mode) {
+        case RowByRow:
+            for (int i=0; i<h; ++i)
+                glReadPixels(0, h - i - 1, w, 1, GL_RGBA, GL_UNSIGNED_BYTE, m_pixels.data() + i * w);
+            ++m_completed;
+            break;
+        case SingleCall:
+            renderer()->readPixels(0, 0, w, h, m_pixels.data());
+            ++m_completed;
+            break;
+        case Async:
+            m_pending.push_back(std::make_pair(renderer()->readPixelsAsync(0, 0, w, h), m_frame));
+            break;
+        }
+        m_readTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (++m_frame < warmupFrames + frameCount)
+            return;
+
+        // The ones still in flight finish after the frames we time, count
+        // them, but not their latency
+        renderer()->finishReadbacks();
+        double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+        for (auto &p : m_pending)
+            m_completed += p.first->isReady() ? 1 : 0;
+        unsigned latent = m_completed - m_pending.size();
+        m_pending.clear();
+
+        Result &r = m_results[m_mode];
+        r.frameTime = time / frameCount;
+        r.readTime = m_readTime / frameCount;
+        r.throughput = m_completed * double(w * h * sizeof(unsigned)) / (time / 1000.0) / (1024 * 1024);
+        r.latency = latent > 0 ? double(m_latency) / latent : 0;
+
+        m_frame = 0;
+        if (++m_mode == ModeCount) {
+            report();
+            Backend::get()->quit();
+        }
+    }
+
+    void report()
+    {
+        OpenGLRenderer *glRenderer = dynamic_cast<OpenGLRenderer *>(renderer());
+        cout << "Reading back " << size().x << "x" << size().y << " pixels, "
+             << (glRenderer && glRenderer->asyncReadbackSupported() ? "with" : "without")
+             << " pixel buffer objects" << endl;
+        cout << std::setw(12) << "mode"
+             << std::setw(12) << "ms/frame"
+             << std::setw(12) << "ms/read"
+             << std::setw(12) << "MB/s"
+             << std::setw(12) << "latency" << endl;
+        for (int m=0; m<ModeCount; ++m) {
+            const Result &r = m_results[m];
+            cout << std::setw(12) << modeNames[m]
+                 << std::fixed << std::setprecision(3)
+                 << std::setw(12) << r.frameTime
+                 << std::setw(12) << r.readTime
+                 << std::setprecision(1)
+                 << std::setw(12) << r.throughput;
+            if (m == Async)
+                cout << std::setw(12) << r.latency;
+            cout << endl;
+        }
+    }
+
+private:
+    struct Result {
+        double frameTime;
+        double readTime;
+        double throughput;
+        double latency;
+    };
+
+    std::vector<unsigned> m_pixels;
+    std::deque<std::pair<std::shared_ptr<PixelReadback>, int>> m_pending;
+    int m_mode = RowByRow;
+    int m_frame = 0;
+    unsigned m_completed = 0;
+    int m_latency = 0;
+    double m_readTime = 0;
+    Result m_results[ModeCount];
+    std::chrono::steady_clock::time_point m_start;
+};
+
+int main(int argc, char **argv) {
+
+    for (int i=0; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 < argc && arg == "--frames") {
+            frameCount = std::max(1, atoi(argv[++i]));
+        } else if (i + 2 < argc && arg == "--size") {
+            frameSize = vec2(std::max(1, atoi(argv[i + 1])), std::max(1, atoi(argv[i + 2])));
+            i += 2;
+        } else if (arg == "-h" || arg == "--help") {
+            cout << "Usage: " << endl
+                 << " > " << argv[0] << " [options]" << endl
+                 << endl
+                 << "Options:" << endl
+                 << "  --frames [x]     Number of frames to time for each mode" << endl
+                 << "  --size [w] [h]   Size of the surface, 1920x1080 by default" << endl;
+            return 0;
+        }
+    }
+
+    RENGINE_BACKEND backend;
+
+    ReadbackBench surface;
+    surface.requestSize(frameSize);
+    surface.show();
+
+    backend.run();
+
+    return 0;
+}
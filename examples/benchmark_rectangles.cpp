@@ -34,6 +34,8 @@ RENGINE_DEFINE_GLOBALS
 static int nodeCount = 1000;
 static bool interleaved = false;
 static bool textured = false;
+static bool batching = true;
+static bool atlas = true;
 static std::vector<Texture *> texturePool;
 
 class Rectangles : public StandardSurface
@@ -45,6 +47,10 @@ public:
 
     Node *update(Node *root) override {
 
+        OpenGLRenderer *glRenderer = static_cast<OpenGLRenderer *>(renderer());
+        glRenderer->setBatchingEnabled(batching);
+        glRenderer->setTextureAtlasEnabled(atlas);
+
         // if --textures, we have nodeCount textures (all the nodes)
         // if --interleaved, we have half of them.
         const unsigned int textureCount = interleaved ? nodeCount / 2 : (textured ? nodeCount : 0);
@@ -109,6 +115,10 @@ int main(int argc, char **argv) {
             interleaved = true;
         } else if (i < argc && arg == "--textured") {
             textured = true;
+        } else if (i < argc && arg == "--no-batching") {
+            batching = false;
+        } else if (i < argc && arg == "--no-atlas") {
+            atlas = false;
         }
     }
 
@@ -118,6 +128,8 @@ int main(int argc, char **argv) {
     std::cout << "Using " << nodeCount << " nodes..." << std::endl;
     std::cout << "  --interleaved ....: " << (interleaved ? "yes" : "no") << std::endl;
     std::cout << "  --textured .......: " << (textured ? "yes" : "no") << std::endl;
+    std::cout << "  --no-batching ....: " << (batching ? "no" : "yes") << std::endl;
+    std::cout << "  --no-atlas .......: " << (atlas ? "no" : "yes") << std::endl;
 
     RENGINE_ALLOCATION_POOL(RectangleNode, rengine_RectangleNode, 1024);
     RENGINE_ALLOCATION_POOL(TextureNode, rengine_TextureNode, 1024);
@@ -0,0 +1,185 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+#include "examples.h"
+
+#include <chrono>
+#include <iomanip>
+
+#define  STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+RENGINE_DEFINE_GLOBALS
+
+static int frameCount = 20;
+static vec2 frameSize(1280, 720);
+static int maxThreads = -1;
+
+/*!
+    Renders a few scenes with the SoftwareRenderer, without a backend or a
+    GPU, and prints the average time per frame for increasing numbers of
+    render threads. This is the CPU baseline to hold the OpenGL renderer
+    against.
+ */
+
+static float random(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / float(RAND_MAX));
+}
+
+static vec4 randomColor()
+{
+    return vec4(random(0, 1), random(0, 1), random(0, 1), rand() % 2 ? 1.0f : random(0.2f, 0.9f));
+}
+
+static rect2d randomRect(float minSize, float maxSize)
+{
+    vec2 size(random(minSize, maxSize), random(minSize, maxSize));
+    return rect2d::fromPosSize(vec2(random(-size.x, frameSize.x), random(-size.y, frameSize.y)), size);
+}
+
+static Node *rectangles(Renderer *)
+{
+    Node *root = Node::create();
+    for (int i=0; i<10000; ++i)
+        *root << RectangleNode::create(randomRect(4, 64), randomColor());
+    return root;
+}
+
+static Node *rotatedRectangles(Renderer *)
+{
+    Node *root = Node::create();
+    for (int i=0; i<2000; ++i) {
+        rect2d r = randomRect(8, 64);
+        *root << &(*TransformNode::create(mat4::translate2D(r.center()) * mat4::rotate2D(random(0, M_PI)))
+                   << RectangleNode::create(rect2d::fromPosSizeCentered(vec2(), r.size()), randomColor()));
+    }
+    return root;
+}
+
+static Node *textures(Renderer *renderer)
+{
+    static std::unique_ptr<Texture> texture;
+    texture.reset(rengine_fractalTexture(renderer, vec2(64, 64)));
+    Node *root = Node::create();
+    for (int i=0; i<2000; ++i) {
+        // Every other one at the texture's own size, so it is copied rather than filtered
+        rect2d r = randomRect(16, 128);
+        if (i % 2)
+            r = rect2d::fromPosSize(floor(r.tl), vec2(64, 64));
+        *root << TextureNode::create(r, texture.get());
+    }
+    return root;
+}
+
+static Node *layers(Renderer *)
+{
+    Node *root = Node::create();
+    for (int i=0; i<20; ++i) {
+        Node *layer;
+        switch (i % 3) {
+        case 0: layer = OpacityNode::create(0.5); break;
+        case 1: layer = BlurNode::create(8); break;
+        default: layer = ShadowNode::create(8, vec2(10, 10), vec4(0, 0, 0, 0.5)); break;
+        }
+        for (int j=0; j<20; ++j)
+            *layer << RectangleNode::create(randomRect(8, 64), randomColor());
+        *root << layer;
+    }
+    return root;
+}
+
+struct Scene {
+    const char *name;
+    Node *(*build)(Renderer *renderer);
+};
+
+static const Scene scenes[] = {
+    { "rectangles", rectangles },
+    { "rotated", rotatedRectangles },
+    { "textures", textures },
+    { "layers", layers }
+};
+
+int main(int argc, char **argv) {
+
+    for (int i=0; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 < argc && arg == "--frames") {
+            frameCount = std::max(1, atoi(argv[++i]));
+        } else if (i + 2 < argc && arg == "--size") {
+            frameSize.x = std::max(1, atoi(argv[++i]));
+            frameSize.y = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--threads") {
+            maxThreads = std::max(0, atoi(argv[++i]));
+        } else if (arg == "-h" || arg == "--help") {
+            cout << "Usage: " << endl
+                 << " > " << argv[0] << " [options]" << endl
+                 << endl
+                 << "Options:" << endl
+                 << "  --frames [x]     Number of frames to time for each scene" << endl
+                 << "  --size [w] [h]   Size of the frame" << endl
+                 << "  --threads [x]    Most render threads to try, besides the calling thread" << endl;
+            return 0;
+        }
+    }
+
+    SoftwareRenderer renderer;
+    renderer.setSize(frameSize);
+    if (maxThreads < 0)
+        maxThreads = renderer.renderThreadCount();
+
+    std::vector<unsigned> threadCounts;
+    for (unsigned t=0; int(t) <= maxThreads; t = t * 2 + 1)
+        threadCounts.push_back(t);
+    if (int(threadCounts.back()) != maxThreads)
+        threadCounts.push_back(maxThreads);
+
+    cout << std::setw(12) << "threads";
+    for (unsigned t : threadCounts)
+        cout << std::setw(10) << t + 1;
+    cout << " (ms/frame, " << frameSize.x << "x" << frameSize.y << ")" << endl;
+
+    for (const Scene &scene : scenes) {
+        srand(0);
+        Node *root = scene.build(&renderer);
+        renderer.setSceneRoot(root);
+        cout << std::setw(12) << scene.name;
+        for (unsigned t : threadCounts) {
+            renderer.setRenderThreadCount(t);
+            renderer.render(); // warm up
+            auto start = std::chrono::steady_clock::now();
+            for (int i=0; i<frameCount; ++i)
+                renderer.render();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frameCount;
+            cout << std::setw(10) << std::fixed << std::setprecision(3) << ms;
+        }
+        cout << endl;
+        root->destroy();
+    }
+
+    return 0;
+}
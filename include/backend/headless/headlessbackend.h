@@ -0,0 +1,368 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "common/common.h"
+#include "common/logging.h"
+#include "backend/backend_decl.h"
+#include "scenegraph/openglrenderer.h"
+#include "scenegraph/softwarerenderer.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    The HeadlessBackend renders without a window or a display, so examples,
+    benchmarks and tests can run on build machines.
+
+    It renders with OpenGL into an EGL pbuffer, on Mesa's surfaceless
+    platform when it is there. When no EGL display, config or context can be
+    had, or RENGINE_HEADLESS_SOFTWARE is set to a non-zero value, it renders
+    with the SoftwareRenderer instead.
+
+    The size of the surface is 1280x720, or whatever RENGINE_HEADLESS_SIZE is
+    set to, as in "320x240". The surface can be resized with requestSize().
+
+    The buffer age is 0, so every frame is repainted in full. When
+    RENGINE_HEADLESS_PRESERVE is set to a non-zero value, the backend asks for
+    a pbuffer which is preserved across eglSwapBuffers() and reports a buffer
+    age of 1 if, and only if, EGL confirms that it got one. This allows
+    testing partial repaints.
+
+    Nothing is presented, so frames are paced by a virtual vsync clock which
+    ticks once per pass of the event loop, every vsyncInterval(). Frames are
+    rendered back to back, as fast as they can be, unless throttling is
+    enabled, in which case the event loop waits for each vsync in real time.
+    The event loop always waits for the next vsync when there is nothing to
+    render.
+ */
+class HeadlessBackend : public Backend, SurfaceBackendImpl
+{
+public:
+    HeadlessBackend();
+    ~HeadlessBackend();
+
+    void processEvents() override;
+
+    SurfaceBackendImpl *createSurface(Surface *iface) override;
+    void destroySurface(Surface *surface, SurfaceBackendImpl *impl) override;
+
+    Renderer *createRenderer() override;
+
+    bool beginRender() override;
+    bool commitRender() override;
+
+    int bufferAge() const override { return m_bufferPreserved ? 1 : 0; }
+
+    void show() override { }
+    void hide() override { }
+    vec2 size() const override { return m_size; }
+
+    void requestSize(vec2 size) override;
+
+    void requestRender() override { m_renderRequested = true; }
+
+    vec2 dpi() const override { return vec2(96, 96); }
+
+    /*!
+        Returns true when the backend renders with the SoftwareRenderer
+        rather than with OpenGL.
+     */
+    bool isSoftware() const { return m_software; }
+
+    /*!
+        Returns true when the content of the pbuffer is known to be preserved
+        across frames, see RENGINE_HEADLESS_PRESERVE.
+     */
+    bool isBufferPreserved() const { return m_bufferPreserved; }
+
+    void setVsyncInterval(std::chrono::microseconds interval) { m_vsyncInterval = interval; }
+    std::chrono::microseconds vsyncInterval() const { return m_vsyncInterval; }
+
+    void setThrottled(bool throttled) { m_throttled = throttled; }
+    bool isThrottled() const { return m_throttled; }
+
+    /*!
+        The number of vsyncs since the backend was created and the virtual
+        time they add up to.
+     */
+    unsigned vsyncCount() const { return m_vsyncCount; }
+    std::chrono::microseconds vsyncTime() const { return m_vsyncCount * m_vsyncInterval; }
+
+    /*!
+        The number of frames which have been rendered.
+     */
+    unsigned frameCount() const { return m_frameCount; }
+
+private:
+    bool initEgl();
+    bool createPbuffer();
+
+    Surface *m_surface = nullptr;
+    vec2 m_size;
+    bool m_software = false;
+    bool m_renderRequested = false;
+    bool m_throttled = false;
+    bool m_preserveRequested = false;
+    bool m_bufferPreserved = false;
+
+    EGLDisplay m_display = EGL_NO_DISPLAY;
+    EGLConfig m_config = 0;
+    EGLContext m_context = EGL_NO_CONTEXT;
+    EGLSurface m_pbuffer = EGL_NO_SURFACE;
+
+    std::chrono::microseconds m_vsyncInterval;
+    std::chrono::steady_clock::time_point m_nextVsync;
+    unsigned m_vsyncCount = 0;
+    unsigned m_frameCount = 0;
+};
+
+inline HeadlessBackend::HeadlessBackend()
+    : m_size(1280, 720)
+    , m_vsyncInterval(16667)
+{
+    const char *size = std::getenv("RENGINE_HEADLESS_SIZE");
+    int w, h;
+    if (size && sscanf(size, "%dx%d", &w, &h) == 2 && w > 0 && h > 0)
+        m_size = vec2(w, h);
+
+    const char *software = std::getenv("RENGINE_HEADLESS_SOFTWARE");
+    m_software = software && atoi(software) != 0;
+    const char *preserve = std::getenv("RENGINE_HEADLESS_PRESERVE");
+    m_preserveRequested = preserve && atoi(preserve) != 0;
+    if (!m_software && !initEgl()) {
+        logw << "OpenGL is not available, using the software renderer" << std::endl;
+        m_software = true;
+    }
+
+    logi << "HeadlessBackend: created, " << m_size << (m_software ? ", software" : ", OpenGL") << std::endl;
+    m_nextVsync = std::chrono::steady_clock::now();
+}
+
+inline HeadlessBackend::~HeadlessBackend()
+{
+    if (m_display == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (m_pbuffer != EGL_NO_SURFACE)
+        eglDestroySurface(m_display, m_pbuffer);
+    if (m_context != EGL_NO_CONTEXT)
+        eglDestroyContext(m_display, m_context);
+    eglTerminate(m_display);
+}
+
+inline bool HeadlessBackend::initEgl()
+{
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+#endif
+    if (m_display == EGL_NO_DISPLAY)
+        m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor)) {
+        logw << "eglInitialize failed: " << std::hex << eglGetError() << std::dec << std::endl;
+        m_display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+#ifdef RENGINE_OPENGL_DESKTOP
+    const EGLint renderableType = EGL_OPENGL_BIT;
+    const EGLenum api = EGL_OPENGL_API;
+    const EGLint contextAttributes[] = { EGL_NONE };
+#else
+    const EGLint renderableType = EGL_OPENGL_ES2_BIT;
+    const EGLenum api = EGL_OPENGL_ES_API;
+    const EGLint contextAttributes[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+#endif
+
+    EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT | EGL_SWAP_BEHAVIOR_PRESERVED_BIT,
+        EGL_RENDERABLE_TYPE, renderableType,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 16,     // for the renderer's opaque pass
+        EGL_NONE
+    };
+    EGLint count = 0;
+    if (m_preserveRequested
+        && (!eglChooseConfig(m_display, configAttributes, &m_config, 1, &count) || count < 1)) {
+        logw << "no EGL config with preserved pbuffers, frames are repainted in full" << std::endl;
+        m_preserveRequested = false;
+    }
+    if (!m_preserveRequested) {
+        configAttributes[1] = EGL_PBUFFER_BIT;
+        if (!eglChooseConfig(m_display, configAttributes, &m_config, 1, &count) || count < 1) {
+            logw << "no EGL config with pbuffers" << std::endl;
+            return false;
+        }
+    }
+
+    eglBindAPI(api);
+    m_context = eglCreateContext(m_display, m_config, EGL_NO_CONTEXT, contextAttributes);
+    if (m_context == EGL_NO_CONTEXT) {
+        logw << "eglCreateContext failed: " << std::hex << eglGetError() << std::dec << std::endl;
+        return false;
+    }
+
+    if (!createPbuffer())
+        return false;
+
+#if defined(RENGINE_OPENGL_DESKTOP) && !defined(__APPLE__)
+    glewInit();
+#endif
+
+    return true;
+}
+
+inline bool HeadlessBackend::createPbuffer()
+{
+    if (m_pbuffer != EGL_NO_SURFACE) {
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroySurface(m_display, m_pbuffer);
+    }
+
+    const EGLint attributes[] = { EGL_WIDTH, EGLint(m_size.x), EGL_HEIGHT, EGLint(m_size.y), EGL_NONE };
+    m_pbuffer = eglCreatePbufferSurface(m_display, m_config, attributes);
+    if (m_pbuffer == EGL_NO_SURFACE || !eglMakeCurrent(m_display, m_pbuffer, m_pbuffer, m_context)) {
+        logw << "failed to create a " << m_size << " pbuffer: " << std::hex << eglGetError() << std::dec << std::endl;
+        return false;
+    }
+
+    m_bufferPreserved = false;
+    if (m_preserveRequested) {
+        EGLint behavior = EGL_BUFFER_DESTROYED;
+        eglSurfaceAttrib(m_display, m_pbuffer, EGL_SWAP_BEHAVIOR, EGL_BUFFER_PRESERVED);
+        m_bufferPreserved = eglQuerySurface(m_display, m_pbuffer, EGL_SWAP_BEHAVIOR, &behavior)
+                            && behavior == EGL_BUFFER_PRESERVED;
+        if (!m_bufferPreserved)
+            logw << "the pbuffer is not preserved across swaps, frames are repainted in full" << std::endl;
+    }
+    return true;
+}
+
+inline void HeadlessBackend::processEvents()
+{
+    assert(m_surface);
+
+    ++m_vsyncCount;
+    bool rendered = m_renderRequested;
+    if (m_renderRequested) {
+        // reset this before onRender so we don't prevent onRender from
+        // scheduling another one..
+        m_renderRequested = false;
+        m_surface->onRender();
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (rendered && !m_throttled) {
+        m_nextVsync = now + m_vsyncInterval;
+        return;
+    }
+
+    if (m_nextVsync > now)
+        std::this_thread::sleep_until(m_nextVsync);
+    // Skip the vsyncs we were too late for
+    m_nextVsync = std::max(m_nextVsync, now) + m_vsyncInterval;
+    if (!rendered)
+        m_surface->onTick();
+}
+
+inline SurfaceBackendImpl *HeadlessBackend::createSurface(Surface *surface)
+{
+    assert(surface);
+    assert(!m_surface); // there can be only one!
+    m_surface = surface;
+    requestRender();
+    return this;
+}
+
+inline void HeadlessBackend::destroySurface(Surface */*surface*/, SurfaceBackendImpl */*impl*/)
+{
+    m_surface = nullptr;
+}
+
+inline Renderer *HeadlessBackend::createRenderer()
+{
+    assert(m_surface);
+    Renderer *r;
+    if (m_software)
+        r = new SoftwareRenderer();
+    else
+        r = new OpenGLRenderer();
+    r->setTargetSurface(m_surface);
+    return r;
+}
+
+inline bool HeadlessBackend::beginRender()
+{
+    assert(m_surface);
+    if (m_software)
+        return true;
+    if (!eglMakeCurrent(m_display, m_pbuffer, m_pbuffer, m_context)) {
+        logw << "eglMakeCurrent failed: " << std::hex << eglGetError() << std::dec << std::endl;
+        return false;
+    }
+    return true;
+}
+
+inline bool HeadlessBackend::commitRender()
+{
+    assert(m_surface);
+    ++m_frameCount;
+    if (!m_software)
+        eglSwapBuffers(m_display, m_pbuffer);
+    return true;
+}
+
+inline void HeadlessBackend::requestSize(vec2 size)
+{
+    size = vec2(std::max(1.0f, std::floor(size.x)), std::max(1.0f, std::floor(size.y)));
+    if (size == m_size)
+        return;
+    m_size = size;
+    if (!m_software)
+        createPbuffer();
+    requestRender();
+}
+
+#define RENGINE_BACKEND rengine::HeadlessBackend
+
+RENGINE_END_NAMESPACE
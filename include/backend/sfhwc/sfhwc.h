@@ -56,6 +56,8 @@ public:
     void show() override;
     bool beginRender() override;
     bool commitRender() override;
+    int bufferAge() const override;
+    void setDamage(rect2d damage) override { m_damage = damage; }
     vec2 size() const override;
     void requestSize(vec2) override { logd << "resizing is not supported on this backend" << std::endl; }
 
@@ -90,6 +92,12 @@ public:
     EGLDisplay m_eglDisplay;
     EGLSurface m_eglSurface;
     EGLContext m_eglContext;
+
+    // EGL_EXT_buffer_age and EGL_KHR_swap_buffers_with_damage, when available
+    typedef EGLBoolean (*SwapBuffersWithDamage)(EGLDisplay, EGLSurface, EGLint *, EGLint);
+    SwapBuffersWithDamage m_swapBuffersWithDamage;
+    rect2d m_damage;
+    bool m_bufferAgeSupported;
 };
 
 class SfHwcBackend : public Backend, public hwc_procs_t
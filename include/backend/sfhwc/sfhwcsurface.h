@@ -30,6 +30,10 @@
 #include <chrono>
 #include <sync/sync.h>
 
+#ifndef EGL_BUFFER_AGE_EXT
+#define EGL_BUFFER_AGE_EXT 0x313D
+#endif
+
 RENGINE_BEGIN_NAMESPACE
 
 inline const char *sfhwc_decode_egl_error(EGLint error)
@@ -121,6 +125,8 @@ inline SfHwcSurface::SfHwcSurface(Surface *surface, SfHwcBackend *backend, vec2
 	, m_vsyncDelta(0)
 	, m_size(size)
     , m_useOverlay(false)
+    , m_swapBuffersWithDamage(0)
+    , m_bufferAgeSupported(false)
 {
     char *overlay = getenv("RENGINE_SURFACE_USE_OVERLAY");
     if (overlay && atoi(overlay) != 0) {
@@ -170,7 +176,18 @@ inline bool SfHwcSurface::beginRender()
 inline bool SfHwcSurface::commitRender()
 {
 	logd << std::endl;
-    EGLBoolean ok = eglSwapBuffers(m_eglDisplay, m_eglSurface);
+    EGLBoolean ok;
+    if (m_swapBuffersWithDamage && m_damage.width() > 0 && m_damage.height() > 0) {
+        // EGL wants the damage with the origin in the bottom left corner
+        EGLint rect[4] = { EGLint(m_damage.left()),
+                           EGLint(m_size.y - m_damage.bottom()),
+                           EGLint(m_damage.width()),
+                           EGLint(m_damage.height()) };
+        ok = m_swapBuffersWithDamage(m_eglDisplay, m_eglSurface, rect, 1);
+    } else {
+        ok = eglSwapBuffers(m_eglDisplay, m_eglSurface);
+    }
+    m_damage = rect2d();
     if (!ok) {
 		logw << sfhwc_decode_egl_error(eglGetError()) << std::endl;
 		return false;
@@ -178,6 +195,14 @@ inline bool SfHwcSurface::commitRender()
     return true;
 }
 
+inline int SfHwcSurface::bufferAge() const
+{
+    EGLint age = 0;
+    if (m_bufferAgeSupported && !eglQuerySurface(m_eglDisplay, m_eglSurface, EGL_BUFFER_AGE_EXT, &age))
+        return 0;
+    return age;
+}
+
 inline vec2 SfHwcSurface::size() const
 {
 	return m_size;
@@ -266,6 +291,14 @@ inline void SfHwcSurface::initEgl()
 	logi << " - EGL_VERSION .....: " << eglQueryString(m_eglDisplay, EGL_VERSION) << std::endl;
 	logi << " - EGL_CLIENT_APIS .: " << eglQueryString(m_eglDisplay, EGL_CLIENT_APIS) << std::endl;
 	logi << " - EGL_EXTENSIONS ..: " << eglQueryString(m_eglDisplay, EGL_EXTENSIONS) << std::endl;
+
+    std::string extensions = eglQueryString(m_eglDisplay, EGL_EXTENSIONS);
+    m_bufferAgeSupported = extensions.find("EGL_EXT_buffer_age") != std::string::npos;
+    if (extensions.find("EGL_KHR_swap_buffers_with_damage") != std::string::npos)
+        m_swapBuffersWithDamage = (SwapBuffersWithDamage) eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    logi << " - Buffer age ......: " << (m_bufferAgeSupported ? "yes" : "no") << std::endl;
+    logi << " - Swap with damage : " << (m_swapBuffersWithDamage ? "yes" : "no") << std::endl;
+
 	int r, g, b, a, d, s;
 	eglGetConfigAttrib(m_eglDisplay, eglConfig, EGL_ALPHA_SIZE, &a);
 	eglGetConfigAttrib(m_eglDisplay, eglConfig, EGL_RED_SIZE, &r);
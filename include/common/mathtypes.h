@@ -43,9 +43,20 @@
 
 #include <math.h>
 #include <cmath>
+#include <algorithm>
 #include <ostream>
 #include <assert.h>
 
+// The quad transforms at the end of this file use SSE2 or NEON when the
+// target has it, unless RENGINE_MATH_NO_SIMD is defined.
+#if !defined(RENGINE_MATH_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#  define RENGINE_MATH_SSE2
+#  include <emmintrin.h>
+#elif !defined(RENGINE_MATH_NO_SIMD) && defined(__ARM_NEON)
+#  define RENGINE_MATH_NEON
+#  include <arm_neon.h>
+#endif
+
 RENGINE_BEGIN_NAMESPACE
 
 struct vec2 {
@@ -598,6 +609,17 @@ public:
 
     bool operator==(rect2d o) const { return tl == o.tl && br == o.br; }
 
+    // The intersection, which has a negative size if there is none
+    rect2d operator&(rect2d r) const {
+        return rect2d(std::max(tl.x, r.tl.x), std::max(tl.y, r.tl.y),
+                      std::min(br.x, r.br.x), std::min(br.y, r.br.y));
+    }
+
+    // True if the two rects overlap by more than just an edge
+    bool intersects(rect2d r) const {
+        return tl.x < r.br.x && r.tl.x < br.x && tl.y < r.br.y && r.tl.y < br.y;
+    }
+
     bool contains(vec2 p) const {
         assert(tl.x <= br.x);
         assert(tl.y <= br.y);
@@ -617,6 +639,118 @@ public:
     vec2 br;
 };
 
+/*!
+    Transforms the corners of each of the \a count rectangles in \a rects by
+    the 2D part of \a m, same as mat4::operator*(vec2), and writes them to
+    \a v, four per rectangle, in the order top-left, bottom-left, top-right,
+    bottom-right. The four corners are transformed at once and the matrix is
+    only loaded once for all the rectangles.
+
+    The result is the same as with the scalar code, down to the bit, as the
+    operations are done in the same order without fused multiply-add.
+ */
+inline void transformQuads2D(const mat4 &m, const rect2d *rects, unsigned count, vec2 *v)
+{
+    float *out = reinterpret_cast<float *>(v);
+#if defined(RENGINE_MATH_SSE2)
+    __m128 m0 = _mm_set1_ps(m.m[0]), m1 = _mm_set1_ps(m.m[1]), m3 = _mm_set1_ps(m.m[3]);
+    __m128 m4 = _mm_set1_ps(m.m[4]), m5 = _mm_set1_ps(m.m[5]), m7 = _mm_set1_ps(m.m[7]);
+    for (unsigned i=0; i<count; ++i, out += 8) {
+        const rect2d &r = rects[i];
+        __m128 x = _mm_setr_ps(r.tl.x, r.tl.x, r.br.x, r.br.x);
+        __m128 y = _mm_setr_ps(r.tl.y, r.br.y, r.tl.y, r.br.y);
+        __m128 tx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m1, y)), m3);
+        __m128 ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m4, x), _mm_mul_ps(m5, y)), m7);
+        _mm_storeu_ps(out, _mm_unpacklo_ps(tx, ty));
+        _mm_storeu_ps(out + 4, _mm_unpackhi_ps(tx, ty));
+    }
+#elif defined(RENGINE_MATH_NEON)
+    float32x4_t m0 = vdupq_n_f32(m.m[0]), m1 = vdupq_n_f32(m.m[1]), m3 = vdupq_n_f32(m.m[3]);
+    float32x4_t m4 = vdupq_n_f32(m.m[4]), m5 = vdupq_n_f32(m.m[5]), m7 = vdupq_n_f32(m.m[7]);
+    for (unsigned i=0; i<count; ++i, out += 8) {
+        const rect2d &r = rects[i];
+        const float xs[4] = { r.tl.x, r.tl.x, r.br.x, r.br.x };
+        const float ys[4] = { r.tl.y, r.br.y, r.tl.y, r.br.y };
+        float32x4_t x = vld1q_f32(xs);
+        float32x4_t y = vld1q_f32(ys);
+        float32x4x2_t t;
+        t.val[0] = vaddq_f32(vaddq_f32(vmulq_f32(m0, x), vmulq_f32(m1, y)), m3);
+        t.val[1] = vaddq_f32(vaddq_f32(vmulq_f32(m4, x), vmulq_f32(m5, y)), m7);
+        vst2q_f32(out, t);
+    }
+#else
+    for (unsigned i=0; i<count; ++i, v += 4) {
+        const rect2d &r = rects[i];
+        v[0] = m * r.tl;
+        v[1] = m * vec2(r.tl.x, r.br.y);
+        v[2] = m * vec2(r.br.x, r.tl.y);
+        v[3] = m * r.br;
+    }
+    (void) out;
+#endif
+}
+
+inline void transformQuad2D(const mat4 &m, rect2d r, vec2 *v)
+{
+    transformQuads2D(m, &r, 1, v);
+}
+
+/*!
+    Transforms the corners of \a r by \a m3d, projects them to 2D with
+    \a farPlane, see vec3::project2D(), and transforms the result by the 2D
+    part of \a m2d. The corners are written to \a v in the same order as
+    transformQuads2D().
+ */
+inline void projectQuad(const mat4 &m3d, float farPlane, const mat4 &m2d, rect2d r, vec2 *v)
+{
+#if defined(RENGINE_MATH_SSE2)
+    const float *m = m3d.m;
+    __m128 x = _mm_setr_ps(r.tl.x, r.tl.x, r.br.x, r.br.x);
+    __m128 y = _mm_setr_ps(r.tl.y, r.br.y, r.tl.y, r.br.y);
+    __m128 z = _mm_setzero_ps();
+    __m128 tx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0]), x), _mm_mul_ps(_mm_set1_ps(m[1]), y)),
+                                      _mm_mul_ps(_mm_set1_ps(m[2]), z)), _mm_set1_ps(m[3]));
+    __m128 ty = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[4]), x), _mm_mul_ps(_mm_set1_ps(m[5]), y)),
+                                      _mm_mul_ps(_mm_set1_ps(m[6]), z)), _mm_set1_ps(m[7]));
+    __m128 tz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[8]), x), _mm_mul_ps(_mm_set1_ps(m[9]), y)),
+                                      _mm_mul_ps(_mm_set1_ps(m[10]), z)), _mm_set1_ps(m[11]));
+    __m128 far = _mm_set1_ps(farPlane);
+    __m128 zScale = _mm_div_ps(_mm_sub_ps(far, tz), far);
+    __m128 px = _mm_div_ps(tx, zScale);
+    __m128 py = _mm_div_ps(ty, zScale);
+    m = m2d.m;
+    tx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0]), px), _mm_mul_ps(_mm_set1_ps(m[1]), py)), _mm_set1_ps(m[3]));
+    ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[4]), px), _mm_mul_ps(_mm_set1_ps(m[5]), py)), _mm_set1_ps(m[7]));
+    float *out = reinterpret_cast<float *>(v);
+    _mm_storeu_ps(out, _mm_unpacklo_ps(tx, ty));
+    _mm_storeu_ps(out + 4, _mm_unpackhi_ps(tx, ty));
+#elif defined(RENGINE_MATH_NEON) && defined(__aarch64__)
+    const float *m = m3d.m;
+    const float xs[4] = { r.tl.x, r.tl.x, r.br.x, r.br.x };
+    const float ys[4] = { r.tl.y, r.br.y, r.tl.y, r.br.y };
+    float32x4_t x = vld1q_f32(xs);
+    float32x4_t y = vld1q_f32(ys);
+    float32x4_t z = vdupq_n_f32(0);
+    float32x4_t tx = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x, m[0]), vmulq_n_f32(y, m[1])), vmulq_n_f32(z, m[2])), vdupq_n_f32(m[3]));
+    float32x4_t ty = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x, m[4]), vmulq_n_f32(y, m[5])), vmulq_n_f32(z, m[6])), vdupq_n_f32(m[7]));
+    float32x4_t tz = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x, m[8]), vmulq_n_f32(y, m[9])), vmulq_n_f32(z, m[10])), vdupq_n_f32(m[11]));
+    float32x4_t far = vdupq_n_f32(farPlane);
+    float32x4_t zScale = vdivq_f32(vsubq_f32(far, tz), far);
+    float32x4_t px = vdivq_f32(tx, zScale);
+    float32x4_t py = vdivq_f32(ty, zScale);
+    m = m2d.m;
+    float32x4x2_t t;
+    t.val[0] = vaddq_f32(vaddq_f32(vmulq_n_f32(px, m[0]), vmulq_n_f32(py, m[1])), vdupq_n_f32(m[3]));
+    t.val[1] = vaddq_f32(vaddq_f32(vmulq_n_f32(px, m[4]), vmulq_n_f32(py, m[5])), vdupq_n_f32(m[7]));
+    vst2q_f32(reinterpret_cast<float *>(v), t);
+#else
+    v[0] = m2d * ((m3d * vec3(r.tl))                 .project2D(farPlane));
+    v[1] = m2d * ((m3d * vec3(r.tl.x, r.br.y, 0.0f)).project2D(farPlane));
+    v[2] = m2d * ((m3d * vec3(r.br.x, r.tl.y, 0.0f)).project2D(farPlane));
+    v[3] = m2d * ((m3d * vec3(r.br))                 .project2D(farPlane));
+#endif
+}
+
 inline std::ostream &operator<<(std::ostream &o, vec2 v) {
     o << "vec2(" << v.x << ", " << v.y << ")";
     return o;
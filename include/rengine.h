@@ -91,9 +91,15 @@ RENGINE_END_NAMESPACE
 //#include "scenegraph/noderef.h"
 #include "scenegraph/texture.h"
 #include "scenegraph/renderer.h"
+#include "scenegraph/openglgputimer.h"
+#include "scenegraph/openglprogramcache.h"
+#include "scenegraph/openglreadback.h"
 #include "scenegraph/openglshaderprogram.h"
 #include "scenegraph/opengltexture.h"
+#include "scenegraph/opengltextureatlas.h"
 #include "scenegraph/openglrenderer.h"
+#include "scenegraph/softwaretexture.h"
+#include "scenegraph/softwarerenderer.h"
 #include "scenegraph/layoutnode.h"
 
 #include "animationsystem/animation.h"
@@ -104,8 +110,10 @@ RENGINE_END_NAMESPACE
 #include "backend/sdl/sdlbackend.h"
 #elif defined RENGINE_BACKEND_SFHWC
 #include "backend/sfhwc/sfhwc.h"
+#elif defined RENGINE_BACKEND_HEADLESS
+#include "backend/headless/headlessbackend.h"
 #else
-#error "Please define which backend you want: RENGINE_BACKEND_SDL or RENGNE_BACKEND_SFHWC."
+#error "Please define which backend you want: RENGINE_BACKEND_SDL, RENGINE_BACKEND_SFHWC or RENGINE_BACKEND_HEADLESS."
 #endif
 
 #include "util/workqueue.h"
@@ -120,6 +120,9 @@ public:
             child->m_next = m_child;
         }
         child->setParent(this);
+        // Only the child has moved, its new siblings render as before.
+        child->m_changed = true;
+        markSubtreeDirty();
     }
 
     Node &operator<<(Node *child) { append(child); return *this; }
@@ -160,6 +163,7 @@ public:
         child->m_next = 0;
         child->m_prev = 0;
         child->setParent(0);
+        markSubtreeDirty();
     }
 
     // /*!
@@ -244,7 +248,7 @@ public:
      */
     Type type() const { return m_type; }
 
-    void requestPreprocess() { m_preprocess = true; }
+    void requestPreprocess() { m_preprocess = true; markDirty(); }
     void preprocess() {
         if (m_preprocess) {
             m_preprocess = false;
@@ -252,6 +256,60 @@ public:
         }
     }
 
+    /*!
+     * Marks this node and all its ancestors as changed. All setters which
+     * affect how the node is rendered call this, so the renderer can tell
+     * that it needs to process the scene again by looking at the root.
+     *
+     * Subclasses which change their rendered output without going through
+     * the built-in setters need to call this themselves.
+     */
+    void markDirty() {
+        m_changed = true;
+        markSubtreeDirty();
+    }
+
+    /*!
+     * Like markDirty(), but only marks how this node is composited as
+     * changed, such as a layer's opacity. What the subtree renders into a
+     * layer is unchanged, so the renderer can reuse a cached layer.
+     */
+    void markCompositionDirty() {
+        m_changed = true;
+        m_dirty = true;
+        if (m_parent)
+            m_parent->markSubtreeDirty();
+    }
+
+    /*!
+     * Returns true if this node or anything in its subtree has changed since
+     * the renderer last called clearDirty() on it.
+     */
+    bool isDirty() const { return m_dirty; }
+
+    /*!
+     * Returns true if the content of this node's subtree has changed, as
+     * opposed to only how the node is composited. See markCompositionDirty().
+     */
+    bool isContentDirty() const { return m_contentDirty; }
+
+    /*!
+     * Called by the renderer once it has picked up the node's state.
+     */
+    void clearDirty() {
+        m_dirty = false;
+        m_contentDirty = false;
+    }
+
+    /*!
+     * Returns true if this node itself, as opposed to something in its
+     * subtree, has changed since the renderer last called clearChanged() on
+     * it. Being added to a parent counts as a change to the node, so the
+     * renderer can tell which parts of the surface need to be repainted.
+     */
+    bool isChanged() const { return m_changed; }
+    void clearChanged() { m_changed = false; }
+
     static void dump(Node *n, unsigned level = 0)
     {
         for (unsigned x=0; x<level; ++x) std::cout << " ";
@@ -303,6 +361,9 @@ protected:
         , m_preprocess(false)
         , m_poolAllocated(false)
         , m_pointerTarget(false)
+        , m_dirty(true)
+        , m_contentDirty(true)
+        , m_changed(true)
     {
     }
 
@@ -331,6 +392,20 @@ protected:
         m_parent = p;
     }
 
+    /*!
+     * Marks this node and its ancestors as dirty, without marking this node
+     * itself as changed.
+     */
+    void markSubtreeDirty() {
+        // A dirty node always has fully dirty ancestors, so we can stop early.
+        Node *n = this;
+        while (n && !(n->m_dirty && n->m_contentDirty)) {
+            n->m_dirty = true;
+            n->m_contentDirty = true;
+            n = n->m_parent;
+        }
+    }
+
     Node *m_parent;
     Node *m_child;
     Node *m_next;
@@ -340,13 +415,21 @@ protected:
     unsigned m_preprocess : 1;
     unsigned m_poolAllocated : 1;
     unsigned m_pointerTarget : 1;
-    unsigned m_reserved : 21; // 32 - 11
+    unsigned m_dirty : 1;
+    unsigned m_contentDirty : 1;
+    unsigned m_changed : 1;
+    unsigned m_reserved : 18; // 32 - 14
 };
 
 class OpacityNode : public Node {
 public:
     float opacity() const { return m_opacity; }
-    void setOpacity(float opacity) { m_opacity = opacity; }
+    void setOpacity(float opacity) {
+        if (opacity == m_opacity)
+            return;
+        m_opacity = opacity;
+        markCompositionDirty();
+    }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(OpacityNode, rengine_OpacityNode);
 
@@ -373,10 +456,20 @@ class TransformNode : public Node
 {
 public:
     mat4 matrix() const { return m_matrix; }
-    void setMatrix(const mat4 &m) { m_matrix = m; }
+    void setMatrix(const mat4 &m) {
+        if (m == m_matrix)
+            return;
+        m_matrix = m;
+        markDirty();
+    }
 
     float projectionDepth() const { return m_projectionDepth; }
-    void setProjectionDepth(float d) { m_projectionDepth = d; }
+    void setProjectionDepth(float d) {
+        if (d == m_projectionDepth)
+            return;
+        m_projectionDepth = d;
+        markDirty();
+    }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(TransformNode, rengine_TransformNode);
 
@@ -408,8 +501,18 @@ public:
     void setMatrix_rotateAroundY(float radians) { setMatrix(mat4::rotateAroundY(radians)); }
     void setMatrix_rotateAroundZ(float radians) { setMatrix(mat4::rotateAroundZ(radians)); }
     void setMatrix_rotate2D(float radians) { setMatrix(mat4::rotate2D(radians)); }
-    void setMatrix_x(float x) { m_matrix.m[3] = x; }
-    void setMatrix_y(float y) { m_matrix.m[7] = y; }
+    void setMatrix_x(float x) {
+        if (m_matrix.m[3] == x)
+            return;
+        m_matrix.m[3] = x;
+        markDirty();
+    }
+    void setMatrix_y(float y) {
+        if (m_matrix.m[7] == y)
+            return;
+        m_matrix.m[7] = y;
+        markDirty();
+    }
 
 protected:
     TransformNode()
@@ -535,6 +638,7 @@ public:
         if (x == m_geometry.x())
             return;
         m_geometry.setX(x);
+        markDirty();
         onXChanged.emit(this);
     }
 
@@ -543,6 +647,7 @@ public:
         if (y == m_geometry.y())
             return;
         m_geometry.setY(y);
+        markDirty();
         onYChanged.emit(this);
     }
 
@@ -561,6 +666,7 @@ public:
         if (w == m_geometry.width())
             return;
         m_geometry.setWidth(w);
+        markDirty();
         onWidthChanged.emit(this);
     }
 
@@ -569,6 +675,7 @@ public:
         if (h == m_geometry.height())
             return;
         m_geometry.setHeight(h);
+        markDirty();
         onHeightChanged.emit(this);
     }
 
@@ -581,6 +688,7 @@ public:
         if (!updateX && !updateY && !updateW && !updateH)
             return;
         m_geometry = rect;
+        markDirty();
         if (updateX) onXChanged.emit(this);
         if (updateY) onYChanged.emit(this);
         if (updateW) onWidthChanged.emit(this);
@@ -625,6 +733,7 @@ public:
         if (c == m_color)
             return;
         m_color = color;
+        markDirty();
         onColorChanged.emit(this);
     }
 
@@ -649,7 +758,24 @@ protected:
 class TextureNode : public RectangleNodeBase {
 public:
     const Texture *texture() const { return m_texture; }
-    void setTexture(const Texture *texture) { m_texture = texture; }
+    void setTexture(const Texture *texture) {
+        if (texture == m_texture)
+            return;
+        m_texture = texture;
+        markDirty();
+    }
+
+    /*!
+     * The normalized sub-rectangle of the texture to draw. Defaults to the
+     * entire texture.
+     */
+    rect2d textureRect() const { return m_textureRect; }
+    void setTextureRect(rect2d rect) {
+        if (rect == m_textureRect)
+            return;
+        m_textureRect = rect;
+        markDirty();
+    }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(TextureNode, rengine_TextureNode);
 
@@ -669,11 +795,17 @@ protected:
     }
 
     const Texture *m_texture = nullptr;
+    rect2d m_textureRect = rect2d(0, 0, 1, 1);
 };
 
 class ColorFilterNode : public Node {
 public:
-    void setColorMatrix(const mat4 &matrix) { m_colorMatrix = matrix; }
+    void setColorMatrix(const mat4 &matrix) {
+        if (matrix == m_colorMatrix)
+            return;
+        m_colorMatrix = matrix;
+        markCompositionDirty();
+    }
     mat4 colorMatrix() const { return m_colorMatrix; }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(ColorFilterNode, rengine_ColorFilterNode);
@@ -699,7 +831,12 @@ class BlurNode : public Node {
 public:
     enum { StaticType = BlurNodeType };
 
-    void setRadius(unsigned radius) { m_radius = radius; }
+    void setRadius(unsigned radius) {
+        if (radius == m_radius)
+            return;
+        m_radius = radius;
+        markDirty();
+    }
     unsigned radius() const { return m_radius; }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(BlurNode, rengine_BlurNode);
@@ -722,13 +859,28 @@ class ShadowNode : public Node {
 public:
     enum { StaticType = ShadowNodeType };
 
-    void setRadius(unsigned radius) { m_radius = radius; }
+    void setRadius(unsigned radius) {
+        if (radius == m_radius)
+            return;
+        m_radius = radius;
+        markDirty();
+    }
     unsigned radius() const { return m_radius; }
 
-    void setOffset(vec2 offset) { m_offset = offset; }
+    void setOffset(vec2 offset) {
+        if (offset == m_offset)
+            return;
+        m_offset = offset;
+        markCompositionDirty();
+    }
     vec2 offset() const { return m_offset; }
 
-    void setColor(vec4 color) { m_color = color; }
+    void setColor(vec4 color) {
+        if (color == m_color)
+            return;
+        m_color = color;
+        markCompositionDirty();
+    }
     vec4 color() const { return m_color; }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(ShadowNode, rengine_ShadowNode);
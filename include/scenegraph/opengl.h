@@ -32,8 +32,14 @@
 #        include <GL/glew.h>
 #    endif
 #    define RENGINE_GLSL(code) "#define highp\n#define mediump\n#define lowp\n"#code
+#    ifdef __APPLE__
+#        define RENGINE_GL_APIENTRY
+#    else
+#        define RENGINE_GL_APIENTRY GLAPIENTRY
+#    endif
 #else
 #    include <EGL/egl.h>
 #    include <GLES2/gl2.h>
 #    define RENGINE_GLSL(code) #code
+#    define RENGINE_GL_APIENTRY GL_APIENTRY
 #endif
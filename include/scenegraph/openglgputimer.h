@@ -0,0 +1,291 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "common/common.h"
+
+#include "opengl.h"
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+#define RENGINE_GPU_TIMER_MAX_FRAMES 4
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Measures how long the GPU spends on each pass of a frame with
+    GL_TIME_ELAPSED queries, from OpenGL 3.3, GL_ARB_timer_query or
+    GL_EXT_disjoint_timer_query.
+
+    Time elapsed queries can't be nested, so switchTo() ends the query of the
+    current pass and begins one for the next. A layer rendered in the middle
+    of the main pass therefore counts towards its own pass only, and the
+    passes add up to the whole frame.
+
+    The results are read in collect() once the GPU has got that far, which
+    is typically a frame or two later. Nothing ever waits for them. When more
+    than RENGINE_GPU_TIMER_MAX_FRAMES frames are still pending, new frames
+    are not timed until they catch up.
+ */
+class OpenGLGpuTimer
+{
+public:
+    enum Pass {
+        NoPass = -1,
+        MainPass,
+        OpacityLayers,
+        ColorFilterLayers,
+        BlurLayers,
+        ShadowLayers,
+        PassCount
+    };
+
+    struct Timings {
+        bool available = false;         // false until a timed frame has completed
+        double passes[PassCount] = {};  // milliseconds
+
+        double total() const {
+            double t = 0;
+            for (double p : passes)
+                t += p;
+            return t;
+        }
+    };
+
+    ~OpenGLGpuTimer();
+
+    void initialize(bool supported, const char *extensions);
+    bool isSupported() const { return m_supported; }
+
+    void setEnabled(bool enabled) {
+        m_enabled = enabled;
+        if (!enabled)
+            m_timings = Timings();
+    }
+    bool isEnabled() const { return m_enabled; }
+
+    void beginFrame();
+    void endFrame();
+
+    /*!
+        Attributes what the GPU does from now on to \a pass and returns the
+        pass it was attributed to before.
+     */
+    Pass switchTo(Pass pass);
+
+    void collect();
+
+    /*!
+        Returns the timings of the last frame which has completed. They are
+        not available when timer queries are not supported or timing is not
+        enabled.
+     */
+    const Timings &timings() const { return m_timings; }
+
+private:
+    struct Query {
+        GLuint id;
+        Pass pass;
+    };
+    typedef std::vector<Query> Frame;
+
+    GLuint acquireQuery();
+
+    // The GLES 2 headers don't have these, see initialize()
+    typedef void (RENGINE_GL_APIENTRY *GenQueries)(GLsizei n, GLuint *ids);
+    typedef void (RENGINE_GL_APIENTRY *DeleteQueries)(GLsizei n, const GLuint *ids);
+    typedef void (RENGINE_GL_APIENTRY *BeginQuery)(GLenum target, GLuint id);
+    typedef void (RENGINE_GL_APIENTRY *EndQuery)(GLenum target);
+    typedef void (RENGINE_GL_APIENTRY *GetQueryObjectuiv)(GLuint id, GLenum pname, GLuint *params);
+    typedef void (RENGINE_GL_APIENTRY *GetQueryObjectui64v)(GLuint id, GLenum pname, uint64_t *params);
+    GenQueries m_genQueries = 0;
+    DeleteQueries m_deleteQueries = 0;
+    BeginQuery m_beginQuery = 0;
+    EndQuery m_endQuery = 0;
+    GetQueryObjectuiv m_getQueryObjectuiv = 0;
+    GetQueryObjectui64v m_getQueryObjectui64v = 0;
+
+    std::deque<Frame> m_pending;        // oldest first
+    Frame m_frame;                      // the one being timed
+    std::vector<GLuint> m_freeQueries;
+    Timings m_timings;
+    Pass m_pass = NoPass;
+    bool m_supported = false;
+    bool m_enabled = false;
+    bool m_disjointQuery = false;       // GL_EXT_disjoint_timer_query, where results can be invalid
+};
+
+inline OpenGLGpuTimer::~OpenGLGpuTimer()
+{
+    if (!m_supported)
+        return;
+    for (const Frame &f : m_pending)
+        for (const Query &q : f)
+            m_deleteQueries(1, &q.id);
+    for (const Query &q : m_frame)
+        m_deleteQueries(1, &q.id);
+    if (!m_freeQueries.empty())
+        m_deleteQueries(m_freeQueries.size(), m_freeQueries.data());
+}
+
+inline void OpenGLGpuTimer::initialize(bool supported, const char *extensions)
+{
+    m_supported = false;
+#if defined(RENGINE_OPENGL_DESKTOP) && !defined(__APPLE__)
+    if (!supported && !(extensions && std::strstr(extensions, "GL_ARB_timer_query")))
+        return;
+    m_genQueries = (GenQueries) glGenQueries;
+    m_deleteQueries = (DeleteQueries) glDeleteQueries;
+    m_beginQuery = (BeginQuery) glBeginQuery;
+    m_endQuery = (EndQuery) glEndQuery;
+    m_getQueryObjectuiv = (GetQueryObjectuiv) glGetQueryObjectuiv;
+    m_getQueryObjectui64v = (GetQueryObjectui64v) glGetQueryObjectui64v;
+#elif !defined(RENGINE_OPENGL_DESKTOP)
+    (void) supported;
+    if (!extensions || !std::strstr(extensions, "GL_EXT_disjoint_timer_query"))
+        return;
+    m_disjointQuery = true;
+    m_genQueries = (GenQueries) eglGetProcAddress("glGenQueriesEXT");
+    m_deleteQueries = (DeleteQueries) eglGetProcAddress("glDeleteQueriesEXT");
+    m_beginQuery = (BeginQuery) eglGetProcAddress("glBeginQueryEXT");
+    m_endQuery = (EndQuery) eglGetProcAddress("glEndQueryEXT");
+    m_getQueryObjectuiv = (GetQueryObjectuiv) eglGetProcAddress("glGetQueryObjectuivEXT");
+    m_getQueryObjectui64v = (GetQueryObjectui64v) eglGetProcAddress("glGetQueryObjectui64vEXT");
+#else
+    (void) supported;
+    (void) extensions;
+#endif
+    m_supported = m_genQueries && m_deleteQueries && m_beginQuery && m_endQuery
+                  && m_getQueryObjectuiv && m_getQueryObjectui64v;
+}
+
+inline GLuint OpenGLGpuTimer::acquireQuery()
+{
+    if (m_freeQueries.empty()) {
+        GLuint id;
+        m_genQueries(1, &id);
+        return id;
+    }
+    GLuint id = m_freeQueries.back();
+    m_freeQueries.pop_back();
+    return id;
+}
+
+inline void OpenGLGpuTimer::beginFrame()
+{
+    assert(m_pass == NoPass);
+    if (!m_enabled || !m_supported || m_pending.size() >= RENGINE_GPU_TIMER_MAX_FRAMES)
+        return;
+    switchTo(MainPass);
+}
+
+inline void OpenGLGpuTimer::endFrame()
+{
+    if (m_pass == NoPass)
+        return;
+    switchTo(NoPass);
+    m_pending.push_back(Frame());
+    std::swap(m_pending.back(), m_frame);
+}
+
+inline OpenGLGpuTimer::Pass OpenGLGpuTimer::switchTo(Pass pass)
+{
+    Pass previous = m_pass;
+    if (pass == previous)
+        return previous;
+    // Not timing this frame
+    if (previous == NoPass && pass != MainPass)
+        return previous;
+
+    if (previous != NoPass)
+        m_endQuery(GL_TIME_ELAPSED);
+    if (pass != NoPass) {
+        Query q = { acquireQuery(), pass };
+        m_beginQuery(GL_TIME_ELAPSED, q.id);
+        m_frame.push_back(q);
+    }
+    m_pass = pass;
+    return previous;
+}
+
+inline void OpenGLGpuTimer::collect()
+{
+    if (m_pending.empty())
+        return;
+
+#ifndef RENGINE_OPENGL_DESKTOP
+    // Something like a power state change makes the pending results
+    // meaningless. Reading the flag also resets it.
+    GLint disjoint = 0;
+    if (m_disjointQuery)
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) {
+        for (const Frame &f : m_pending)
+            for (const Query &q : f)
+                m_freeQueries.push_back(q.id);
+        m_pending.clear();
+        return;
+    }
+#endif
+
+    // Queries complete in order, so a frame is done when its last query is
+    while (!m_pending.empty()) {
+        const Frame &f = m_pending.front();
+        GLuint available = 0;
+        m_getQueryObjectuiv(f.back().id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        Timings timings;
+        timings.available = true;
+        for (const Query &q : f) {
+            uint64_t ns = 0;
+            m_getQueryObjectui64v(q.id, GL_QUERY_RESULT, &ns);
+            timings.passes[q.pass] += ns / 1000000.0;
+            m_freeQueries.push_back(q.id);
+        }
+        m_timings = timings;
+        m_pending.pop_front();
+    }
+}
+
+RENGINE_END_NAMESPACE
@@ -0,0 +1,302 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "common/common.h"
+#include "common/logging.h"
+
+#include "opengl.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Keeps linked shader programs on disk, using glGetProgramBinary() or
+    GL_OES_get_program_binary, so that the next run can load them rather
+    than compile and link them again.
+
+    Each program is stored in its own file in directory(), named after a
+    hash of the GL vendor, renderer and version strings and a hash of the
+    program's sources and attributes. A driver update or a change to a
+    shader therefore never picks up a stale binary. A binary which the
+    driver refuses to load is deleted and the program is compiled as usual.
+
+    The cache also keeps track of how many programs were compiled and how
+    many were loaded, and the time spent on each, whether or not a
+    directory is set.
+ */
+class OpenGLProgramCache
+{
+public:
+    /*!
+        Sets the directory that caches created from now on store programs
+        in. The directory must exist. An empty string, the default unless
+        the RENGINE_PROGRAM_CACHE_DIR environment variable is set, turns the
+        cache off.
+     */
+    static void setDefaultDirectory(const std::string &directory) { defaultDirectoryStorage() = directory; }
+    static std::string defaultDirectory() { return defaultDirectoryStorage(); }
+
+    /*!
+        Resolves the program binary functions and turns the cache on if
+        \a directory is set and the driver supports at least one binary
+        format. Needs a current GL context.
+     */
+    void initialize(const std::string &directory);
+
+    bool isActive() const { return m_active; }
+    const std::string &directory() const { return m_directory; }
+
+    uint64_t keyFor(const char *vsh, const char *fsh, const std::vector<const char *> &attrs) const;
+
+    /*!
+        Called before \a program is linked, so the driver knows that its
+        binary will be retrieved.
+     */
+    void prepare(GLuint program);
+
+    /*!
+        Loads the binary stored for \a key into \a program. Returns true if
+        the program is linked and ready to use.
+     */
+    bool load(GLuint program, uint64_t key);
+
+    /*!
+        Stores the binary of the linked \a program under \a key.
+     */
+    void store(GLuint program, uint64_t key);
+
+    void recordCompile(double seconds) { ++m_compiledPrograms; m_compileTime += seconds; }
+    void recordLoad(double seconds) { ++m_loadedPrograms; m_loadTime += seconds; }
+
+    unsigned compiledPrograms() const { return m_compiledPrograms; }
+    unsigned loadedPrograms() const { return m_loadedPrograms; }
+    double compileTime() const { return m_compileTime; }
+    double loadTime() const { return m_loadTime; }
+
+    static uint64_t hash(const char *data, size_t size, uint64_t h = 0xcbf29ce484222325ull) {
+        // 64-bit FNV-1a, which is stable across runs and platforms
+        for (size_t i=0; i<size; ++i)
+            h = (h ^ (unsigned char) data[i]) * 0x100000001b3ull;
+        return h;
+    }
+
+private:
+    struct Header {
+        char magic[4];
+        uint32_t format;
+        uint32_t size;
+        uint32_t reserved;
+        uint64_t driverKey;
+        uint64_t key;
+    };
+
+    static std::string &defaultDirectoryStorage() {
+        static std::string directory = std::getenv("RENGINE_PROGRAM_CACHE_DIR") ? std::getenv("RENGINE_PROGRAM_CACHE_DIR") : "";
+        return directory;
+    }
+
+    std::string fileName(uint64_t key) const;
+
+    typedef void (RENGINE_GL_APIENTRY *GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+    typedef void (RENGINE_GL_APIENTRY *ProgramBinary)(GLuint program, GLenum binaryFormat, const void *binary, GLint length);
+    typedef void (RENGINE_GL_APIENTRY *ProgramParameteri)(GLuint program, GLenum pname, GLint value);
+    GetProgramBinary m_getProgramBinary = 0;
+    ProgramBinary m_programBinary = 0;
+    ProgramParameteri m_programParameteri = 0;
+
+    std::string m_directory;
+    uint64_t m_driverKey = 0;
+    bool m_active = false;
+
+    unsigned m_compiledPrograms = 0;
+    unsigned m_loadedPrograms = 0;
+    double m_compileTime = 0;
+    double m_loadTime = 0;
+};
+
+inline void OpenGLProgramCache::initialize(const std::string &directory)
+{
+    m_directory = directory;
+    m_active = false;
+    if (directory.empty())
+        return;
+
+#if defined(RENGINE_OPENGL_DESKTOP) && !defined(__APPLE__)
+    m_getProgramBinary = (GetProgramBinary) glGetProgramBinary;
+    m_programBinary = (ProgramBinary) glProgramBinary;
+    m_programParameteri = (ProgramParameteri) glProgramParameteri;
+#elif !defined(RENGINE_OPENGL_DESKTOP)
+    // Core in OpenGL ES 3.0, GL_OES_get_program_binary before that
+    m_getProgramBinary = (GetProgramBinary) eglGetProcAddress("glGetProgramBinary");
+    m_programBinary = (ProgramBinary) eglGetProcAddress("glProgramBinary");
+    m_programParameteri = (ProgramParameteri) eglGetProcAddress("glProgramParameteri");
+    if (!m_getProgramBinary || !m_programBinary) {
+        m_getProgramBinary = (GetProgramBinary) eglGetProcAddress("glGetProgramBinaryOES");
+        m_programBinary = (ProgramBinary) eglGetProcAddress("glProgramBinaryOES");
+    }
+#endif
+    if (!m_getProgramBinary || !m_programBinary)
+        return;
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    glGetError(); // Not an error if the driver doesn't know the enum, just no formats
+    if (formats <= 0)
+        return;
+
+    std::string driver;
+    const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (GLenum s : strings) {
+        const char *value = (const char *) glGetString(s);
+        driver += value ? value : "";
+        driver += '\n';
+    }
+    m_driverKey = hash(driver.data(), driver.size());
+    m_active = true;
+}
+
+inline uint64_t OpenGLProgramCache::keyFor(const char *vsh, const char *fsh, const std::vector<const char *> &attrs) const
+{
+    // Include the terminating zeros, so that the parts can't run into
+    // each other
+    uint64_t h = hash(vsh, std::strlen(vsh) + 1);
+    h = hash(fsh, std::strlen(fsh) + 1, h);
+    for (const char *attr : attrs)
+        h = hash(attr, std::strlen(attr) + 1, h);
+    return h;
+}
+
+inline std::string OpenGLProgramCache::fileName(uint64_t key) const
+{
+    char name[48];
+    snprintf(name, sizeof(name), "%016llx-%016llx.bin", (unsigned long long) m_driverKey, (unsigned long long) key);
+    return m_directory + "/" + name;
+}
+
+inline void OpenGLProgramCache::prepare(GLuint program)
+{
+    if (m_active && m_programParameteri) {
+        m_programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glGetError();
+    }
+}
+
+inline bool OpenGLProgramCache::load(GLuint program, uint64_t key)
+{
+    if (!m_active)
+        return false;
+
+    std::string name = fileName(key);
+    FILE *file = fopen(name.c_str(), "rb");
+    if (!file)
+        return false;
+
+    Header header;
+    std::vector<char> binary;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+              && std::memcmp(header.magic, "RPC1", 4) == 0
+              && header.driverKey == m_driverKey
+              && header.key == key;
+    if (ok) {
+        binary.resize(header.size);
+        ok = fread(binary.data(), 1, binary.size(), file) == binary.size() && fgetc(file) == EOF;
+    }
+    fclose(file);
+
+    if (ok) {
+        m_programBinary(program, header.format, binary.data(), binary.size());
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        ok = glGetError() == GL_NO_ERROR && linked == GL_TRUE;
+    }
+
+    if (!ok) {
+        logw << "discarding invalid program binary: " << name << std::endl;
+        std::remove(name.c_str());
+    }
+    return ok;
+}
+
+inline void OpenGLProgramCache::store(GLuint program, uint64_t key)
+{
+    if (!m_active)
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (glGetError() != GL_NO_ERROR || length <= 0)
+        return;
+
+    Header header;
+    std::memcpy(header.magic, "RPC1", 4);
+    header.reserved = 0;
+    header.driverKey = m_driverKey;
+    header.key = key;
+    std::vector<char> binary(length);
+    GLsizei size = 0;
+    GLenum format = 0;
+    m_getProgramBinary(program, length, &size, &format, binary.data());
+    if (glGetError() != GL_NO_ERROR || size <= 0)
+        return;
+    header.format = format;
+    header.size = size;
+
+    // Write to a temporary file and rename it, so that another process
+    // never sees a partially written binary.
+    std::string name = fileName(key);
+    std::string temporary = name + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file) {
+        logw << "failed to write program binary: " << temporary << std::endl;
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(binary.data(), 1, size, file) == size_t(size);
+    ok = fclose(file) == 0 && ok;
+    if (!ok || std::rename(temporary.c_str(), name.c_str()) != 0) {
+        logw << "failed to write program binary: " << name << std::endl;
+        std::remove(temporary.c_str());
+    }
+}
+
+RENGINE_END_NAMESPACE
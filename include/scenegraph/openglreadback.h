@@ -0,0 +1,272 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "common/common.h"
+#include "common/logging.h"
+
+#include "opengl.h"
+#include "renderer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT 0x0001
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+#ifndef GL_WAIT_FAILED
+#define GL_WAIT_FAILED 0x911D
+#endif
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Reads pixels back from the current framebuffer.
+
+    read() does it with a single glReadPixels() call and flips the rows on
+    the CPU, so the GPU and the CPU wait for each other once.
+
+    start() copies the pixels into a pixel buffer object and puts a fence
+    after it, so the GPU can get on with it while the CPU carries on with the
+    next frame. poll() maps the buffers whose fence has been signalled and
+    hands their pixels to the PixelReadback. This needs pixel buffer objects,
+    glMapBufferRange() and fences, which is OpenGL 3.2 and OpenGL ES 3.0.
+    Without them, start() reads the pixels right away.
+ */
+class OpenGLReadback
+{
+public:
+    ~OpenGLReadback();
+
+    void initialize(bool supported);
+    bool isAsyncSupported() const { return m_supported; }
+
+    static void read(int x, int y, int w, int h, unsigned *pixels);
+
+    void start(const std::shared_ptr<PixelReadback> &readback);
+
+    /*!
+        Completes the pending reads whose fence has been signalled, or all
+        of them when \a wait is set.
+     */
+    void poll(bool wait);
+    unsigned pendingCount() const { return m_pending.size(); }
+
+private:
+    struct Buffer {
+        GLuint id;
+        unsigned size;
+    };
+
+    struct Pending {
+        std::shared_ptr<PixelReadback> readback;
+        Buffer buffer;
+        void *fence;
+    };
+
+    void complete(const Pending &pending);
+
+    // The GLES 2 headers don't have these and GLsync is a pointer, see
+    // initialize()
+    typedef void *(RENGINE_GL_APIENTRY *FenceSync)(GLenum condition, GLbitfield flags);
+    typedef GLenum (RENGINE_GL_APIENTRY *ClientWaitSync)(void *sync, GLbitfield flags, uint64_t timeout);
+    typedef void (RENGINE_GL_APIENTRY *DeleteSync)(void *sync);
+    typedef void *(RENGINE_GL_APIENTRY *MapBufferRange)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+    typedef GLboolean (RENGINE_GL_APIENTRY *UnmapBuffer)(GLenum target);
+    FenceSync m_fenceSync = 0;
+    ClientWaitSync m_clientWaitSync = 0;
+    DeleteSync m_deleteSync = 0;
+    MapBufferRange m_mapBufferRange = 0;
+    UnmapBuffer m_unmapBuffer = 0;
+
+    std::vector<Pending> m_pending;
+    std::vector<Buffer> m_freeBuffers;  // recycled once their read completes
+    bool m_supported = false;
+};
+
+inline OpenGLReadback::~OpenGLReadback()
+{
+    for (const Pending &p : m_pending) {
+        m_deleteSync(p.fence);
+        glDeleteBuffers(1, &p.buffer.id);
+    }
+    for (const Buffer &b : m_freeBuffers)
+        glDeleteBuffers(1, &b.id);
+}
+
+inline void OpenGLReadback::initialize(bool supported)
+{
+    m_supported = false;
+    if (!supported)
+        return;
+
+#if defined(RENGINE_OPENGL_DESKTOP) && !defined(__APPLE__)
+    m_fenceSync = (FenceSync) glFenceSync;
+    m_clientWaitSync = (ClientWaitSync) glClientWaitSync;
+    m_deleteSync = (DeleteSync) glDeleteSync;
+    m_mapBufferRange = (MapBufferRange) glMapBufferRange;
+    m_unmapBuffer = (UnmapBuffer) glUnmapBuffer;
+#elif !defined(RENGINE_OPENGL_DESKTOP)
+    m_fenceSync = (FenceSync) eglGetProcAddress("glFenceSync");
+    m_clientWaitSync = (ClientWaitSync) eglGetProcAddress("glClientWaitSync");
+    m_deleteSync = (DeleteSync) eglGetProcAddress("glDeleteSync");
+    m_mapBufferRange = (MapBufferRange) eglGetProcAddress("glMapBufferRange");
+    m_unmapBuffer = (UnmapBuffer) eglGetProcAddress("glUnmapBuffer");
+#endif
+    m_supported = m_fenceSync && m_clientWaitSync && m_deleteSync && m_mapBufferRange && m_unmapBuffer;
+}
+
+inline void OpenGLReadback::read(int x, int y, int w, int h, unsigned *pixels)
+{
+    glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    // GL has the bottom row first, we want the top one first
+    std::vector<unsigned> line(w);
+    for (int i=0; i<h/2; ++i) {
+        unsigned *a = pixels + i * w;
+        unsigned *b = pixels + (h - i - 1) * w;
+        std::memcpy(line.data(), a, w * sizeof(unsigned));
+        std::memcpy(a, b, w * sizeof(unsigned));
+        std::memcpy(b, line.data(), w * sizeof(unsigned));
+    }
+}
+
+inline void OpenGLReadback::start(const std::shared_ptr<PixelReadback> &readback)
+{
+    if (!m_supported) {
+        read(readback->x(), readback->y(), readback->width(), readback->height(), readback->bits());
+        readback->setReady();
+        return;
+    }
+
+    unsigned size = readback->width() * readback->height() * sizeof(unsigned);
+
+    // Take the smallest free buffer which is large enough
+    Pending p;
+    p.readback = readback;
+    auto best = m_freeBuffers.end();
+    for (auto i = m_freeBuffers.begin(); i != m_freeBuffers.end(); ++i) {
+        if (i->size >= size && (best == m_freeBuffers.end() || i->size < best->size))
+            best = i;
+    }
+    bool allocate = best == m_freeBuffers.end();
+    if (allocate) {
+        glGenBuffers(1, &p.buffer.id);
+        p.buffer.size = size;
+    } else {
+        p.buffer = *best;
+        m_freeBuffers.erase(best);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, p.buffer.id);
+    if (allocate)
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+    glReadPixels(readback->x(), readback->y(), readback->width(), readback->height(), GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    p.fence = m_fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_pending.push_back(p);
+}
+
+inline void OpenGLReadback::poll(bool wait)
+{
+    if (m_pending.empty())
+        return;
+
+    // Make sure the fences reach the GPU, so that they will be signalled
+    glFlush();
+
+    // Reads complete in the order they were started, so we can stop at the
+    // first one which isn't done.
+    unsigned done = 0;
+    for (const Pending &p : m_pending) {
+        GLenum status = m_clientWaitSync(p.fence, 0, 0);
+        while (wait && status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED && status != GL_WAIT_FAILED)
+            status = m_clientWaitSync(p.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED && status != GL_WAIT_FAILED)
+            break;
+        complete(p);
+        ++done;
+    }
+    m_pending.erase(m_pending.begin(), m_pending.begin() + done);
+
+    // Keep a few buffers around for the next reads
+    while (m_freeBuffers.size() > 3) {
+        glDeleteBuffers(1, &m_freeBuffers.front().id);
+        m_freeBuffers.erase(m_freeBuffers.begin());
+    }
+}
+
+inline void OpenGLReadback::complete(const Pending &p)
+{
+    m_deleteSync(p.fence);
+
+    PixelReadback *readback = p.readback.get();
+    int w = readback->width();
+    int h = readback->height();
+    unsigned stride = w * sizeof(unsigned);
+
+    // Nobody is waiting for it anymore, so don't bother with the copy
+    if (p.readback.use_count() > 1) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, p.buffer.id);
+        const unsigned char *src = (const unsigned char *) m_mapBufferRange(GL_PIXEL_PACK_BUFFER, 0, h * stride, GL_MAP_READ_BIT);
+        if (src) {
+            // GL has the bottom row first, we want the top one first
+            unsigned char *dst = (unsigned char *) readback->bits();
+            for (int i=0; i<h; ++i)
+                std::memcpy(dst + i * stride, src + (h - i - 1) * stride, stride);
+            m_unmapBuffer(GL_PIXEL_PACK_BUFFER);
+            readback->setReady();
+        } else {
+            logw << "failed to map pixel buffer, readback is lost" << std::endl;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    m_freeBuffers.push_back(p.buffer);
+}
+
+RENGINE_END_NAMESPACE
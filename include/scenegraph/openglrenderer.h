@@ -29,40 +29,208 @@
 
 #include "common/logging.h"
 
+#include "openglgputimer.h"
+#include "openglreadback.h"
 #include "openglrenderer_shaders.h"
 #include "openglshaderprogram.h"
 #include "opengltexture.h"
+#include "opengltextureatlas.h"
 #include "node.h"
 
 #include "windowsystem/surface.h"
 
+#include "util/workqueue.h"
+
+#include <chrono>
 #include <stack>
 #include <stdio.h>
-#include <alloca.h>
 #include <iomanip>
 #include <cstring>
+#include <cstddef>
 #include <vector>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <algorithm>
 
 RENGINE_BEGIN_NAMESPACE
 
+// Batches are drawn using 16-bit indices, 4 vertices per quad.
+#define RENGINE_RENDERER_MAX_BATCH_QUADS 16384
+
+// Layer textures are allocated in multiples of this size
+#define RENGINE_RENDERER_LAYER_TEXTURE_GRANULARITY 64
+
+// Free layer textures are deleted after this many frames without being used
+#define RENGINE_RENDERER_TEXTURE_POOL_MAX_AGE 60
+
+// The default memory limit for free layer textures, see
+// OpenGLRenderer::setTexturePoolLimit()
+#define RENGINE_RENDERER_TEXTURE_POOL_LIMIT (64 * 1024 * 1024)
+
+// Changed ranges in a retained buffer which are closer than this many
+// elements are merged and uploaded together.
+#define RENGINE_RENDERER_RETAINED_MERGE_DISTANCE 64
+
+// With OpenGLRenderer::AutomaticBlur, blurs with a larger radius than this
+// are done on a downsampled copy of the layer, halving its resolution until
+// the radius fits or the max number of levels is reached.
+#define RENGINE_RENDERER_BLUR_DOWNSAMPLE_RADIUS 8
+#define RENGINE_RENDERER_BLUR_MAX_LEVELS 4
+
+// The opaque pass gives each element its own depth value, at most this many.
+// Scenes with more elements are drawn without it.
+#define RENGINE_RENDERER_DEPTH_STEPS 65535
+
+// How many frames of damage the renderer remembers. Buffers older than this
+// are repainted in full.
+#define RENGINE_RENDERER_MAX_BUFFER_AGE 4
+
+// Scenes with fewer rectangles and textures than this are always built on
+// the rendering thread, as handing the work out costs more than it saves.
+#define RENGINE_RENDERER_PARALLEL_BUILD_MIN_NODES 4096
+
+inline void rengine_create_texture(int id, int w, int h)
+{
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+}
+
 class OpenGLRenderer : public Renderer
 {
 public:
 
-    // FIXME: can't inherit from std::
-    struct TexturePool : public std::vector<GLuint>
+    /*!
+        Pool of the textures used for layers. Textures are allocated in size
+        classes, so a texture can be reused for any layer which rounds up to
+        the same size without reallocating its storage. A layer renders into
+        the top-left part of its texture and is sampled using
+        layerTextureScale().
+
+        Free textures which have not been used for a while are deleted, as
+        are the least recently used free textures when the pool grows beyond
+        its memory limit.
+     */
+    struct TexturePool
     {
+        struct Entry {
+            GLuint id;
+            unsigned width;
+            unsigned height;
+            unsigned lastUsed;
+            bool inUse;
+        };
+
         ~TexturePool()
         {
-            glDeleteTextures(size(), data());
+            for (const Entry &e : entries)
+                glDeleteTextures(1, &e.id);
+        }
+
+        static unsigned sizeClass(float size) {
+            const unsigned g = RENGINE_RENDERER_LAYER_TEXTURE_GRANULARITY;
+            return std::max<unsigned>(1, (unsigned(std::ceil(size)) + g - 1) / g) * g;
+        }
+
+        GLuint acquire(vec2 size) {
+            unsigned w = sizeClass(size.x);
+            unsigned h = sizeClass(size.y);
+            for (Entry &e : entries) {
+                if (!e.inUse && e.width == w && e.height == h) {
+                    ++hits;
+                    e.inUse = true;
+                    return e.id;
+                }
+            }
+
+            ++misses;
+            unsigned bytes = w * h * 4;
+            evict(limit > bytes ? limit - bytes : 0);
+            Entry e = { 0, w, h, frame, true };
+            glGenTextures(1, &e.id);
+            rengine_create_texture(e.id, w, h);
+            entries.push_back(e);
+            memory += bytes;
+            return e.id;
+        }
+
+        void release(GLuint id) {
+            assert(id > 0);
+            for (Entry &e : entries) {
+                if (e.id == id) {
+                    assert(e.inUse);
+                    e.inUse = false;
+                    e.lastUsed = frame;
+                    return;
+                }
+            }
+            assert(false);
+        }
+
+        // Called once per frame
+        void trim() {
+            ++frame;
+            for (unsigned i=0; i<entries.size(); ) {
+                if (!entries[i].inUse && frame - entries[i].lastUsed > RENGINE_RENDERER_TEXTURE_POOL_MAX_AGE)
+                    remove(i);
+                else
+                    ++i;
+            }
+            evict(limit);
+        }
+
+        // Deletes the least recently used free textures until memory is
+        // below 'bytes' or no free textures are left.
+        void evict(unsigned bytes) {
+            while (memory > bytes) {
+                int lru = -1;
+                for (unsigned i=0; i<entries.size(); ++i) {
+                    if (!entries[i].inUse && (lru < 0 || entries[i].lastUsed < entries[lru].lastUsed))
+                        lru = i;
+                }
+                if (lru < 0)
+                    return;
+                remove(lru);
+            }
+        }
+
+        void remove(unsigned i) {
+            memory -= entries[i].width * entries[i].height * 4;
+            glDeleteTextures(1, &entries[i].id);
+            entries[i] = entries.back();
+            entries.pop_back();
+        }
+
+        std::vector<Entry> entries;
+        unsigned frame = 0;
+        unsigned memory = 0;
+        unsigned limit = RENGINE_RENDERER_TEXTURE_POOL_LIMIT;
+        unsigned hits = 0;
+        unsigned misses = 0;
+    };
+
+    // Framebuffer objects are expensive to create and validate, so the ones
+    // used for layers are kept around and only have their color attachment
+    // changed.
+    struct FramebufferPool : public std::vector<GLuint>
+    {
+        ~FramebufferPool()
+        {
+            glDeleteFramebuffers(size(), data());
         }
 
         GLuint acquire() {
             GLuint id;
             if (empty()) {
-                glGenTextures(1, &id);
+                ++misses;
+                glGenFramebuffers(1, &id);
                 return id;
             }
+            ++hits;
             id = back();
             pop_back();
             return id;
@@ -73,41 +241,304 @@ public:
             push_back(id);
         }
 
-        void compact() {
-            glFlush();
-            for (auto id : *this) {
-                glBindTexture(GL_TEXTURE_2D, id);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-            }
-        }
+        unsigned hits = 0;
+        unsigned misses = 0;
     };
 
     struct Element {
         Node *node;
-        unsigned vboOffset;         // offset into vbo for flattened, rect and layer nodes
+        unsigned vboOffset;         // offset into vbo for flattened, rect and layer nodes, or into
+                                    // the instance buffers when 'instanced' is set
         float z;                    // only valid when 'projection' is set
         unsigned texture;           // only valid during rendering when 'layered' is set.
         unsigned sourceTexture;     // only valid during rendering when 'layered' is set and we have a shadow node
-        unsigned groupSize : 29;    // The size of this group, used with 'projection' and 'layered'. Packed to ft into 32-bit
+        unsigned groupSize : 27;    // The size of this group, used with 'projection' and 'layered'. Packed to ft into 32-bit
                                     // The groupSize is the number of nodes inside the group, excluding the parent.
+        unsigned instanced : 1;     // rect or texture drawn from the instance buffers
         unsigned projection : 1;    // 3d subtree
         unsigned layered : 1;       // subtree is flattened into a layer (texture)
         unsigned completed : 1;     // used during the actual rendering to know we're done with it
+        unsigned cached : 1;        // 'texture' and 'sourceTexture' are owned by the layer cache
+
+    };
+    // A flattened layer which is kept across frames, keyed on the layer node.
+    struct CachedLayer {
+        GLuint texture = 0;
+        GLuint sourceTexture = 0;   // the unblurred layer, for shadows
+        vec2 size;                  // the size of the flattened subtree
+        vec2 expandedSize;          // the size of 'texture' for blur and shadow
+        mat4 matrix;                // the layer's 2d transform when it was built
+        bool used = false;          // whether the layer was part of the last build
+    };
+    // The depth order of the elements in a 3D projection from the last
+    // frame, keyed on the projection's transform node.
+    struct ProjectionOrder {
+        std::vector<unsigned> order;    // offsets into the group of the elements to draw, back to front
+        bool used = false;          // whether the projection was part of the last build
+    };
+
+    struct PackedColor {
+        unsigned char r, g, b, a;   // premultiplied
+    };
+
+    // The 2D affine part of a node's transform, as two rows, for instancing
+    struct InstanceTransform {
+        vec3 row0;
+        vec3 row1;
+    };
+
+    // A run of sibling subtrees, [first, last), built on a build thread.
+    struct BuildChunk : public WorkQueue::Job {
+        struct Quad {
+            Node *node;
+            vec2 v[4];
+            rect2d bounds;
+            PackedColor color;      // for rectangle nodes
+            vec2 texCoords[4];      // for texture nodes
+            rect2d geometry;        // for instancing
+            InstanceTransform transform;
+            bool changed;
+        };
+        void onExecute() override;
+        void build(Node *n, const mat4 &m, bool changedAncestor);
+        void buildRange(Node *first, Node *last, const mat4 &m, bool changedAncestor);
+        void addQuad(Node *n, const mat4 &m, const vec2 *v, bool changed);
+        static bool isSimple(Node *n);
+
+        Node *first = 0;
+        Node *last = 0;
+        mat4 matrix;
+        rect2d cullRect;
+        bool changed = false;
+        bool simple = false;        // false if the chunk has to be built serially
+        unsigned culled = 0;
+        std::vector<Quad> quads;    // keeps its capacity from frame to frame
+        std::vector<rect2d> siblingRects;
+        std::vector<vec2> siblingVertices;
+    };
+
+    /*!
+        A vertex attribute buffer which is kept alive across frames. Each
+        drawable's vertices live at the same offset from frame to frame as
+        long as the scene's structure does not change. Writes are compared
+        to what was written in the previous frame and only the ranges which
+        actually changed are uploaded, using glBufferSubData.
+
+        Writes are expected to come in increasing order, which is how
+        build() allocates vertices.
+     */
+    template <typename T>
+    struct RetainedBuffer {
+        ~RetainedBuffer() { glDeleteBuffers(1, &id); }
+
+        void resize(unsigned size) {
+            if (data.size() < size)
+                data.resize(size + size / 4);
+        }
 
-        bool operator<(const Element &e) const { return e.completed || z < e.z; }
+        void write(unsigned offset, const T *values, unsigned count) {
+            assert(offset + count <= data.size());
+            T *dst = data.data() + offset;
+            if (memcmp(dst, values, count * sizeof(T)) == 0)
+                return;
+            memcpy(dst, values, count * sizeof(T));
+            if (!dirty.empty() && dirty.back() + RENGINE_RENDERER_RETAINED_MERGE_DISTANCE >= offset) {
+                dirty.back() = std::max(dirty.back(), offset + count);
+            } else {
+                dirty.push_back(offset);
+                dirty.push_back(offset + count);
+            }
+        }
+
+        // Uploads the changes and returns the number of bytes uploaded. The
+        // buffer is left bound to GL_ARRAY_BUFFER.
+        unsigned upload() {
+            glBindBuffer(GL_ARRAY_BUFFER, id);
+            unsigned bytes = 0;
+            if (capacity < data.size()) {
+                capacity = data.size();
+                bytes = capacity * sizeof(T);
+                glBufferData(GL_ARRAY_BUFFER, bytes, data.data(), GL_DYNAMIC_DRAW);
+            } else {
+                for (unsigned i=0; i<dirty.size(); i+=2) {
+                    unsigned size = (dirty[i+1] - dirty[i]) * sizeof(T);
+                    glBufferSubData(GL_ARRAY_BUFFER, dirty[i] * sizeof(T), size, data.data() + dirty[i]);
+                    bytes += size;
+                }
+            }
+            dirty.clear();
+            return bytes;
+        }
+
+        GLuint id = 0;
+        unsigned capacity = 0;
+        std::vector<T> data;
+        std::vector<unsigned> dirty;    // [begin, end) pairs, in elements
     };
     struct Program : OpenGLShaderProgram {
-        int matrix;
+        int matrix = -1;
+        bool ready = false;             // compiled and its uniforms resolved
+        std::function<void()> start;    // starts compiling, set up by setupProgram()
+        std::function<void()> uniforms; // resolves the uniforms other than 'm'
+
+        // The values last set for the program's uniforms, see GLState
+        struct UniformValue {
+            int location;
+            float v[16];
+        };
+        std::vector<UniformValue> values;
+    };
+
+    /*!
+        Shadows the GL state which the draw functions set for every quad:
+        the bound texture and array buffer, the vertex attribute pointers,
+        blending and the uniform values of each program. Calls which would
+        not change anything are skipped and counted.
+
+        Render nodes and texture allocation change GL state behind its back,
+        so the state is invalidated after them, and at the start of each
+        frame.
+     */
+    struct GLState
+    {
+        static const unsigned MaxAttributes = 5;
+        static const GLuint Unknown = 0xffffffff;
+
+        struct Attribute {
+            GLuint buffer;
+            GLint size;
+            GLenum type;
+            GLboolean normalized;
+            GLsizei stride;
+            size_t offset;
+        };
+
+        GLState() { invalidate(); }
+
+        void invalidate() {
+            texture = Unknown;
+            arrayBuffer = Unknown;
+            for (Attribute &a : attributes)
+                a.buffer = Unknown;
+            blending = -1;
+        }
+
+        void bindTexture(GLuint id) {
+            if (id == texture) {
+                ++skipped;
+                return;
+            }
+            ++issued;
+            texture = id;
+            glBindTexture(GL_TEXTURE_2D, id);
+        }
+
+        void bindArrayBuffer(GLuint id) {
+            if (id == arrayBuffer) {
+                ++skipped;
+                return;
+            }
+            ++issued;
+            arrayBuffer = id;
+            glBindBuffer(GL_ARRAY_BUFFER, id);
+        }
+
+        // Points \a index at \a offset in the currently bound array buffer
+        void attribute(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, size_t offset) {
+            assert(index < MaxAttributes);
+            assert(arrayBuffer != Unknown);
+            Attribute &a = attributes[index];
+            if (a.buffer == arrayBuffer && a.offset == offset && a.size == size
+                && a.type == type && a.normalized == normalized && a.stride == stride) {
+                ++skipped;
+                return;
+            }
+            ++issued;
+            a = { arrayBuffer, size, type, normalized, stride, offset };
+            glVertexAttribPointer(index, size, type, normalized, stride, (void *) offset);
+        }
+
+        void setBlending(bool enabled) {
+            if (blending == int(enabled)) {
+                ++skipped;
+                return;
+            }
+            ++issued;
+            blending = enabled;
+            if (enabled)
+                glEnable(GL_BLEND);
+            else
+                glDisable(GL_BLEND);
+        }
+
+        // Returns true if the \a count floats in \a v differ from what was
+        // last set for \a location in \a program and remembers them.
+        bool uniformChanged(Program *program, int location, const float *v, unsigned count) {
+            assert(count <= 16);
+            for (Program::UniformValue &u : program->values) {
+                if (u.location == location) {
+                    if (std::memcmp(u.v, v, count * sizeof(float)) == 0) {
+                        ++skipped;
+                        return false;
+                    }
+                    std::memcpy(u.v, v, count * sizeof(float));
+                    ++issued;
+                    return true;
+                }
+            }
+            program->values.push_back(Program::UniformValue());
+            program->values.back().location = location;
+            std::memcpy(program->values.back().v, v, count * sizeof(float));
+            ++issued;
+            return true;
+        }
+
+        void uniform(Program *program, int location, float v) {
+            if (uniformChanged(program, location, &v, 1))
+                glUniform1f(location, v);
+        }
+        void uniform(Program *program, int location, vec2 v) {
+            if (uniformChanged(program, location, &v.x, 2))
+                glUniform2f(location, v.x, v.y);
+        }
+        void uniform(Program *program, int location, vec4 v) {
+            if (uniformChanged(program, location, &v.x, 4))
+                glUniform4f(location, v.x, v.y, v.z, v.w);
+        }
+        void uniform(Program *program, int location, const mat4 &m) {
+            if (uniformChanged(program, location, m.m, 16))
+                glUniformMatrix4fv(location, 1, true, m.m);
+        }
+
+        GLuint texture;
+        GLuint arrayBuffer;
+        Attribute attributes[MaxAttributes];
+        int blending;       // -1 when unknown
+
+        unsigned issued = 0;
+        unsigned skipped = 0;
     };
     enum ProgramUpdate {
-        UpdateSolidProgram          = 0x01,
-        UpdateTextureProgram        = 0x02,
-        UpdateTextureBgrProgram     = 0x04,
-        UpdateAlphaTextureProgram   = 0x08,
-        UpdateColorFilterProgram    = 0x10,
-        UpdateBlurProgram           = 0x20,
-        UpdateShadowProgram         = 0x40,
-        UpdateAllPrograms           = 0xffffffff
+        UpdateSolidProgram               = 0x01,
+        UpdateTextureProgram             = 0x02,
+        UpdateTextureBgrProgram          = 0x04,
+        UpdateAlphaTextureProgram        = 0x08,
+        UpdateColorFilterProgram         = 0x10,
+        UpdateBlurProgram                = 0x20,
+        UpdateShadowProgram              = 0x40,
+        UpdateSolidBatchedProgram        = 0x80,
+        UpdateSolidInstancedProgram      = 0x100,
+        UpdateTextureInstancedProgram    = 0x200,
+        UpdateTextureBgrInstancedProgram = 0x400,
+        UpdateSolidOpaqueProgram         = 0x800,
+        UpdateTextureOpaqueProgram       = 0x1000,
+        UpdateTextureBgrOpaqueProgram    = 0x2000,
+        UpdateAllPrograms                = 0xffffffff
+    };
+    enum BlurMode {
+        AutomaticBlur,
+        FullResolutionBlur,
+        DownsampledBlur
     };
 
     OpenGLRenderer();
@@ -117,22 +548,335 @@ public:
 
     void initialize() override;
     bool render() override;
-    void frameSwapped() override { m_texturePool.compact(); }
+    void frameSwapped() override;
     bool readPixels(int x, int y, int w, int h, unsigned *pixels) override;
 
+    /*!
+        Reads the pixels into a pixel buffer object, which is mapped in a
+        later frameSwapped() once the GPU has got that far, so neither the
+        GPU nor the CPU waits for the other. Without support for it, the
+        pixels are read right away.
+     */
+    std::shared_ptr<PixelReadback> readPixelsAsync(int x, int y, int w, int h) override;
+    void finishReadbacks() override { m_readback.poll(true); }
+    bool asyncReadbackSupported() const { return m_readback.isAsyncSupported(); }
+    unsigned readbacksPending() const { return m_readback.pendingCount(); }
+
+    /*!
+        When GPU timing is enabled, the time the GPU spends on the main pass
+        and on opacity, color filter, blur and shadow layers is measured
+        with timer queries. The results are picked up in frameSwapped() a
+        few frames later, so the CPU never waits for them, and gpuTimings()
+        returns those of the most recent frame the GPU has finished. Layers
+        reused from the layer cache cost nothing and are not counted.
+
+        Disabled by default. Without timer query support, the timings are
+        never available.
+     */
+    void setGpuTimingEnabled(bool enabled) { m_gpuTimer.setEnabled(enabled); }
+    bool gpuTimingEnabled() const { return m_gpuTimer.isEnabled(); }
+    bool gpuTimingSupported() const { return m_gpuTimer.isSupported(); }
+    const OpenGLGpuTimer::Timings &gpuTimings() const { return m_gpuTimer.timings(); }
+
+    /*!
+        When batching is enabled, runs of adjacent rectangle nodes and runs of
+        adjacent texture nodes sharing the same texture are drawn with a
+        single draw call. Enabled by default.
+     */
+    void setBatchingEnabled(bool enabled) { m_batching = enabled; }
+    bool batchingEnabled() const { return m_batching; }
+
+    /*!
+        Returns the number of draw calls which were saved by batching in
+        the last frame.
+     */
+    unsigned drawCallsSaved() const { return m_drawCallsSaved; }
+
+    /*!
+        Returns the number of vertex and instance bytes which were uploaded
+        in the last frame. For a scene which did not change, this is zero.
+     */
+    unsigned vertexBytesUploaded() const { return m_vertexBytesUploaded; }
+
+    /*!
+        Returns how many texture and buffer bindings, vertex attribute
+        pointers, blend state changes, uniforms and program switches were
+        passed on to GL in the last frame, and how many were skipped because
+        GL already had that state.
+     */
+    unsigned glCallsIssued() const { return m_state.issued; }
+    unsigned glCallsSkipped() const { return m_state.skipped; }
+
+    /*!
+        Returns true if the last frame had to run prepass() and build() over
+        the scene. When nothing in the scene has changed, the elements and
+        vertices from the previous frame are reused and this returns false.
+     */
+    bool sceneRebuilt() const { return m_sceneRebuilt; }
+
+    /*!
+        When layer caching is enabled, the textures that opacity, color
+        filter, blur and shadow nodes flatten their subtrees into are kept
+        across frames. A layer is only rendered again when something inside
+        its subtree changes or it is transformed other than by whole pixel
+        translation. Layers inside 3D projections and layers containing
+        render nodes are never cached. Disabled by default.
+
+        Changes to the content of a texture are not noticed by themselves, so
+        a layer showing a texture which is uploaded again would keep its old
+        content. Mark the texture nodes using it as dirty.
+     */
+    void setLayerCachingEnabled(bool enabled) { m_layerCaching = enabled; m_builtSceneRoot = 0; }
+    bool layerCachingEnabled() const { return m_layerCaching; }
+
+    /*!
+        Returns the number of layers which were drawn from the layer cache in
+        the last frame, rather than being rendered again.
+     */
+    unsigned layerCacheHits() const { return m_layerCacheHits; }
+
+    /*!
+        Returns how many times a layer got its framebuffer object from the
+        pool and how many times a new one had to be created, since the
+        renderer was created.
+     */
+    unsigned framebufferPoolHits() const { return m_framebufferPool.hits; }
+    unsigned framebufferPoolMisses() const { return m_framebufferPool.misses; }
+
+    /*!
+        Sets the amount of memory, in bytes, that unused layer textures are
+        allowed to hold on to. Textures in use are not counted against the
+        limit and are never deleted.
+     */
+    void setTexturePoolLimit(unsigned bytes) { m_texturePool.limit = bytes; m_texturePool.evict(bytes); }
+    unsigned texturePoolLimit() const { return m_texturePool.limit; }
+
+    /*!
+        Returns the memory, in bytes, held by layer textures, both in use and
+        free, and how many times a layer texture was reused or allocated
+        since the renderer was created.
+     */
+    unsigned texturePoolMemory() const { return m_texturePool.memory; }
+    unsigned texturePoolHits() const { return m_texturePool.hits; }
+    unsigned texturePoolMisses() const { return m_texturePool.misses; }
+
+    /*!
+        When the texture atlas is enabled, createTextureFromImageData() will
+        place small images into shared atlas pages so that they can be
+        batched. Enabled by default.
+     */
+    void setTextureAtlasEnabled(bool enabled) { m_atlasing = enabled; }
+    bool textureAtlasEnabled() const { return m_atlasing; }
+    OpenGLTextureAtlas *textureAtlas() { return &m_atlas; }
+
+    /*!
+        Decides how blur nodes are rendered. FullResolutionBlur runs the
+        gaussian over the layer as is, which costs in proportion to the
+        radius for every pixel. DownsampledBlur first halves the layer's
+        resolution one or more times, blurs with a correspondingly smaller
+        radius and scales the result back up when it is drawn. AutomaticBlur,
+        the default, downsamples only when the radius is larger than
+        RENGINE_RENDERER_BLUR_DOWNSAMPLE_RADIUS.
+
+        Shadow nodes are always blurred at full resolution.
+     */
+    void setBlurMode(BlurMode mode);
+    BlurMode blurMode() const { return m_blurMode; }
+
+    /*!
+        When the opaque pass is enabled, opaque rectangles and textures
+        without alpha are drawn first, front-to-back with depth writes and
+        without blending, so that pixels covered by something opaque on top
+        are rejected by the depth test rather than shaded and blended. The
+        remaining elements are then drawn back-to-front, depth tested against
+        the opaque ones.
+
+        Each opaque element has its own depth, passed per vertex, so adjacent
+        opaque elements are still batched and their quads are drawn in
+        reverse order. Instancing is not used while the opaque pass is
+        enabled, as instances can't be drawn in reverse order.
+
+        Only elements outside of layers and 3D projections are drawn in the
+        opaque pass. The pass needs a depth buffer on the target surface and
+        is skipped for scenes with render nodes or more than
+        RENGINE_RENDERER_DEPTH_STEPS elements. Disabled by default.
+     */
+    void setOpaquePassEnabled(bool enabled) { m_opaquePass = enabled; m_builtSceneRoot = 0; }
+    bool opaquePassEnabled() const { return m_opaquePass; }
+
+    /*!
+        Returns the number of elements which were drawn in the opaque pass in
+        the last frame.
+     */
+    unsigned opaquePassElements() const { return m_opaquePassElements; }
+
+    /*!
+        Returns the number of rectangle, texture and layer nodes which were
+        left out of the last build because they were entirely outside the
+        target surface. Layers which are partially outside are clamped to
+        the part which can affect the surface.
+     */
+    unsigned culledNodes() const { return m_culledNodes; }
+
+    /*!
+        When damage tracking is enabled and the target surface reports a
+        buffer age, see Surface::bufferAge(), the renderer keeps track of
+        where rectangle, texture and layer nodes were drawn in the last few
+        frames and only repaints, scissored, the parts of the buffer which
+        are out of date. The repainted part is passed to
+        Surface::setDamage(). Scenes with 3D projections or render nodes, and
+        changes to the fill color, are always repainted in full. So is a
+        buffer of unknown age. When nothing needs repainting, nothing is
+        drawn and FrameStats::surfaceUnchanged is set, so the frame doesn't
+        need to be presented.
+
+        Changes to the content of a texture are not noticed by themselves, so
+        damage tracking is disabled by default. Mark the texture nodes using
+        a texture as dirty when its content changes.
+     */
+    void setDamageTrackingEnabled(bool enabled) { m_damageTrackingEnabled = enabled; }
+    bool damageTrackingEnabled() const { return m_damageTrackingEnabled; }
+
+    /*!
+        Returns the part of the surface which was repainted in the last
+        frame, in device pixels.
+     */
+    rect2d repaintedRect() const { return m_repaintRect; }
+
+    /*!
+        Returns the number of times the layer for a blur with \a radius is
+        downsampled, 0 meaning it is blurred at full resolution.
+     */
+    unsigned blurLevels(unsigned radius) const;
+
+    /*!
+        Sets the number of threads which build the scene in parallel with
+        the rendering thread after it has changed. 0, the default, builds
+        the scene on the rendering thread only. Only scenes with at least
+        RENGINE_RENDERER_PARALLEL_BUILD_MIN_NODES rectangles and textures are
+        built in parallel.
+     */
+    void setBuildThreadCount(unsigned count) { m_buildThreadCount = count; m_builtSceneRoot = 0; }
+    unsigned buildThreadCount() const { return m_buildThreadCount; }
+
+    /*!
+        When instancing is enabled and supported, rectangle and texture nodes
+        are drawn with glDrawArraysInstanced. Each node is one record of
+        per-instance attributes, its geometry, its 2D transform and its color
+        or texture sub-rectangle, and the transform is applied in the vertex
+        shader rather than on the CPU. Moving a node then only uploads its
+        geometry and changing its color only its color. Nodes inside 3D
+        projections are always drawn from transformed vertices. Enabled by
+        default.
+
+        Instancing is supported on OpenGL 3.3 and OpenGL ES 3.0 and later,
+        which is decided from the version string in initialize(). Other
+        versions use the regular path.
+     */
+    void setInstancingEnabled(bool enabled) { m_instancingEnabled = enabled; m_builtSceneRoot = 0; }
+    bool instancingEnabled() const { return m_instancingEnabled; }
+    bool instancingSupported() const { return m_instancingSupported; }
+
+    /*!
+        Returns the cache that the renderer's shader programs are loaded from
+        and stored in, which also knows how many programs were compiled and
+        loaded and how long that took. The cache directory is set with
+        OpenGLProgramCache::setDefaultDirectory() before the renderer is
+        created.
+     */
+    const OpenGLProgramCache *programCache() const { return &m_programCache; }
+
+    /*!
+        Shader programs are compiled the first time they are needed, so a
+        scene only pays for the programs it uses. Warming up compiles
+        \a programs, a combination of ProgramUpdate bits, and the blur and
+        shadow programs for \a blurRadii and \a shadowRadii ahead of that,
+        so the frame which first needs them doesn't stall.
+
+        With GL_KHR_parallel_shader_compile, the programs are handed to the
+        driver right away and are picked up in frameSwapped() once the
+        driver is done with them. Without it, frameSwapped() compiles one
+        program per frame. A program which is needed before it has been
+        warmed up is compiled on the spot.
+     */
+    void warmUpPrograms(unsigned programs,
+                        const std::vector<unsigned> &blurRadii = std::vector<unsigned>(),
+                        const std::vector<unsigned> &shadowRadii = std::vector<unsigned>());
+    unsigned programsWarmingUp() const { return m_warmUpPrograms.size(); }
+    bool parallelCompileSupported() const { return m_parallelCompileSupported; }
+
+    bool renderFrame();
     void prepass(Node *n);
     void build(Node *n);
+    void buildChildren(Node *n, bool changed);
+    static unsigned gatherSiblingQuads(Node *first, Node *last, std::vector<rect2d> *rects);
+    void writeQuad(Element *e, const vec2 *v, rect2d geometry, const InstanceTransform &transform, PackedColor color, const vec2 *texCoords);
     void drawColorQuad(unsigned bufferOffset, vec4 color);
-    void drawTextureQuad(unsigned bufferOffset, GLuint texId, float opacity = 1.0, Texture::Format format = Texture::RGBA_32);
+    Element *drawColorQuadBatch(Element *first, Element *last);
+    Element *drawTextureQuadBatch(Element *first, Element *last);
+    void drawInstancedQuads(unsigned instanceOffset, unsigned count, bool textured);
+    void drawTextureQuad(unsigned bufferOffset, GLuint texId, float opacity = 1.0, float downsampling = 1.0);
     void drawColorFilterQuad(unsigned bufferOffset, GLuint texId, const mat4 &cm);
     void drawBlurQuad(unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step);
     void drawShadowQuad(unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, vec4 color);
-    void activateShader(const Program *shader);
+    void activateShader(Program *shader);
+    void bindLayerQuad(unsigned offset);
+    GLuint acquireLayerTexture(vec2 size);
+    void setupProgram(Program *program, const char *vsh, const std::string &fsh, const std::vector<const char *> &attrs, std::function<void()> uniforms = std::function<void()>());
+    void compileProgram(Program *program);
     void projectQuad(vec2 a, vec2 b, vec2 *v);
     void render(Element *first, Element *last);
+    void prepareOpaque(Element *first, Element *last);
+    void renderOpaque();
+    Element *drawOpaqueBatch(Element *first, Element *last);
+    double elementDepth(const Element *e) const { return 1.0 - double(e - m_elements + 1) / RENGINE_RENDERER_DEPTH_STEPS; }
+    void setElementDepth(const Element *e);
+    static bool isOpaque(const Element *e);
+    static float layerMargin(const Node *n);
+    rect2d layerOutputRect(const Element *e) const;
+    void recordDamage(const Node *n, rect2d bounds, bool changed);
+    void addDamage(rect2d r) { if (r.width() >= 0 && r.height() >= 0) m_damage |= r; }
+    void resetDamage();
     void renderToLayer(Element *e);
+    void sortProjection(Element *e);
+    void releaseCachedLayer(CachedLayer *layer);
     void setDefaultOpenGLState();
     rect2d boundingRectFor(unsigned vertexOffset) const { return rect2d(m_vertices[vertexOffset], m_vertices[vertexOffset + 3]); }
+    static vec2 layerTextureScale(vec2 size) {
+        return size / vec2(TexturePool::sizeClass(size.x), TexturePool::sizeClass(size.y));
+    }
+    static bool isDrawable(Node *n) {
+        rect2d geometry = static_cast<RectangleNodeBase *>(n)->geometry();
+        return geometry.width() != 0 && geometry.height() != 0
+               && !(n->type() == Node::TextureNodeType && static_cast<TextureNode *>(n)->texture() == 0)
+               && !(n->type() == Node::RectangleNodeType && static_cast<RectangleNode *>(n)->color().w < RENGINE_RENDERER_ALPHA_THRESHOLD);
+    }
+    static PackedColor packedColor(vec4 c) {
+        PackedColor pc = { (unsigned char) (c.x * c.w * 255.0f + 0.5f),
+                           (unsigned char) (c.y * c.w * 255.0f + 0.5f),
+                           (unsigned char) (c.z * c.w * 255.0f + 0.5f),
+                           (unsigned char) (c.w * 255.0f + 0.5f) };
+        return pc;
+    }
+    static void quadTexCoords(const TextureNode *tn, vec2 *texCoords) {
+        rect2d tr = tn->texture()->textureRect();
+        rect2d nr = tn->textureRect();
+        rect2d r(tr.tl + nr.tl * tr.size(), tr.tl + nr.br * tr.size());
+        texCoords[0] = r.tl;
+        texCoords[1] = vec2(r.left(), r.bottom());
+        texCoords[2] = vec2(r.right(), r.top());
+        texCoords[3] = r.br;
+    }
+    static InstanceTransform instanceTransform(const mat4 &m) {
+        InstanceTransform t = { vec3(m.m[0], m.m[1], m.m[3]), vec3(m.m[4], m.m[5], m.m[7]) };
+        return t;
+    }
+    static mat4 layerProjection(rect2d rect) {
+        return mat4::scale2D(1.0, -1.0)
+               * mat4::translate2D(-1.0, 1.0)
+               * mat4::scale2D(2.0f / rect.width(), -2.0f / rect.height())
+               * mat4::translate2D(-rect.tl.x, -rect.tl.y);
+    }
 
     void ensureMatrixUpdated(ProgramUpdate bit, Program *p);
 
@@ -140,22 +884,39 @@ public:
     Program prog_texture_bgr;
     struct : public Program {
         int alpha;
+        int scale;
     } prog_alphaTexture;
     struct : public Program {
         int color;
     } prog_solid;
+    Program prog_solidBatched;
+    Program prog_solidInstanced;
+    Program prog_textureInstanced;
+    Program prog_textureBgrInstanced;
+    Program prog_solidOpaque;
+    Program prog_textureOpaque;
+    Program prog_textureBgrOpaque;
     struct : public Program {
         int colorMatrix;
+        int scale;
     } prog_colorFilter;
     struct BlurProgram : public Program {
+        int scale;
         int dims;
-        int radius;
-        int sigma;
         int step;
-    } prog_blur;
-    struct : public BlurProgram {
+    };
+    struct ShadowProgram : public BlurProgram {
         int color;
-    } prog_shadow;
+    };
+    BlurProgram *blurProgram(unsigned radius);
+    ShadowProgram *shadowProgram(unsigned radius);
+    std::unordered_map<unsigned, std::unique_ptr<BlurProgram>> m_blurPrograms;       // compiled on first use, by radius
+    std::unordered_map<unsigned, std::unique_ptr<ShadowProgram>> m_shadowPrograms;
+    OpenGLProgramCache m_programCache;
+    std::vector<Program *> m_warmUpPrograms;
+    OpenGLReadback m_readback;
+    OpenGLGpuTimer m_gpuTimer;
+    GLState m_state;
 
     unsigned m_numLayeredNodes;
     unsigned m_numTextureNodes;
@@ -163,31 +924,100 @@ public:
     unsigned m_numTransformNodes;
     unsigned m_numTransformNodesWith3d;
     unsigned m_numRenderNodes;
+    unsigned m_numProjectedQuads;   // rectangles and textures inside 3D projections
     unsigned m_additionalQuads;
+    unsigned m_drawCallsSaved;
+    unsigned m_vertexBytesUploaded;
+    unsigned m_layerCacheHits;
+    unsigned m_opaquePassElements;
+    unsigned m_culledNodes;
+    int m_depthBits;
 
     unsigned m_vertexIndex;
+    unsigned m_instanceIndex;
     unsigned m_elementIndex;
     vec2 *m_vertices;
     Element *m_elements;
+    std::vector<Element> m_builtElements;   // the output of build(), reused while the scene is unchanged
+    std::vector<Element> m_frameElements;   // the copy rendered each frame, keeps its capacity across frames
+    std::vector<Element *> m_opaqueRuns;    // [begin, end) pairs of opaque elements, used by renderOpaque()
+    Node *m_builtSceneRoot;
     mat4 m_proj;
     mat4 m_m2d;    // for the 2d world
     mat4 m_m3d;    // below a 3d projection subtree
     float m_farPlane;
     rect2d m_layerBoundingBox;
+    rect2d m_cullRect;      // during build, the part of device space which can affect the surface
     vec2 m_surfaceSize;
+    vec2 m_builtSurfaceSize;
+    vec4 m_builtFillColor;
+
+    std::unordered_map<const Node *, rect2d> m_damageBounds;      // where nodes were drawn in the last build
+    std::unordered_map<const Node *, rect2d> m_newDamageBounds;   // where they are drawn in this one
+    std::vector<rect2d> m_siblingRects;
+    std::vector<vec2> m_siblingVertices;    // the corners of m_siblingRects, transformed by m_m2d
+    const vec2 *m_transformedQuad;          // during build, the corners of the node being built, when known
+    unsigned m_buildThreadCount;
+    std::vector<std::unique_ptr<WorkQueue>> m_buildQueues;      // one per build thread, created on demand
+    std::vector<std::shared_ptr<BuildChunk>> m_buildChunks;
+
+    std::vector<rect2d> m_damageHistory;    // the damage of the last frames, most recent first
+    rect2d m_damage;                        // during build, the damage found so far
+    rect2d m_repaintRect;
 
     TexturePool m_texturePool;
+    FramebufferPool m_framebufferPool;
+    std::unordered_map<const Node *, CachedLayer> m_layerCache;
+    std::unordered_map<const Node *, ProjectionOrder> m_projectionOrders;
+    std::vector<Element> m_sortedElements;
+    OpenGLTextureAtlas m_atlas;
+
+    RetainedBuffer<vec2> m_vertexBuffer;
+    RetainedBuffer<PackedColor> m_vertexColorBuffer;     // only valid for rectangle nodes
+    RetainedBuffer<vec2> m_vertexTexCoordBuffer;         // only valid for texture nodes
+    RetainedBuffer<float> m_vertexDepthBuffer;           // only valid for elements in the opaque pass
+
+    // Per-instance attributes, one record per instanced rectangle or texture
+    RetainedBuffer<rect2d> m_instanceRectBuffer;
+    RetainedBuffer<InstanceTransform> m_instanceTransformBuffer;
+    RetainedBuffer<PackedColor> m_instanceColorBuffer;   // only valid for rectangle nodes
+    RetainedBuffer<rect2d> m_instanceTexRectBuffer;      // only valid for texture nodes
+
+    // Resolved in initialize(), as the GLES 2 headers don't have them
+    typedef void (RENGINE_GL_APIENTRY *DrawArraysInstanced)(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount);
+    typedef void (RENGINE_GL_APIENTRY *VertexAttribDivisor)(GLuint index, GLuint divisor);
+    DrawArraysInstanced m_drawArraysInstanced;
+    VertexAttribDivisor m_vertexAttribDivisor;
 
     const Program *m_activeShader;
     GLuint m_texCoordBuffer;
-    GLuint m_vertexBuffer;
+    GLuint m_quadIndexBuffer;
+    GLuint m_reversedQuadIndexBuffer;   // the same quads, last one first
     GLuint m_fbo;
 
     unsigned m_matrixState;
+    BlurMode m_blurMode;
 
     bool m_render3d : 1;
     bool m_layered : 1;
     bool m_srgb : 1;
+    bool m_batching : 1;
+    bool m_atlasing : 1;
+    bool m_sceneRebuilt : 1;
+    bool m_layerCaching : 1;
+    bool m_layerCacheable : 1;  // used during build to tell if the current layer can be cached
+    bool m_opaquePass : 1;
+    bool m_depthTesting : 1;    // set while elements are drawn with per-element depth
+    bool m_damageTrackingEnabled : 1;
+    bool m_damageTracking : 1;  // set for frames where the buffer age is known
+    bool m_changedAncestor : 1; // used during build to tell if an ancestor of the current node has changed
+    bool m_scissoring : 1;      // set while drawing to the surface is limited to m_repaintRect
+    bool m_buildPartitioned : 1; // set during build while chunks are out on the build threads
+    bool m_instancingSupported : 1;
+    bool m_instancingEnabled : 1;
+    bool m_instancing : 1;      // set for the current build, when enabled and supported
+    bool m_parallelCompileSupported : 1;
+    bool m_programsReported : 1; // set once the shader program totals have been logged
 
 };
 
@@ -197,17 +1027,15 @@ inline void OpenGLRenderer::projectQuad(vec2 a, vec2 b, vec2 *v)
     // pt_3d = matrix3D * pt                 // apply the 3D transform
     // pt_proj = pt_3d.project2D()           // project it to 2D based on current farPlane
     // pt_screen = parent_matrix * pt_proj   // Put the output of our local 3D into the scene world coordinate system
-    v[0] = m_m2d * ((m_m3d * vec3(a))       .project2D(m_farPlane));    // top left
-    v[1] = m_m2d * ((m_m3d * vec3(a.x, b.y)).project2D(m_farPlane));    // bottom left
-    v[2] = m_m2d * ((m_m3d * vec3(b.x, a.y)).project2D(m_farPlane));    // top right
-    v[3] = m_m2d * ((m_m3d * vec3(b))       .project2D(m_farPlane));    // bottom right
+    // All four corners are done at once.
+    rengine::projectQuad(m_m3d, m_farPlane, m_m2d, rect2d(a, b), v);
 }
 
 inline void OpenGLRenderer::ensureMatrixUpdated(ProgramUpdate bit, Program *p)
 {
     if (m_matrixState & bit) {
         m_matrixState &= ~bit;
-        glUniformMatrix4fv(p->matrix, 1, true, m_proj.m);
+        m_state.uniform(p, p->matrix, m_proj);
     }
 }
 
@@ -217,43 +1045,89 @@ inline OpenGLRenderer::OpenGLRenderer()
     , m_numRectangleNodes(0)
     , m_numTransformNodes(0)
     , m_numTransformNodesWith3d(0)
+    , m_numRenderNodes(0)
+    , m_numProjectedQuads(0)
     , m_additionalQuads(0)
+    , m_drawCallsSaved(0)
+    , m_vertexBytesUploaded(0)
+    , m_layerCacheHits(0)
+    , m_opaquePassElements(0)
+    , m_culledNodes(0)
+    , m_depthBits(0)
     , m_vertexIndex(0)
+    , m_instanceIndex(0)
     , m_elementIndex(0)
     , m_vertices(0)
     , m_elements(0)
+    , m_builtSceneRoot(0)
     , m_farPlane(0)
+    , m_transformedQuad(0)
+    , m_buildThreadCount(0)
+    , m_drawArraysInstanced(0)
+    , m_vertexAttribDivisor(0)
     , m_activeShader(0)
     , m_texCoordBuffer(0)
-    , m_vertexBuffer(0)
+    , m_quadIndexBuffer(0)
+    , m_reversedQuadIndexBuffer(0)
     , m_fbo(0)
     , m_matrixState(UpdateAllPrograms)
+    , m_blurMode(AutomaticBlur)
     , m_render3d(false)
     , m_layered(false)
     , m_srgb(false)
+    , m_batching(true)
+    , m_atlasing(true)
+    , m_sceneRebuilt(false)
+    , m_layerCaching(false)
+    , m_layerCacheable(false)
+    , m_opaquePass(false)
+    , m_depthTesting(false)
+    , m_damageTrackingEnabled(false)
+    , m_damageTracking(false)
+    , m_changedAncestor(false)
+    , m_scissoring(false)
+    , m_buildPartitioned(false)
+    , m_instancingSupported(false)
+    , m_instancingEnabled(true)
+    , m_instancing(false)
+    , m_parallelCompileSupported(false)
+    , m_programsReported(false)
 {
     initialize();
 }
 
 inline OpenGLRenderer::~OpenGLRenderer()
 {
+    for (auto &i : m_layerCache)
+        releaseCachedLayer(&i.second);
+
     glDeleteBuffers(1, &m_texCoordBuffer);
-    glDeleteBuffers(1, &m_vertexBuffer);
+    glDeleteBuffers(1, &m_quadIndexBuffer);
+    glDeleteBuffers(1, &m_reversedQuadIndexBuffer);
 
     assert(m_fbo == 0);
 }
 
 inline bool OpenGLRenderer::readPixels(int x, int y, int w, int h, unsigned *bytes)
 {
-    // Read line-by-line and flip it so we get what we want out..
-    // Slow as hell, but this is used for autotesting, so who cares..
-    for (int i=0; i<h; ++i)
-        glReadPixels(x, y + h - i - 1, w, 1, GL_RGBA, GL_UNSIGNED_BYTE, bytes + i * w);
+    OpenGLReadback::read(x, y, w, h, bytes);
     return true;
 }
 
+inline std::shared_ptr<PixelReadback> OpenGLRenderer::readPixelsAsync(int x, int y, int w, int h)
+{
+    std::shared_ptr<PixelReadback> readback = std::make_shared<PixelReadback>(x, y, w, h);
+    m_readback.start(readback);
+    return readback;
+}
+
 inline Texture *OpenGLRenderer::createTextureFromImageData(vec2 size, Texture::Format format, void *data)
 {
+    if (m_atlasing) {
+        if (Texture *texture = m_atlas.create(size, format, data))
+            return texture;
+    }
+
     OpenGLTexture *texture = new OpenGLTexture();
     texture->setFormat(format);
     texture->upload(size.x, size.y, data);
@@ -270,55 +1144,134 @@ inline void OpenGLRenderer::initialize()
         glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
-    // Create the vertex coordinate buffer
-    glGenBuffers(1, &m_vertexBuffer);
+    // Create the retained vertex buffers
+    glGenBuffers(1, &m_vertexBuffer.id);
+    glGenBuffers(1, &m_vertexColorBuffer.id);
+    glGenBuffers(1, &m_vertexTexCoordBuffer.id);
+    glGenBuffers(1, &m_vertexDepthBuffer.id);
+    glGenBuffers(1, &m_instanceRectBuffer.id);
+    glGenBuffers(1, &m_instanceTransformBuffer.id);
+    glGenBuffers(1, &m_instanceColorBuffer.id);
+    glGenBuffers(1, &m_instanceTexRectBuffer.id);
+
+    {   // Create the index buffer used for batched quads, two triangles per quad
+        std::vector<GLushort> indices(RENGINE_RENDERER_MAX_BATCH_QUADS * 6);
+        for (unsigned i=0; i<RENGINE_RENDERER_MAX_BATCH_QUADS; ++i) {
+            GLushort *q = indices.data() + i * 6;
+            GLushort v = i * 4;
+            q[0] = v;
+            q[1] = v + 1;
+            q[2] = v + 2;
+            q[3] = v + 2;
+            q[4] = v + 1;
+            q[5] = v + 3;
+        }
+        glGenBuffers(1, &m_quadIndexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIndexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+        // The opaque pass draws batches front-to-back, so it draws the last
+        // 'n' quads of this one, see drawOpaqueBatch()
+        std::vector<GLushort> reversed(indices.size());
+        for (unsigned i=0; i<RENGINE_RENDERER_MAX_BATCH_QUADS; ++i)
+            std::copy(indices.begin() + i * 6, indices.begin() + i * 6 + 6, reversed.end() - (i + 1) * 6);
+        glGenBuffers(1, &m_reversedQuadIndexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_reversedQuadIndexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, reversed.size() * sizeof(GLushort), reversed.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
 
-    std::vector<const char *> attrsVT;
-    attrsVT.push_back("aV");
-    attrsVT.push_back("aT");
+    // Linked programs are loaded from disk when they have been cached
+    // there before, see OpenGLProgramCache
+    m_programCache.initialize(OpenGLProgramCache::defaultDirectory());
 
-    std::vector<const char *> attrsV;
-    attrsV.push_back("aV");
+    // Programs are compiled the first time they are used, see
+    // compileProgram() and warmUpPrograms()
+    std::vector<const char *> attrsVT = { "aV", "aT" };
+    std::vector<const char *> attrsV = { "aV" };
+    std::vector<const char *> attrsVC = { "aV", "aC" };
 
     // Default texture shader
-    prog_texture.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture(), attrsVT);
-    prog_texture.matrix = prog_texture.resolve("m");
+    setupProgram(&prog_texture, openglrenderer_vsh_texture(), openglrenderer_fsh_texture(), attrsVT);
 
     // BGRA texture shader
-    prog_texture_bgr.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture_bgra(), attrsVT);
-    prog_texture_bgr.matrix = prog_texture.resolve("m");
+    setupProgram(&prog_texture_bgr, openglrenderer_vsh_texture(), openglrenderer_fsh_texture_bgra(), attrsVT);
 
     // Alpha texture shader
-    prog_alphaTexture.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture_alpha(), attrsVT);
-    prog_alphaTexture.matrix = prog_alphaTexture.resolve("m");
-    prog_alphaTexture.alpha = prog_alphaTexture.resolve("alpha");
+    setupProgram(&prog_alphaTexture, openglrenderer_vsh_layer(), openglrenderer_fsh_texture_alpha(), attrsVT, [this] {
+        prog_alphaTexture.alpha = prog_alphaTexture.resolve("alpha");
+        prog_alphaTexture.scale = prog_alphaTexture.resolve("scale");
+    });
 
     // Solid color shader...
-    prog_solid.initialize(openglrenderer_vsh_solid(), openglrenderer_fsh_solid(), attrsV);
-    prog_solid.matrix = prog_solid.resolve("m");
-    prog_solid.color = prog_solid.resolve("color");
+    setupProgram(&prog_solid, openglrenderer_vsh_solid(), openglrenderer_fsh_solid(), attrsV, [this] {
+        prog_solid.color = prog_solid.resolve("color");
+    });
+
+    // Batched solid color shader, color is a vertex attribute
+    setupProgram(&prog_solidBatched, openglrenderer_vsh_solid_batched(), openglrenderer_fsh_solid_batched(), attrsVC);
+
+    // Opaque pass shaders, with the element's depth as a vertex attribute
+    setupProgram(&prog_solidOpaque, openglrenderer_vsh_solid_opaque(), openglrenderer_fsh_solid_batched(), { "aV", "aC", "aZ" });
+    setupProgram(&prog_textureOpaque, openglrenderer_vsh_texture_opaque(), openglrenderer_fsh_texture(), { "aV", "aT", "aZ" });
+    setupProgram(&prog_textureBgrOpaque, openglrenderer_vsh_texture_opaque(), openglrenderer_fsh_texture_bgra(), { "aV", "aT", "aZ" });
 
     // Color filter shader..
-    prog_colorFilter.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture_colorfilter(), attrsVT);
-    prog_colorFilter.matrix = prog_solid.resolve("m");
-    prog_colorFilter.colorMatrix = prog_colorFilter.resolve("CM");
-
-    // Blur shader
-    prog_blur.initialize(openglrenderer_vsh_blur(), openglrenderer_fsh_blur(), attrsVT);
-    prog_blur.matrix = prog_blur.resolve("m");
-    prog_blur.dims = prog_blur.resolve("dims");
-    prog_blur.radius = prog_blur.resolve("radius");
-    prog_blur.sigma = prog_blur.resolve("sigma");
-    prog_blur.step = prog_blur.resolve("step");
-
-    // Shadow shader
-    prog_shadow.initialize(openglrenderer_vsh_blur(), openglrenderer_fsh_shadow(), attrsVT);
-    prog_shadow.matrix = prog_shadow.resolve("m");
-    prog_shadow.dims = prog_shadow.resolve("dims");
-    prog_shadow.radius = prog_shadow.resolve("radius");
-    prog_shadow.sigma = prog_shadow.resolve("sigma");
-    prog_shadow.step = prog_shadow.resolve("step");
-    prog_shadow.color = prog_shadow.resolve("color");
+    setupProgram(&prog_colorFilter, openglrenderer_vsh_layer(), openglrenderer_fsh_texture_colorfilter(), attrsVT, [this] {
+        prog_colorFilter.colorMatrix = prog_colorFilter.resolve("CM");
+        prog_colorFilter.scale = prog_colorFilter.resolve("scale");
+    });
+
+    // Blur and shadow shaders are specific to a radius and are created
+    // when first used, see blurProgram() and shadowProgram()
+
+    // Instancing needs glVertexAttribDivisor, which is OpenGL 3.3 and
+    // OpenGL ES 3.0. The version string is "<major>.<minor> ..." on desktop
+    // and "OpenGL ES <major>.<minor> ..." on ES.
+    int major = 0;
+    int minor = 0;
+    const char *version = (const char *) glGetString(GL_VERSION);
+    if (version) {
+#ifdef RENGINE_OPENGL_DESKTOP
+        sscanf(version, "%d.%d", &major, &minor);
+        m_instancingSupported = major > 3 || (major == 3 && minor >= 3);
+#else
+        sscanf(version, "OpenGL ES %d.%d", &major, &minor);
+        m_instancingSupported = major >= 3;
+#endif
+    }
+#if defined(RENGINE_OPENGL_DESKTOP) && !defined(__APPLE__)
+    m_drawArraysInstanced = (DrawArraysInstanced) glDrawArraysInstanced;
+    m_vertexAttribDivisor = (VertexAttribDivisor) glVertexAttribDivisor;
+#elif !defined(RENGINE_OPENGL_DESKTOP)
+    m_drawArraysInstanced = (DrawArraysInstanced) eglGetProcAddress("glDrawArraysInstanced");
+    m_vertexAttribDivisor = (VertexAttribDivisor) eglGetProcAddress("glVertexAttribDivisor");
+#endif
+    if (!m_drawArraysInstanced || !m_vertexAttribDivisor)
+        m_instancingSupported = false;
+
+    // Asynchronous readback needs fences, which is OpenGL 3.2 and OpenGL ES 3.0
+#ifdef RENGINE_OPENGL_DESKTOP
+    m_readback.initialize(major > 3 || (major == 3 && minor >= 2));
+#else
+    m_readback.initialize(major >= 3);
+#endif
+
+    if (m_instancingSupported) {
+        // The corner of the quad comes from the static texture coordinate
+        // buffer in attribute 1, like for all other programs.
+        std::vector<const char *> attrsInstanced = { "aR", "aT", "aM0", "aM1", "aC" };
+        setupProgram(&prog_solidInstanced, openglrenderer_vsh_solid_instanced(), openglrenderer_fsh_solid_batched(), attrsInstanced);
+
+        attrsInstanced.back() = "aS";
+        setupProgram(&prog_textureInstanced, openglrenderer_vsh_texture_instanced(), openglrenderer_fsh_texture(), attrsInstanced);
+        setupProgram(&prog_textureBgrInstanced, openglrenderer_vsh_texture_instanced(), openglrenderer_fsh_texture_bgra(), attrsInstanced);
+    }
+
+    GLint maxTextureSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    glGetIntegerv(GL_DEPTH_BITS, &m_depthBits);
+    m_atlas.setPageSize(std::min<int>(m_atlas.pageSize(), maxTextureSize));
 
     // Using srgb for everything needs a bit more thought as it results in
     // really washed out colors for rectangles and image textures.
@@ -328,6 +1281,14 @@ inline void OpenGLRenderer::initialize()
         // glEnable(GL_FRAMEBUFFER_SRGB);
     }
 
+    // Lets warmUpPrograms() compile in the background
+    m_parallelCompileSupported = std::strstr(extensions, "GL_KHR_parallel_shader_compile")
+                                 || std::strstr(extensions, "GL_ARB_parallel_shader_compile");
+
+    // Timer queries are OpenGL 3.3 or GL_ARB_timer_query on desktop and
+    // GL_EXT_disjoint_timer_query on ES
+    m_gpuTimer.initialize(major > 3 || (major == 3 && minor >= 3), extensions);
+
 #ifdef RENGINE_LOG_INFO
     static bool logged = false;
     if (!logged) {
@@ -350,10 +1311,14 @@ inline void OpenGLRenderer::initialize()
         logi << " - Samples ..........: " << samples << std::endl;
         logi << " - Max Texture Size .: " << maxTexSize << std::endl;
         logi << " - SRGB Rendering ...: " << (m_srgb ? "yes" : "no") << std::endl;
+        logi << " - Instancing .......: " << (m_instancingSupported ? "yes" : "no") << std::endl;
+        logi << " - Program Cache ....: " << (m_programCache.isActive() ? m_programCache.directory() : "off") << std::endl;
+        logi << " - Parallel Compile .: " << (m_parallelCompileSupported ? "yes" : "no") << std::endl;
+        logi << " - Async Readback ...: " << (m_readback.isAsyncSupported() ? "yes" : "no") << std::endl;
+        logi << " - GPU Timing .......: " << (m_gpuTimer.isSupported() ? "yes" : "no") << std::endl;
         logi << " - Extensions .......: " << glGetString(GL_EXTENSIONS) << std::endl;
     }
 #endif
-
 }
 
 /*!
@@ -366,80 +1331,438 @@ inline void OpenGLRenderer::drawColorQuad(unsigned offset, vec4 c)
 {
     activateShader(&prog_solid);
     ensureMatrixUpdated(UpdateSolidProgram, &prog_solid);
-    glUniform4f(prog_solid.color, c.x * c.w, c.y * c.w, c.z * c.w, c.w);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
+    m_state.uniform(&prog_solid, prog_solid.color, vec4(c.x * c.w, c.y * c.w, c.z * c.w, c.w));
+    m_state.bindArrayBuffer(m_vertexBuffer.id);
+    m_state.attribute(0, 2, GL_FLOAT, GL_FALSE, 0, offset * sizeof(vec2));
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ++m_frameStats.drawCalls;
+}
+
+/*!
+
+    Draws the run of rectangle elements starting at \a first using a single
+    draw call. The run ends at the first element before \a last which is not
+    a rectangle, which is where the GL state would need to change anyway, or
+    at the first rectangle whose vertices do not directly follow the previous
+    one in the vertex buffer. Elements which have already been completed are
+    skipped. The elements that are drawn are marked as completed.
+
+    The positions and colors are already in the retained vertex buffers, so
+    nothing is uploaded here. Instanced elements are batched the same way,
+    only with the instance buffers, and are drawn one at a time when
+    batching is disabled.
+
+    Returns the element following the run.
+
+ */
+inline OpenGLRenderer::Element *OpenGLRenderer::drawColorQuadBatch(Element *first, Element *last)
+{
+    assert(first->node->type() == Node::RectangleNodeType);
+
+    // Instanced draws are not limited by the 16-bit indices
+    unsigned maxQuads = !m_batching ? 1
+                        : first->instanced ? std::numeric_limits<unsigned>::max()
+                        : RENGINE_RENDERER_MAX_BATCH_QUADS;
+    unsigned stride = first->instanced ? 1 : 4;
+
+    Element *e = first;
+    unsigned quads = 0;
+    while (e < last && quads < maxQuads) {
+        if (!e->completed) {
+            if (e->node->type() != Node::RectangleNodeType
+                || e->instanced != first->instanced
+                || e->vboOffset != first->vboOffset + quads * stride)
+                break;
+            e->completed = true;
+            ++quads;
+        }
+        ++e;
+    }
+
+    if (first->instanced) {
+        activateShader(&prog_solidInstanced);
+        ensureMatrixUpdated(UpdateSolidInstancedProgram, &prog_solidInstanced);
+        drawInstancedQuads(first->vboOffset, quads, false);
+        m_drawCallsSaved += quads - 1;
+        return e;
+    }
+
+    // Nothing to gain from a batch of one, use the normal path..
+    if (quads == 1) {
+        drawColorQuad(first->vboOffset, static_cast<RectangleNode *>(first->node)->color());
+        return e;
+    }
+
+    activateShader(&prog_solidBatched);
+    ensureMatrixUpdated(UpdateSolidBatchedProgram, &prog_solidBatched);
+
+    m_state.bindArrayBuffer(m_vertexBuffer.id);
+    m_state.attribute(0, 2, GL_FLOAT, GL_FALSE, 0, first->vboOffset * sizeof(vec2));
+    m_state.bindArrayBuffer(m_vertexColorBuffer.id);
+    m_state.attribute(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, first->vboOffset * sizeof(PackedColor));
+    glDrawElements(GL_TRIANGLES, quads * 6, GL_UNSIGNED_SHORT, 0);
+    ++m_frameStats.drawCalls;
+
+    m_drawCallsSaved += quads - 1;
+
+    return e;
+}
+
+/*!
+
+    Draws the run of texture elements starting at \a first which share the
+    same GL texture and shader using a single draw call. This is typically
+    textures living in the same atlas page. Each quad's texture coordinates
+    come from the retained texture coordinate buffer, so each quad can use
+    its own sub-rectangle.
+
+    Returns the element following the run.
+
+ */
+inline OpenGLRenderer::Element *OpenGLRenderer::drawTextureQuadBatch(Element *first, Element *last)
+{
+    assert(first->node->type() == Node::TextureNodeType);
+
+    const Texture *texture = static_cast<TextureNode *>(first->node)->texture();
+    GLuint id = texture->textureId();
+    bool bgr = texture->format() == Texture::BGRA_32 || texture->format() == Texture::BGRx_32;
+    unsigned maxQuads = !m_batching ? 1
+                        : first->instanced ? std::numeric_limits<unsigned>::max()
+                        : RENGINE_RENDERER_MAX_BATCH_QUADS;
+    unsigned stride = first->instanced ? 1 : 4;
+
+    Element *e = first;
+    unsigned quads = 0;
+    while (e < last && quads < maxQuads) {
+        if (!e->completed) {
+            if (e->node->type() != Node::TextureNodeType
+                || e->instanced != first->instanced
+                || e->vboOffset != first->vboOffset + quads * stride)
+                break;
+            const Texture *t = static_cast<TextureNode *>(e->node)->texture();
+            if (t->textureId() != id || bgr != (t->format() == Texture::BGRA_32 || t->format() == Texture::BGRx_32))
+                break;
+            e->completed = true;
+            ++quads;
+        }
+        ++e;
+    }
+
+    if (first->instanced) {
+        if (bgr) {
+            activateShader(&prog_textureBgrInstanced);
+            ensureMatrixUpdated(UpdateTextureBgrInstancedProgram, &prog_textureBgrInstanced);
+        } else {
+            activateShader(&prog_textureInstanced);
+            ensureMatrixUpdated(UpdateTextureInstancedProgram, &prog_textureInstanced);
+        }
+        m_state.bindTexture(id);
+        drawInstancedQuads(first->vboOffset, quads, true);
+        m_drawCallsSaved += quads - 1;
+        return e;
+    }
+
+    if (bgr) {
+        activateShader(&prog_texture_bgr);
+        ensureMatrixUpdated(UpdateTextureBgrProgram, &prog_texture_bgr);
+    } else {
+        activateShader(&prog_texture);
+        ensureMatrixUpdated(UpdateTextureProgram, &prog_texture);
+    }
+
+    m_state.bindArrayBuffer(m_vertexBuffer.id);
+    m_state.attribute(0, 2, GL_FLOAT, GL_FALSE, 0, first->vboOffset * sizeof(vec2));
+    m_state.bindArrayBuffer(m_vertexTexCoordBuffer.id);
+    m_state.attribute(1, 2, GL_FLOAT, GL_FALSE, 0, first->vboOffset * sizeof(vec2));
+    m_state.bindTexture(id);
+    glDrawElements(GL_TRIANGLES, quads * 6, GL_UNSIGNED_SHORT, 0);
+    ++m_frameStats.drawCalls;
+
+    m_drawCallsSaved += quads - 1;
+
+    return e;
+}
+
+/*!
+
+    Draws \a count instanced rectangles or, if \a textured, textures starting
+    at \a instanceOffset in the instance buffers with a single draw call. The
+    instanced program must already be active.
+
+ */
+inline void OpenGLRenderer::drawInstancedQuads(unsigned instanceOffset, unsigned count, bool textured)
+{
+    const size_t transformOffset = instanceOffset * sizeof(InstanceTransform);
+    m_state.bindArrayBuffer(m_instanceRectBuffer.id);
+    m_state.attribute(0, 4, GL_FLOAT, GL_FALSE, 0, instanceOffset * sizeof(rect2d));
+    m_state.bindArrayBuffer(m_texCoordBuffer);
+    m_state.attribute(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    m_state.bindArrayBuffer(m_instanceTransformBuffer.id);
+    m_state.attribute(2, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), transformOffset);
+    m_state.attribute(3, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), transformOffset + sizeof(vec3));
+    if (textured) {
+        m_state.bindArrayBuffer(m_instanceTexRectBuffer.id);
+        m_state.attribute(4, 4, GL_FLOAT, GL_FALSE, 0, instanceOffset * sizeof(rect2d));
+    } else {
+        m_state.bindArrayBuffer(m_instanceColorBuffer.id);
+        m_state.attribute(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, instanceOffset * sizeof(PackedColor));
+    }
+
+    // Everything but the corner in attribute 1 advances once per quad. The
+    // divisors are reset afterwards, as the other programs and render nodes
+    // expect plain vertex attributes.
+    const GLuint perInstance[] = { 0, 2, 3, 4 };
+    for (GLuint i : perInstance)
+        m_vertexAttribDivisor(i, 1);
+    m_drawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    ++m_frameStats.drawCalls;
+    for (GLuint i : perInstance)
+        m_vertexAttribDivisor(i, 0);
+}
+
+/*!
+    Returns a texture from the pool for a layer of \a size. Creating a new
+    texture binds it and can delete others, so the bound texture is no
+    longer known then.
+ */
+inline GLuint OpenGLRenderer::acquireLayerTexture(vec2 size)
+{
+    unsigned misses = m_texturePool.misses;
+    GLuint id = m_texturePool.acquire(size);
+    if (m_texturePool.misses != misses)
+        m_state.texture = GLState::Unknown;
+    return id;
+}
+
+/*!
+    Points attribute 0 at the quad at \a offset in the vertex buffer and
+    attribute 1 at the static texture coordinates, as the layer programs
+    expect.
+ */
+inline void OpenGLRenderer::bindLayerQuad(unsigned offset)
+{
+    m_state.bindArrayBuffer(m_texCoordBuffer);
+    m_state.attribute(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    m_state.bindArrayBuffer(m_vertexBuffer.id);
+    m_state.attribute(0, 2, GL_FLOAT, GL_FALSE, 0, offset * sizeof(vec2));
 }
 
 inline void OpenGLRenderer::drawColorFilterQuad(unsigned offset, GLuint texId, const mat4 &matrix)
 {
     activateShader(&prog_colorFilter);
     ensureMatrixUpdated(UpdateColorFilterProgram, &prog_colorFilter);
-    glUniformMatrix4fv(prog_colorFilter.colorMatrix, 1, true, matrix.m);
+    m_state.uniform(&prog_colorFilter, prog_colorFilter.colorMatrix, matrix);
+    m_state.uniform(&prog_colorFilter, prog_colorFilter.scale, layerTextureScale(boundingRectFor(offset).size()));
     // std::cout << prog_colorFilter.colorMatrix << matrix;
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
-    glBindTexture(GL_TEXTURE_2D, texId);
+    bindLayerQuad(offset);
+    m_state.bindTexture(texId);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ++m_frameStats.drawCalls;
 }
 
-inline void OpenGLRenderer::drawTextureQuad(unsigned offset, GLuint texId, float opacity, Texture::Format format)
+/*!
+
+    Draws a layer texture. The layer covers the top-left part of the texture,
+    which is as large as the quad at \a offset, divided by \a downsampling.
+
+ */
+inline void OpenGLRenderer::drawTextureQuad(unsigned offset, GLuint texId, float opacity, float downsampling)
 {
-    if (opacity == 1) {
-        if (format == Texture::BGRA_32 || format == Texture::BGRx_32) {
-            activateShader(&prog_texture_bgr);
-            ensureMatrixUpdated(UpdateTextureBgrProgram, &prog_texture_bgr);
-        } else {
-            activateShader(&prog_texture);
-            ensureMatrixUpdated(UpdateTextureProgram, &prog_texture);
-        }
-    } else {
-        activateShader(&prog_alphaTexture);
-        ensureMatrixUpdated(UpdateAlphaTextureProgram, &prog_alphaTexture);
-        glUniform1f(prog_alphaTexture.alpha, opacity);
-    }
+    activateShader(&prog_alphaTexture);
+    ensureMatrixUpdated(UpdateAlphaTextureProgram, &prog_alphaTexture);
+    m_state.uniform(&prog_alphaTexture, prog_alphaTexture.alpha, opacity);
+    m_state.uniform(&prog_alphaTexture, prog_alphaTexture.scale, layerTextureScale(boundingRectFor(offset).size() / downsampling));
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
-    glBindTexture(GL_TEXTURE_2D, texId);
+    bindLayerQuad(offset);
+    m_state.bindTexture(texId);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ++m_frameStats.drawCalls;
 }
 
-inline void OpenGLRenderer::drawBlurQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step)
+inline OpenGLRenderer::BlurProgram *OpenGLRenderer::blurProgram(unsigned radius)
 {
-    activateShader(&prog_blur);
-    ensureMatrixUpdated(UpdateBlurProgram, &prog_blur);
+    std::unique_ptr<BlurProgram> &program = m_blurPrograms[radius];
+    if (!program) {
+        BlurProgram *p = new BlurProgram();
+        program.reset(p);
+        setupProgram(p, openglrenderer_vsh_blur(), openglrenderer_fsh_blur(radius, false), { "aV", "aT" }, [p] {
+            p->scale = p->resolve("scale");
+            p->dims = p->resolve("dims");
+            p->step = p->resolve("step");
+        });
+    }
+    return program.get();
+}
 
-    glUniform1i(prog_blur.radius, radius);
-    glUniform4f(prog_blur.dims, renderSize.x, renderSize.y, textureSize.x, textureSize.y);
-    float sigma = 0.3 * radius + 0.8;
-    glUniform1f(prog_blur.sigma, sigma * sigma * 2.0);
-    glUniform2f(prog_blur.step, step.x, step.y);
+inline OpenGLRenderer::ShadowProgram *OpenGLRenderer::shadowProgram(unsigned radius)
+{
+    std::unique_ptr<ShadowProgram> &program = m_shadowPrograms[radius];
+    if (!program) {
+        ShadowProgram *p = new ShadowProgram();
+        program.reset(p);
+        setupProgram(p, openglrenderer_vsh_blur(), openglrenderer_fsh_blur(radius, true), { "aV", "aT" }, [p] {
+            p->scale = p->resolve("scale");
+            p->dims = p->resolve("dims");
+            p->step = p->resolve("step");
+            p->color = p->resolve("color");
+        });
+    }
+    return program.get();
+}
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
-    glBindTexture(GL_TEXTURE_2D, texId);
+inline void OpenGLRenderer::drawBlurQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step)
+{
+    BlurProgram *program = blurProgram(radius);
+    // All the blur programs share one update bit, so switching between them
+    // always needs the matrix.
+    if (program != m_activeShader)
+        m_matrixState |= UpdateBlurProgram;
+    activateShader(program);
+    ensureMatrixUpdated(UpdateBlurProgram, program);
+
+    m_state.uniform(program, program->dims, vec4(renderSize.x, renderSize.y, textureSize.x, textureSize.y));
+    vec2 scale = layerTextureScale(textureSize);
+    m_state.uniform(program, program->scale, scale);
+    m_state.uniform(program, program->step, vec2(step.x * scale.x, step.y * scale.y));
+
+    bindLayerQuad(offset);
+    m_state.bindTexture(texId);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ++m_frameStats.drawCalls;
 }
 
 inline void OpenGLRenderer::drawShadowQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, vec4 color)
 {
-    activateShader(&prog_shadow);
-    ensureMatrixUpdated(UpdateShadowProgram, &prog_shadow);
-
-    glUniform1i(prog_shadow.radius, radius);
-    glUniform4f(prog_shadow.dims, renderSize.x, renderSize.y, textureSize.x, textureSize.y);
-    float sigma = 0.3 * radius + 0.8;
-    glUniform1f(prog_shadow.sigma, sigma * sigma * 2.0);
-    glUniform2f(prog_shadow.step, step.x, step.y);
-    glUniform4f(prog_shadow.color, color.x, color.y, color.z, color.w);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
-    glBindTexture(GL_TEXTURE_2D, texId);
+    ShadowProgram *program = shadowProgram(radius);
+    if (program != m_activeShader)
+        m_matrixState |= UpdateShadowProgram;
+    activateShader(program);
+    ensureMatrixUpdated(UpdateShadowProgram, program);
+
+    m_state.uniform(program, program->dims, vec4(renderSize.x, renderSize.y, textureSize.x, textureSize.y));
+    vec2 scale = layerTextureScale(textureSize);
+    m_state.uniform(program, program->scale, scale);
+    m_state.uniform(program, program->step, vec2(step.x * scale.x, step.y * scale.y));
+    m_state.uniform(program, program->color, color);
+
+    bindLayerQuad(offset);
+    m_state.bindTexture(texId);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ++m_frameStats.drawCalls;
+}
+
+inline void OpenGLRenderer::setupProgram(Program *program, const char *vsh, const std::string &fsh, const std::vector<const char *> &attrs, std::function<void()> uniforms)
+{
+    program->start = [this, program, vsh, fsh, attrs] {
+        program->startCompile(vsh, fsh.c_str(), attrs, &m_programCache);
+    };
+    program->uniforms = uniforms;
+}
+
+/*!
+    Makes \a program ready for use, waiting for it if it has been started
+    by warmUpPrograms() and compiling it if it hasn't.
+ */
+inline void OpenGLRenderer::compileProgram(Program *program)
+{
+    if (program->ready)
+        return;
+    if (program->id() == 0)
+        program->start();
+    program->finishCompile();
+    program->matrix = program->resolve("m");
+    if (program->uniforms)
+        program->uniforms();
+    program->ready = true;
+
+    logd << "shader program " << program->id() << " is ready" << std::endl;
 }
 
-inline void OpenGLRenderer::activateShader(const Program *shader)
+inline void OpenGLRenderer::warmUpPrograms(unsigned programs, const std::vector<unsigned> &blurRadii, const std::vector<unsigned> &shadowRadii)
 {
-    if (shader == m_activeShader)
+    const std::pair<unsigned, Program *> fixed[] = {
+        { UpdateSolidProgram, &prog_solid },
+        { UpdateTextureProgram, &prog_texture },
+        { UpdateTextureBgrProgram, &prog_texture_bgr },
+        { UpdateAlphaTextureProgram, &prog_alphaTexture },
+        { UpdateColorFilterProgram, &prog_colorFilter },
+        { UpdateSolidBatchedProgram, &prog_solidBatched },
+        { UpdateSolidInstancedProgram, &prog_solidInstanced },
+        { UpdateTextureInstancedProgram, &prog_textureInstanced },
+        { UpdateTextureBgrInstancedProgram, &prog_textureBgrInstanced },
+        { UpdateSolidOpaqueProgram, &prog_solidOpaque },
+        { UpdateTextureOpaqueProgram, &prog_textureOpaque },
+        { UpdateTextureBgrOpaqueProgram, &prog_textureBgrOpaque }
+    };
+
+    std::vector<Program *> queue;
+    for (const auto &p : fixed) {
+        // The instanced programs are only set up when instancing is supported
+        if ((programs & p.first) && p.second->start)
+            queue.push_back(p.second);
+    }
+    if (programs & UpdateBlurProgram) {
+        for (unsigned radius : blurRadii)
+            queue.push_back(blurProgram(radius));
+    }
+    if (programs & UpdateShadowProgram) {
+        for (unsigned radius : shadowRadii)
+            queue.push_back(shadowProgram(radius));
+    }
+
+    for (Program *p : queue) {
+        if (p->ready || std::find(m_warmUpPrograms.begin(), m_warmUpPrograms.end(), p) != m_warmUpPrograms.end())
+            continue;
+        if (m_parallelCompileSupported && p->id() == 0)
+            p->start();
+        m_warmUpPrograms.push_back(p);
+    }
+}
+
+inline void OpenGLRenderer::frameSwapped()
+{
+    m_texturePool.trim();
+
+    // Hand over the pixels the GPU has finished reading back
+    m_readback.poll(false);
+    m_gpuTimer.collect();
+
+    // Pick up the programs the driver has finished, or compile the next one
+    // when it can't tell us
+    bool compiled = false;
+    auto i = m_warmUpPrograms.begin();
+    while (i != m_warmUpPrograms.end()) {
+        Program *p = *i;
+        if (!p->ready) {
+            if (m_parallelCompileSupported ? !p->isCompileComplete(true) : compiled) {
+                ++i;
+                continue;
+            }
+            compileProgram(p);
+            compiled = true;
+        }
+        i = m_warmUpPrograms.erase(i);
+    }
+
+    // Report the programs once, after the first frame and any warm-up
+    if (!m_programsReported && m_warmUpPrograms.empty()) {
+        m_programsReported = true;
+        logi << "Shader programs: " << m_programCache.compiledPrograms() << " compiled in "
+             << m_programCache.compileTime() * 1000.0 << " ms, " << m_programCache.loadedPrograms()
+             << " loaded from cache in " << m_programCache.loadTime() * 1000.0 << " ms" << std::endl;
+    }
+}
+
+inline void OpenGLRenderer::activateShader(Program *shader)
+{
+    if (shader == m_activeShader) {
+        ++m_state.skipped;
         return;
+    }
+    ++m_state.issued;
+
+    if (shader)
+        compileProgram(shader);
 
     int oldCount = m_activeShader ? m_activeShader->attributeCount() : 0;
     int newCount = 0;
@@ -447,6 +1770,7 @@ inline void OpenGLRenderer::activateShader(const Program *shader)
     if (shader) {
         newCount = shader->attributeCount();
         glUseProgram(shader->id());
+        ++m_frameStats.shaderSwitches;
     } else {
         glUseProgram(0);
     }
@@ -472,22 +1796,43 @@ inline void OpenGLRenderer::activateShader(const Program *shader)
 
 inline void OpenGLRenderer::prepass(Node *n)
 {
+    // Preprocessing may change the node, so do that before clearing it
     n->preprocess();
+    if (n->isContentDirty() && !m_layerCache.empty()) {
+        auto cached = m_layerCache.find(n);
+        if (cached != m_layerCache.end())
+            releaseCachedLayer(&cached->second);
+    }
+    n->clearDirty();
     switch (n->type()) {
     case Node::TextureNodeType: {
         TextureNode *tn = static_cast<TextureNode *>(n);
-        if (tn->width() != 0.0f && tn->height() != 0.0f && tn->texture() != nullptr)
+        if (tn->width() != 0.0f && tn->height() != 0.0f && tn->texture() != nullptr) {
             ++m_numTextureNodes;
+            if (m_render3d)
+                ++m_numProjectedQuads;
+        }
     }   break;
     case Node::RectangleNodeType: {
         RectangleNode *rn = static_cast<RectangleNode *>(n);
-        if (rn->width() != 0.0f && rn->height() != 0.0f && !(rn->color().w < RENGINE_RENDERER_ALPHA_THRESHOLD))
+        if (rn->width() != 0.0f && rn->height() != 0.0f && !(rn->color().w < RENGINE_RENDERER_ALPHA_THRESHOLD)) {
             ++m_numRectangleNodes;
+            if (m_render3d)
+                ++m_numProjectedQuads;
+        }
     }   break;
     case Node::TransformNodeType:
         ++m_numTransformNodes;
-        if (static_cast<TransformNode *>(n)->projectionDepth() > 0)
+        if (static_cast<TransformNode *>(n)->projectionDepth() > 0) {
             ++m_numTransformNodesWith3d;
+            // Count what is drawn from vertices rather than instances
+            bool stored3d = m_render3d;
+            m_render3d = true;
+            for (Node *c = n->child(); c; c = c->sibling())
+                prepass(c);
+            m_render3d = stored3d;
+            return;
+        }
         break;
     // All layered nodes take this path..
     case Node::ColorFilterNodeType:
@@ -502,6 +1847,9 @@ inline void OpenGLRenderer::prepass(Node *n)
         if (static_cast<BlurNode *>(n)->radius() > 0) {
             ++m_numLayeredNodes;
             m_additionalQuads += 2;
+            // The source rect and one rect per downsampled level
+            if (unsigned levels = blurLevels(static_cast<BlurNode *>(n)->radius()))
+                m_additionalQuads += levels + 1;
         }
         break;
     case Node::ShadowNodeType:
@@ -525,23 +1873,24 @@ inline void OpenGLRenderer::prepass(Node *n)
 
 inline void OpenGLRenderer::build(Node *n)
 {
+    // Anything below a changed node may have changed too
+    bool changed = m_changedAncestor || n->isChanged();
+    n->clearChanged();
+
     switch (n->type()) {
     case Node::TextureNodeType:
     case Node::RectangleNodeType: {
         rect2d geometry = static_cast<RectangleNodeBase *>(n)->geometry();
 
         // Skip if empty..
-        if (geometry.width() == 0 || geometry.height() == 0
-            || (n->type() == Node::TextureNodeType && static_cast<TextureNode *>(n)->texture() == 0)
-            || (n->type() == Node::RectangleNodeType && static_cast<RectangleNode *>(n)->color().w < RENGINE_RENDERER_ALPHA_THRESHOLD))
+        if (!isDrawable(n))
             break;
 
         Element *e = m_elements + m_elementIndex;
         e->node = n;
-        e->vboOffset = m_vertexIndex;
         vec2 p1 = geometry.tl;
         vec2 p2 = geometry.br;
-        vec2 *v = m_vertices + m_vertexIndex;
+        vec2 v[4];
 
         // std::cout << " -- building rect from " << p1 << " " << p2 << " into " << m_vertices << " " << e << std::endl;
 
@@ -550,12 +1899,26 @@ inline void OpenGLRenderer::build(Node *n)
             projectQuad(p1, p2, v);
 
         } else {
-            v[0] = m_m2d * p1;
-            v[1] = m_m2d * vec2(p1.x, p2.y);
-            v[2] = m_m2d * vec2(p2.x, p1.y);
-            v[3] = m_m2d * p2;
+            if (m_transformedQuad)
+                std::copy(m_transformedQuad, m_transformedQuad + 4, v);
+            else
+                transformQuad2D(m_m2d, geometry, v);
+            rect2d bounds = rect2d(v[0], v[0]) | v[1] | v[2] | v[3];
+            if (!bounds.intersects(m_cullRect)) {
+                ++m_culledNodes;
+                break;
+            }
+            if (m_damageTracking)
+                recordDamage(n, bounds, changed);
         }
-        m_vertexIndex += 4;
+
+        PackedColor color = { 0, 0, 0, 0 };
+        vec2 texCoords[4];
+        if (n->type() == Node::RectangleNodeType)
+            color = packedColor(static_cast<RectangleNode *>(n)->color());
+        else
+            quadTexCoords(static_cast<TextureNode *>(n), texCoords);
+        writeQuad(e, v, geometry, instanceTransform(m_m2d), color, texCoords);
         m_elementIndex += 1;
 
         // Add to the bounding box if we're in inside a layer
@@ -579,14 +1942,14 @@ inline void OpenGLRenderer::build(Node *n)
             e->node = n;
             e->z = 0;
             e->projection = true;
+            m_projectionOrders[n].used = true;
         }
 
         mat4 *m = m_render3d ? &m_m3d : &m_m2d;
         mat4 old = *m;
         *m = *m * tn->matrix();
 
-        for (Node *c = n->child(); c; c = c->sibling())
-            build(c);
+        buildChildren(n, changed);
 
         // restore previous state
         *m = old;
@@ -610,22 +1973,34 @@ inline void OpenGLRenderer::build(Node *n)
             || (n->type() == Node::ShadowNodeType && static_cast<ShadowNode *>(n)->color().w > 0);
 
         bool storedTextureed = m_layered;
+        bool storedCacheable = m_layerCacheable;
         Element *e = 0;
         rect2d storedBox = m_layerBoundingBox;
+        rect2d storedCullRect = m_cullRect;
+        rect2d storedDamage = m_damage;
+        unsigned storedVertexIndex = m_vertexIndex;
+        unsigned storedInstanceIndex = m_instanceIndex;
 
         if (useTexture) {
             m_layered = true;
+            m_layerCacheable = true;
             e = m_elements + m_elementIndex++;
             e->node = n;
             e->projection = m_render3d;
             e->layered = true;
             const float inf = std::numeric_limits<float>::infinity();
             m_layerBoundingBox = rect2d(inf, inf, -inf, -inf);
+            // Blurs and shadows pull in content from outside the area they
+            // cover.
+            float margin = layerMargin(n);
+            m_cullRect.tl -= margin;
+            m_cullRect.br += margin;
+            // Damage inside the layer spreads to all of its output
+            m_damage = rect2d(inf, inf, -inf, -inf);
         }
         // std::cout << " -- building layered node into " << e << std::endl;
 
-        for (Node *c = n->child(); c; c = c->sibling())
-            build(c);
+        buildChildren(n, changed);
 
         if (e) {
             m_layered = storedTextureed;
@@ -633,12 +2008,37 @@ inline void OpenGLRenderer::build(Node *n)
             // std::cout << "groupSize of " << e << " is " << e->groupSize << " based on: " << m_elements << " " << m_elementIndex << " " << e << std::endl;
             e->vboOffset = m_vertexIndex;
             rect2d box = m_layerBoundingBox.aligned();
-            vec2 *v = m_vertices + m_vertexIndex;
-            v[0] = box.tl;
+
+            // Leave out layers which cannot affect the surface and clamp the
+            // rest to the part that can. The clamped content depends on where
+            // the layer is, so it cannot be cached.
+            if (!m_render3d) {
+                rect2d visible = box & m_cullRect;
+                if (visible.width() <= 0 || visible.height() <= 0) {
+                    memset(e, 0, (m_elementIndex - (e - m_elements)) * sizeof(Element));
+                    m_elementIndex = e - m_elements;
+                    m_vertexIndex = storedVertexIndex;
+                    m_instanceIndex = storedInstanceIndex;
+                    m_layerCacheable = storedCacheable;
+                    m_layerBoundingBox = storedBox;
+                    m_cullRect = storedCullRect;
+                    addDamage(storedDamage);
+                    ++m_culledNodes;
+                    return;
+                }
+                if (!(visible == box)) {
+                    box = visible;
+                    m_layerCacheable = false;
+                }
+            }
+            m_cullRect = storedCullRect;
+
+            vec2 v[16 + 4 * RENGINE_RENDERER_BLUR_MAX_LEVELS];
+            unsigned vertexCount = 4;
+            v[0] = box.tl;
             v[1] = vec2(box.left(), box.bottom());
             v[2] = vec2(box.right(), box.top());
             v[3] = box.br;
-            m_vertexIndex += 4;
 
             if (n->type() == Node::BlurNodeType || n->type() == Node::ShadowNodeType) {
                 float radius = n->type() == Node::BlurNodeType
@@ -656,15 +2056,77 @@ inline void OpenGLRenderer::build(Node *n)
                 v[ 9] = vec2(tlr.x, brr.y);
                 v[10] = vec2(brr.x, tlr.y);
                 v[11] = vec2(brr.x, brr.y);
-                m_vertexIndex += 8;
+                vertexCount = 12;
+
+                unsigned levels = n->type() == Node::BlurNodeType ? blurLevels(radius) : 0;
+                if (levels > 0) {
+                    // Each level gets a margin of one texel and is rounded
+                    // up to a whole number of texels. The blur quads
+                    // surround the last level, with the radius rounded up
+                    // to whole texels too.
+                    rect2d level(box.tl - 1.0f, box.br + 1.0f);
+                    for (unsigned i=0; i<=levels; ++i) {
+                        float f = float(1 << i);
+                        if (i > 0) {
+                            level.tl -= f;
+                            level.br += f;
+                            level.br.x = level.tl.x + std::ceil(level.width() / f) * f;
+                            level.br.y = level.tl.y + std::ceil(level.height() / f) * f;
+                        }
+                        vec2 *lv = v + 12 + 4 * i;
+                        lv[0] = level.tl;
+                        lv[1] = vec2(level.left(), level.bottom());
+                        lv[2] = vec2(level.right(), level.top());
+                        lv[3] = level.br;
+                    }
+                    float f = float(1 << levels);
+                    float rd = std::ceil(radius / f) * f;
+                    v[ 4] = vec2(level.left() - rd, level.top());
+                    v[ 5] = vec2(level.left() - rd, level.bottom());
+                    v[ 6] = vec2(level.right() + rd, level.top());
+                    v[ 7] = vec2(level.right() + rd, level.bottom());
+                    v[ 8] = level.tl - rd;
+                    v[ 9] = vec2(level.left() - rd, level.bottom() + rd);
+                    v[10] = vec2(level.right() + rd, level.top() - rd);
+                    v[11] = level.br + rd;
+                    vertexCount = 16 + 4 * levels;
+                }
 
                 if (n->type() == Node::ShadowNodeType) {
                     v[12] = box.tl - 1.0;
                     v[13] = vec2(box.left() - 1, box.bottom() + 1);
                     v[14] = vec2(box.right() + 1, box.top() - 1);
                     v[15] = box.br + 1;
+                    vertexCount = 16;
+                }
+            }
+            m_vertexBuffer.write(m_vertexIndex, v, vertexCount);
+            m_vertexIndex += vertexCount;
+
+            if (m_damageTracking) {
+                bool damaged = m_damage.width() >= 0;
+                addDamage(storedDamage);
+                if (!m_render3d)
+                    recordDamage(n, layerOutputRect(e), changed || damaged);
+            }
+
+            if (m_layerCaching && m_layerCacheable && !m_render3d) {
+                // The cached content stays valid under whole pixel
+                // translation, anything else means rendering it again.
+                CachedLayer &cached = m_layerCache[n];
+                if (cached.texture) {
+                    const float *a = cached.matrix.m;
+                    const float *b = m_m2d.m;
+                    bool valid = std::floor(b[3] - a[3]) == b[3] - a[3] && std::floor(b[7] - a[7]) == b[7] - a[7];
+                    for (int i=0; valid && i<16; ++i)
+                        valid = i == 3 || i == 7 || a[i] == b[i];
+                    if (!valid)
+                        releaseCachedLayer(&cached);
                 }
+                cached.matrix = m_m2d;
+                cached.used = true;
             }
+            m_layerCacheable = storedCacheable && m_layerCacheable;
 
             // We're a nested layer, accumulate the layered bounding box into
             // the stored one..
@@ -696,9 +2158,11 @@ inline void OpenGLRenderer::build(Node *n)
         if (m_render3d)
             e->z = (m_m3d * vec3((p1 + p2) / 2.0f)).z;
 
-        // Add to the bounding box if we're in inside a layer
+        // Add to the bounding box if we're in inside a layer. What a render
+        // node draws can change at any time, so its layer can't be cached.
         if (m_layered) {
             m_layerBoundingBox |= geometry;
+            m_layerCacheable = false;
         }
         break;
     }
@@ -707,22 +2171,272 @@ inline void OpenGLRenderer::build(Node *n)
         break;
     }
 
-    for (Node *c = n->child(); c; c = c->sibling())
-        build(c);
+    buildChildren(n, changed);
+}
 
+/*!
+    Writes the quad for the rectangle or texture element \a e. Outside of 3D
+    projections and with instancing, this is one record in the instance
+    buffers made up of the node's \a geometry and \a transform. Otherwise
+    it is the transformed vertices \a v. \a color is used for rectangles
+    and \a texCoords for textures.
+ */
+inline void OpenGLRenderer::writeQuad(Element *e, const vec2 *v, rect2d geometry, const InstanceTransform &transform, PackedColor color, const vec2 *texCoords)
+{
+    bool rectangle = e->node->type() == Node::RectangleNodeType;
+    if (m_instancing && !m_render3d) {
+        e->instanced = true;
+        e->vboOffset = m_instanceIndex;
+        m_instanceRectBuffer.write(m_instanceIndex, &geometry, 1);
+        m_instanceTransformBuffer.write(m_instanceIndex, &transform, 1);
+        if (rectangle) {
+            m_instanceColorBuffer.write(m_instanceIndex, &color, 1);
+        } else {
+            rect2d texRect(texCoords[0], texCoords[3]);
+            m_instanceTexRectBuffer.write(m_instanceIndex, &texRect, 1);
+        }
+        m_instanceIndex += 1;
+        return;
+    }
 
+    e->vboOffset = m_vertexIndex;
+    m_vertexBuffer.write(m_vertexIndex, v, 4);
+    if (rectangle) {
+        PackedColor colors[4] = { color, color, color, color };
+        m_vertexColorBuffer.write(m_vertexIndex, colors, 4);
+    } else {
+        m_vertexTexCoordBuffer.write(m_vertexIndex, texCoords, 4);
+    }
+    m_vertexIndex += 4;
 }
 
-inline void rengine_create_texture(int id, int w, int h)
+/*!
+    Builds the children of \a n, which is \a changed or not.
+
+    When parallel building is enabled and \a n has enough children, the
+    children are split into chunks of adjacent siblings which are built on
+    the build threads and then stitched into the elements and vertex buffers
+    in order. The result is the same as that of the serial build. Only
+    subtrees of plain nodes, 2D transforms, rectangles and textures are built
+    in parallel. A chunk containing anything else, such as a layer, is built
+    serially when its turn comes.
+ */
+inline void OpenGLRenderer::buildChildren(Node *n, bool changed)
 {
-    glBindTexture(GL_TEXTURE_2D, id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    bool storedChanged = m_changedAncestor;
+    m_changedAncestor = changed;
+
+    unsigned childCount = 0;
+    if (m_buildThreadCount > 0 && !m_render3d && !m_buildPartitioned
+        && m_numRectangleNodes + m_numTextureNodes >= RENGINE_RENDERER_PARALLEL_BUILD_MIN_NODES) {
+        for (Node *c = n->child(); c; c = c->sibling())
+            ++childCount;
+    }
+
+    if (childCount == 0 || childCount < 2 * m_buildThreadCount) {
+        Node *c = n->child();
+        while (c) {
+            unsigned count = m_render3d ? 0 : gatherSiblingQuads(c, 0, &m_siblingRects);
+            if (count < 2) {
+                build(c);
+                c = c->sibling();
+                continue;
+            }
+            m_siblingVertices.resize(count * 4);
+            transformQuads2D(m_m2d, m_siblingRects.data(), count, m_siblingVertices.data());
+            for (unsigned i=0; i<count; ++i, c = c->sibling()) {
+                m_transformedQuad = m_siblingVertices.data() + i * 4;
+                build(c);
+            }
+            m_transformedQuad = 0;
+        }
+        m_changedAncestor = storedChanged;
+        return;
+    }
+
+    while (m_buildQueues.size() < m_buildThreadCount)
+        m_buildQueues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+
+    // Split the children evenly into a few chunks per thread, so that a
+    // slow chunk doesn't hold up the rest.
+    unsigned chunkCount = std::min(childCount, 4 * m_buildThreadCount);
+    while (m_buildChunks.size() < chunkCount)
+        m_buildChunks.push_back(std::make_shared<BuildChunk>());
+    Node *c = n->child();
+    for (unsigned i=0; i<chunkCount; ++i) {
+        BuildChunk *chunk = m_buildChunks[i].get();
+        chunk->first = c;
+        for (unsigned j=(i+1) * childCount / chunkCount - i * childCount / chunkCount; j>0; --j)
+            c = c->sibling();
+        chunk->last = c;
+        chunk->matrix = m_m2d;
+        chunk->cullRect = m_cullRect;
+        chunk->changed = changed;
+        chunk->quads.clear();
+    }
+
+    // The first chunk is built on this thread while the others run
+    m_buildPartitioned = true;
+    for (unsigned i=1; i<chunkCount; ++i)
+        m_buildQueues[i % m_buildThreadCount]->schedule(m_buildChunks[i]);
+    m_buildChunks[0]->onExecute();
+
+    for (unsigned i=0; i<chunkCount; ++i) {
+        BuildChunk *chunk = m_buildChunks[i].get();
+        if (i > 0)
+            chunk->waitForCompletion();
+        if (!chunk->simple) {
+            for (Node *c = chunk->first; c != chunk->last; c = c->sibling())
+                build(c);
+            continue;
+        }
+        m_culledNodes += chunk->culled;
+        for (const BuildChunk::Quad &q : chunk->quads) {
+            Element *e = m_elements + m_elementIndex;
+            e->node = q.node;
+            if (m_damageTracking)
+                recordDamage(q.node, q.bounds, q.changed);
+            writeQuad(e, q.v, q.geometry, q.transform, q.color, q.texCoords);
+            m_elementIndex += 1;
+            if (m_layered) {
+                for (int i=0; i<4; ++i)
+                    m_layerBoundingBox |= q.v[i];
+            }
+        }
+    }
+    m_buildPartitioned = false;
+    m_changedAncestor = storedChanged;
+}
+
+/*!
+    Collects the geometry of the run of rectangles and textures without
+    children starting at \a first and ending before \a last into \a rects
+    and returns how many there are. The nodes in the run are built with the
+    same matrix, so their corners can be transformed with a single call to
+    transformQuads2D().
+ */
+inline unsigned OpenGLRenderer::gatherSiblingQuads(Node *first, Node *last, std::vector<rect2d> *rects)
+{
+    rects->clear();
+    for (Node *c = first; c != last; c = c->sibling()) {
+        if ((c->type() != Node::RectangleNodeType && c->type() != Node::TextureNodeType) || c->child())
+            break;
+        rects->push_back(static_cast<RectangleNodeBase *>(c)->geometry());
+    }
+    return rects->size();
 }
 
+/*!
+    Returns true if the subtree at \a n can be built by a BuildChunk.
+ */
+inline bool OpenGLRenderer::BuildChunk::isSimple(Node *n)
+{
+    switch (n->type()) {
+    case Node::BasicNodeType:
+    case Node::RectangleNodeType:
+    case Node::TextureNodeType:
+        break;
+    case Node::TransformNodeType:
+        if (static_cast<TransformNode *>(n)->projectionDepth())
+            return false;
+        break;
+    default:
+        return false;
+    }
+    for (Node *c = n->child(); c; c = c->sibling()) {
+        if (!isSimple(c))
+            return false;
+    }
+    return true;
+}
+
+/*!
+    Does what OpenGLRenderer::build() does for the simple subtree at \a n,
+    transformed by \a m, but into the chunk's own list of quads.
+ */
+inline void OpenGLRenderer::BuildChunk::build(Node *n, const mat4 &m, bool changedAncestor)
+{
+    bool nodeChanged = changedAncestor || n->isChanged();
+    n->clearChanged();
+
+    if (n->type() == Node::TransformNodeType) {
+        buildRange(n->child(), 0, m * static_cast<TransformNode *>(n)->matrix(), nodeChanged);
+        return;
+    }
+
+    if (n->type() != Node::BasicNodeType) {
+        vec2 v[4];
+        transformQuad2D(m, static_cast<RectangleNodeBase *>(n)->geometry(), v);
+        addQuad(n, m, v, nodeChanged);
+    }
+
+    buildRange(n->child(), 0, m, nodeChanged);
+}
+
+/*!
+    Builds the siblings from \a first up to, but not including, \a last.
+    Runs of rectangles and textures without children have their corners
+    transformed together.
+ */
+inline void OpenGLRenderer::BuildChunk::buildRange(Node *first, Node *last, const mat4 &m, bool changedAncestor)
+{
+    Node *c = first;
+    while (c != last) {
+        unsigned count = gatherSiblingQuads(c, last, &siblingRects);
+        if (count < 2) {
+            build(c, m, changedAncestor);
+            c = c->sibling();
+            continue;
+        }
+        siblingVertices.resize(count * 4);
+        transformQuads2D(m, siblingRects.data(), count, siblingVertices.data());
+        for (unsigned i=0; i<count; ++i, c = c->sibling()) {
+            addQuad(c, m, siblingVertices.data() + i * 4, changedAncestor || c->isChanged());
+            c->clearChanged();
+        }
+    }
+}
+
+/*!
+    Adds the rectangle or texture \a n with the corners \a v, transformed by
+    \a m, to the chunk's quads, unless it is culled or not drawn at all.
+ */
+inline void OpenGLRenderer::BuildChunk::addQuad(Node *n, const mat4 &m, const vec2 *v, bool changed)
+{
+    if (!isDrawable(n))
+        return;
+    Quad q;
+    q.geometry = static_cast<RectangleNodeBase *>(n)->geometry();
+    std::copy(v, v + 4, q.v);
+    q.bounds = rect2d(q.v[0], q.v[0]) | q.v[1] | q.v[2] | q.v[3];
+    if (!q.bounds.intersects(cullRect)) {
+        ++culled;
+        return;
+    }
+    q.node = n;
+    q.changed = changed;
+    q.transform = instanceTransform(m);
+    if (n->type() == Node::RectangleNodeType)
+        q.color = packedColor(static_cast<RectangleNode *>(n)->color());
+    else
+        quadTexCoords(static_cast<TextureNode *>(n), q.texCoords);
+    quads.push_back(q);
+}
+
+inline void OpenGLRenderer::BuildChunk::onExecute()
+{
+    // Check the whole chunk before touching it, so that a chunk which has
+    // to be built serially is left as it was.
+    culled = 0;
+    simple = true;
+    for (Node *c = first; simple && c != last; c = c->sibling())
+        simple = isSimple(c);
+    if (!simple)
+        return;
+    buildRange(first, last, matrix, changed);
+}
+
+
 
 // static int recursion;
 
@@ -742,6 +2456,44 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
         return;
     }
 
+    BlurNode *blurNode = BlurNode::from(e->node);
+    ShadowNode *shadowNode = ShadowNode::from(e->node);
+
+    if (blurNode || shadowNode) {
+        devRect.tl -= 1.0f;
+        devRect.br += 1.0f;
+    }
+
+    // Reuse the layer from an earlier frame if we can. The subtree is then
+    // not rendered at all.
+    CachedLayer *cached = 0;
+    if (!m_layerCache.empty()) {
+        auto i = m_layerCache.find(e->node);
+        if (i != m_layerCache.end())
+            cached = &i->second;
+    }
+    if (cached && cached->texture) {
+        if (cached->size == devRect.size()
+            && (!(blurNode || shadowNode) || cached->expandedSize == boundingRectFor(e->vboOffset + 4).size())) {
+            e->texture = cached->texture;
+            e->sourceTexture = cached->sourceTexture;
+            e->cached = true;
+            for (unsigned i=1; i<=e->groupSize; ++i)
+                (e+i)->completed = true;
+            ++m_layerCacheHits;
+            return;
+        }
+        releaseCachedLayer(cached);
+    }
+
+    ++m_frameStats.layersRendered;
+
+    // What the GPU does for the layer is timed on its own
+    OpenGLGpuTimer::Pass storedPass = m_gpuTimer.switchTo(blurNode ? OpenGLGpuTimer::BlurLayers
+                                                          : shadowNode ? OpenGLGpuTimer::ShadowLayers
+                                                          : e->node->type() == Node::ColorFilterNodeType ? OpenGLGpuTimer::ColorFilterLayers
+                                                          : OpenGLGpuTimer::OpacityLayers);
+
     // Store current state...
     bool stored3d = m_render3d;
     bool storedTextureed = m_layered;
@@ -752,23 +2504,18 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     m_render3d |= e->projection;
     m_layered = true;
 
-
-    BlurNode *blurNode = BlurNode::from(e->node);
-    ShadowNode *shadowNode = ShadowNode::from(e->node);
-
-    if (blurNode || shadowNode) {
-        devRect.tl -= 1.0f;
-        devRect.br += 1.0f;
-    }
+    // Layers are rendered in full, only drawing them to the surface is
+    // limited to the repainted part.
+    if (m_scissoring)
+        glDisable(GL_SCISSOR_TEST);
 
     // std::cout << space << " ---> from " << e->vboOffset << " " << m_vertices[e->vboOffset] << " " << m_vertices[e->vboOffset+3] << std::endl;
 
     m_surfaceSize = devRect.size();
 
-    e->texture = m_texturePool.acquire();
-    rengine_create_texture(e->texture, devRect.width(), devRect.height());
+    e->texture = acquireLayerTexture(devRect.size());
 
-    glGenFramebuffers(1, &m_fbo);
+    m_fbo = m_framebufferPool.acquire();
     glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, e->texture, 0);
 
@@ -783,10 +2530,7 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
 #endif
 
     // Render the layered group
-    m_proj = mat4::scale2D(1.0, -1.0)
-             * mat4::translate2D(-1.0, 1.0)
-             * mat4::scale2D(2.0f / devRect.width(), -2.0f / devRect.height())
-             * mat4::translate2D(-devRect.tl.x, -devRect.tl.y);
+    m_proj = layerProjection(devRect);
     m_matrixState = UpdateAllPrograms;
 
     // std::cout << " ---> rect=" << devRect << " texture=" << e->texture << " fbo=" << m_fbo
@@ -797,16 +2541,44 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     glClear(GL_COLOR_BUFFER_BIT);
     render(e + 1, e + e->groupSize + 1);
 
-    if (blurNode || shadowNode) {
+    unsigned levels = blurNode ? blurLevels(blurNode->radius()) : 0;
+    if (levels > 0) {
+        // Downsample the layer, each level at half the resolution of the
+        // one before and rendered from it, then do the horizontal pass of
+        // the blur on the last level.
+        GLuint source = e->texture;
+        for (unsigned i=1; i<=levels; ++i) {
+            float f = float(1 << i);
+            rect2d level = boundingRectFor(e->vboOffset + 12 + 4 * i);
+            GLuint texture = acquireLayerTexture(level.size() / f);
+            m_proj = layerProjection(level);
+            m_matrixState = UpdateAllPrograms;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glViewport(0, 0, level.width() / f, level.height() / f);
+            drawTextureQuad(e->vboOffset + 12 + 4 * (i - 1), source, 1.0, f / 2);
+            m_texturePool.release(source);
+            source = texture;
+        }
+        float f = float(1 << levels);
+        vec2 levelSize = boundingRectFor(e->vboOffset + 12 + 4 * levels).size() / f;
+        rect2d expandedWidth = boundingRectFor(e->vboOffset + 4);
+        vec2 expandedSize = expandedWidth.size() / f;
+        e->texture = acquireLayerTexture(expandedSize);
+        m_proj = layerProjection(expandedWidth);
+        m_matrixState = UpdateAllPrograms;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, e->texture, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glViewport(0, 0, expandedSize.x, expandedSize.y);
+        int radius = std::ceil(blurNode->radius() / f);
+        drawBlurQuad(e->vboOffset + 4, source, radius, expandedSize, levelSize, vec2(1/expandedSize.x, 0));
+        m_texturePool.release(source);
+    } else if (blurNode || shadowNode) {
         int tmpTex = e->texture;
-        e->texture = m_texturePool.acquire();
         rect2d expandedWidth = boundingRectFor(e->vboOffset + 4);
-        m_proj = mat4::scale2D(1.0, -1.0)
-                 * mat4::translate2D(-1.0, 1.0)
-                 * mat4::scale2D(2.0f / expandedWidth.width(), -2.0f / expandedWidth.height())
-                 * mat4::translate2D(-expandedWidth.tl.x, -expandedWidth.tl.y);
+        e->texture = acquireLayerTexture(expandedWidth.size());
+        m_proj = layerProjection(expandedWidth);
         m_matrixState = UpdateAllPrograms;
-        rengine_create_texture(e->texture, expandedWidth.width(), expandedWidth.height());
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, e->texture, 0);
         glClear(GL_COLOR_BUFFER_BIT);
         glViewport(0, 0, expandedWidth.width(), expandedWidth.height());
@@ -819,11 +2591,19 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
         }
     }
 
-    // Reset the GL state..
-    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    if (cached) {
+        cached->texture = e->texture;
+        cached->sourceTexture = e->sourceTexture;
+        cached->size = devRect.size();
+        if (blurNode || shadowNode)
+            cached->expandedSize = boundingRectFor(e->vboOffset + 4).size();
+        e->cached = true;
+    }
+
+    // Reset the GL state. The texture stays attached until the framebuffer
+    // is reused, which saves a round of validation.
     glBindFramebuffer(GL_FRAMEBUFFER, storedFbo);
-    glDeleteFramebuffers(1, &m_fbo);
+    m_framebufferPool.release(m_fbo);
 
     // Reset the old state...
     m_fbo = storedFbo;
@@ -832,10 +2612,110 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     m_proj = storedProjection;
     m_matrixState = UpdateAllPrograms;
     m_surfaceSize = storedSize;
+    if (m_scissoring && m_fbo == 0)
+        glEnable(GL_SCISSOR_TEST);
+    m_gpuTimer.switchTo(storedPass);
 
     // std::cout << space << "- layer is completed..." << std::endl;
 }
 
+/*!
+    Sorts the elements of the 3D projection \a e back to front, with the
+    elements which are already completed, those inside layers, moved to the
+    end.
+
+    Every frame starts out with the elements in the order they were built,
+    and their depth rarely changes much from one frame to the next, so the
+    order from the last frame is sorted again with an insertion sort, which
+    then takes close to linear time. Elements at the same depth are ordered
+    by their index, so they are drawn in the order of the scene graph no
+    matter where they were last frame.
+ */
+inline void OpenGLRenderer::sortProjection(Element *e)
+{
+    Element *first = e + 1;
+    unsigned size = e->groupSize;
+
+    unsigned count = 0;
+    for (unsigned i=0; i<size; ++i) {
+        if (!first[i].completed)
+            ++count;
+    }
+
+    // The last frame's order can be used as long as it holds the same
+    // elements, which it doesn't after structural changes.
+    std::vector<unsigned> &order = m_projectionOrders[e->node].order;
+    bool valid = order.size() == count;
+    for (unsigned i=0; valid && i<count; ++i)
+        valid = order[i] < size && !first[order[i]].completed;
+    if (!valid) {
+        order.clear();
+        for (unsigned i=0; i<size; ++i) {
+            if (!first[i].completed)
+                order.push_back(i);
+        }
+    }
+
+    // Insertion sort is quadratic when the order is far off, which it is
+    // without a last frame to start from or after a big jump, so give up on
+    // it once elements have moved 16 places each on average.
+    auto byDepth = [first] (unsigned a, unsigned b) {
+        return first[a].z < first[b].z || (first[a].z == first[b].z && a < b);
+    };
+    unsigned moves = valid ? 0 : count * count;
+    for (unsigned i=1; i<count && moves <= 16 * count; ++i) {
+        unsigned index = order[i];
+        unsigned j = i;
+        for (; j > 0 && byDepth(index, order[j - 1]); --j)
+            order[j] = order[j - 1];
+        order[j] = index;
+        moves += i - j;
+    }
+    if (moves > 16 * count)
+        std::sort(order.begin(), order.end(), byDepth);
+
+    m_sortedElements.assign(first, first + size);
+    for (unsigned i=0; i<count; ++i)
+        first[i] = m_sortedElements[order[i]];
+    for (const Element &c : m_sortedElements) {
+        if (c.completed)
+            first[count++] = c;
+    }
+}
+
+inline void OpenGLRenderer::setBlurMode(BlurMode mode)
+{
+    if (mode == m_blurMode)
+        return;
+    m_blurMode = mode;
+    // The layout of blur layers changes, so nothing can be reused
+    for (auto &i : m_layerCache)
+        releaseCachedLayer(&i.second);
+    m_layerCache.clear();
+    m_builtSceneRoot = 0;
+}
+
+inline unsigned OpenGLRenderer::blurLevels(unsigned radius) const
+{
+    if (m_blurMode == FullResolutionBlur || radius == 0)
+        return 0;
+    unsigned levels = m_blurMode == DownsampledBlur ? 1 : 0;
+    while (levels < RENGINE_RENDERER_BLUR_MAX_LEVELS
+           && (radius + (1 << levels) - 1) >> levels > RENGINE_RENDERER_BLUR_DOWNSAMPLE_RADIUS)
+        ++levels;
+    return levels;
+}
+
+inline void OpenGLRenderer::releaseCachedLayer(CachedLayer *layer)
+{
+    if (layer->texture)
+        m_texturePool.release(layer->texture);
+    if (layer->sourceTexture)
+        m_texturePool.release(layer->sourceTexture);
+    layer->texture = 0;
+    layer->sourceTexture = 0;
+}
+
 /*!
     Render the elements, starting at \a first and all elements up to, but not including \a last.
  */
@@ -851,7 +2731,12 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
         Element *e = first;
         // std::cout << space << "- checking layering for " << e << std::endl;
         while (e < last) {
-            if (e->layered) {
+            if (e->layered && m_scissoring && m_fbo == 0 && !layerOutputRect(e).intersects(m_repaintRect)) {
+                // Nothing the layer draws is repainted
+                for (unsigned i=0; i<=e->groupSize; ++i)
+                    (e+i)->completed = true;
+                e = e + e->groupSize + 1;
+            } else if (e->layered) {
                 // std::cout << space << "- needs layering: " << e << std::endl;
                 // ++recursion;
                 renderToLayer(e);
@@ -874,30 +2759,42 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
             continue;
         }
 
-        if (e->node->type() == Node::RectangleNodeType) {
+        if (m_depthTesting)
+            setElementDepth(e);
+
+        if (e->node->type() == Node::RectangleNodeType && (m_batching || e->instanced)) {
+            e = drawColorQuadBatch(e, last);
+            continue;
+        } else if (e->node->type() == Node::RectangleNodeType) {
             // std::cout << space << "---> rect quad, vbo=" << e->vboOffset
             //      << " " << m_proj * m_vertices[e->vboOffset] << " " << m_proj * m_vertices[e->vboOffset+3] << std::endl;
             drawColorQuad(e->vboOffset, static_cast<RectangleNode *>(e->node)->color());
         } else if (e->node->type() == Node::TextureNodeType) {
             // std::cout << space << "---> texture quad, vbo=" << e->vboOffset << std::endl;
-            const Texture *texture = static_cast<TextureNode *>(e->node)->texture();
-            drawTextureQuad(e->vboOffset, texture->textureId(), 1.0f, texture->format());
+            e = drawTextureQuadBatch(e, last);
+            continue;
         } else if (e->node->type() == Node::OpacityNodeType && e->layered && e->texture) {
             // std::cout << space << "---> layered texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << std::endl;
             drawTextureQuad(e->vboOffset, e->texture, static_cast<OpacityNode *>(e->node)->opacity());
-            m_texturePool.release(e->texture);
+            if (!e->cached)
+                m_texturePool.release(e->texture);
         } else if (e->node->type() == Node::ColorFilterNodeType && e->layered && e->texture) {
             // std::cout << space << "---> layered texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << std::endl;
             drawColorFilterQuad(e->vboOffset, e->texture, static_cast<ColorFilterNode *>(e->node)->colorMatrix());
-            m_texturePool.release(e->texture);
+            if (!e->cached)
+                m_texturePool.release(e->texture);
         } else if (e->node->type() == Node::BlurNodeType && e->layered && e->texture) {
             // std::cout << space << "---> blur texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << std::endl;
             BlurNode *blurNode = static_cast<BlurNode *>(e->node);
-            vec2 textureSize = boundingRectFor(e->vboOffset + 4).size();
-            vec2 renderSize = boundingRectFor(e->vboOffset + 8).size();
+            // A downsampled blur's texture is 1/f the size of its quad
+            float f = float(1 << blurLevels(blurNode->radius()));
+            vec2 textureSize = boundingRectFor(e->vboOffset + 4).size() / f;
+            vec2 renderSize = boundingRectFor(e->vboOffset + 8).size() / f;
+            int radius = std::ceil(blurNode->radius() / f);
             // std::cout << " - radius: " << blurNode->radius() << " textureSize=" << textureSize << ", renderSize=" << renderSize << std::endl;
-            drawBlurQuad(e->vboOffset + 8, e->texture, blurNode->radius(), renderSize, textureSize, vec2(0, 1/renderSize.y));
-            m_texturePool.release(e->texture);
+            drawBlurQuad(e->vboOffset + 8, e->texture, radius, renderSize, textureSize, vec2(0, 1/renderSize.y));
+            if (!e->cached)
+                m_texturePool.release(e->texture);
         } else if (e->node->type() == Node::ShadowNodeType && e->layered && e->texture) {
             // std::cout << "---> shadow texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << std::endl;
             ShadowNode *shadowNode = static_cast<ShadowNode *>(e->node);
@@ -911,16 +2808,19 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
             m_proj = storedProj;
             m_matrixState |= UpdateShadowProgram;
             drawTextureQuad(e->vboOffset + 12, e->sourceTexture);
-            m_texturePool.release(e->texture);
-            m_texturePool.release(e->sourceTexture);
+            if (!e->cached) {
+                m_texturePool.release(e->texture);
+                m_texturePool.release(e->sourceTexture);
+            }
         } else if (e->projection) {
-            std::sort(e + 1, e + e->groupSize + 1);
+            sortProjection(e);
             // std::cout << space << "---> projection, sorting range: " << (e+1) << " -> " << (e+e->groupSize) << std::endl;
         } else if (e->node->type() == Node::RenderNodeType) {
             RenderNode *rn = static_cast<RenderNode *>(e->node);
             if (rn->width() != 0 && rn->height() != 0) {
                 activateShader(0);
-                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                m_state.bindArrayBuffer(0);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
                 rn->render(m_proj);
                 setDefaultOpenGLState();
             }
@@ -931,25 +2831,270 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
     }
 }
 
+/*!
+
+    Returns how far outside of its own bounds the content of the layer node
+    \a n can reach, or the other way around, how far outside of the area
+    that matters the layer's content needs to be kept. This errs on the large
+    side, as the downsampled blur reaches a bit further than its radius.
+
+ */
+inline float OpenGLRenderer::layerMargin(const Node *n)
+{
+    if (n->type() == Node::BlurNodeType)
+        return 2.0f * static_cast<const BlurNode *>(n)->radius() + 2.0f;
+    if (n->type() == Node::ShadowNodeType) {
+        const ShadowNode *shadow = static_cast<const ShadowNode *>(n);
+        vec2 offset = shadow->offset();
+        return 2.0f * shadow->radius() + 2.0f + std::ceil(std::max(std::abs(offset.x), std::abs(offset.y)));
+    }
+    return 0;
+}
+
+/*!
+    Returns the part of the surface which the layer element \a e draws to.
+ */
+inline rect2d OpenGLRenderer::layerOutputRect(const Element *e) const
+{
+    if (e->node->type() == Node::BlurNodeType)
+        return boundingRectFor(e->vboOffset + 8);
+    if (e->node->type() == Node::ShadowNodeType) {
+        vec2 offset = static_cast<const ShadowNode *>(e->node)->offset();
+        rect2d shadow = boundingRectFor(e->vboOffset + 8);
+        shadow.tl += vec2(std::round(offset.x), std::round(offset.y));
+        shadow.br += vec2(std::round(offset.x), std::round(offset.y));
+        return shadow | boundingRectFor(e->vboOffset + 12);
+    }
+    return boundingRectFor(e->vboOffset);
+}
+
+/*!
+    Remembers that \a n is drawn to \a bounds in this build and adds the
+    parts of the surface which need to be repainted because of it to the
+    damage.
+ */
+inline void OpenGLRenderer::recordDamage(const Node *n, rect2d bounds, bool changed)
+{
+    auto i = m_damageBounds.find(n);
+    if (i == m_damageBounds.end()) {
+        addDamage(bounds);
+    } else {
+        if (changed || !(i->second == bounds)) {
+            addDamage(i->second);
+            addDamage(bounds);
+        }
+        m_damageBounds.erase(i);
+    }
+    m_newDamageBounds[n] = bounds;
+}
+
+inline void OpenGLRenderer::resetDamage()
+{
+    m_damageBounds.clear();
+    m_newDamageBounds.clear();
+    m_damageHistory.clear();
+}
+
+inline bool OpenGLRenderer::isOpaque(const Element *e)
+{
+    if (e->node->type() == Node::RectangleNodeType)
+        return static_cast<RectangleNode *>(e->node)->color().w >= 1.0f;
+    if (e->node->type() == Node::TextureNodeType)
+        return !(static_cast<TextureNode *>(e->node)->texture()->format() & Texture::AlphaFormatMask);
+    return false;
+}
+
+/*!
+
+    Places the quads drawn for \a e at a depth which is in front of all the
+    elements before it and behind all the elements after it. Batches are
+    drawn at the depth of their first element, which is fine as the elements
+    in a batch are never separated by an opaque one.
+
+ */
+inline void OpenGLRenderer::setElementDepth(const Element *e)
+{
+    double z = elementDepth(e);
+#ifdef RENGINE_OPENGL_DESKTOP
+    glDepthRange(z, z);
+#else
+    glDepthRangef(z, z);
+#endif
+}
+
+/*!
+
+    Finds the runs of opaque elements in the top level of \a first to \a last
+    for renderOpaque() and writes the depth of each of their vertices, in
+    normalized device coordinates, to the retained depth buffer. This happens
+    before the vertex buffers are uploaded.
+
+ */
+inline void OpenGLRenderer::prepareOpaque(Element *first, Element *last)
+{
+    // Layers and 3D projections are not looked into. Instanced elements
+    // are left from before the opaque pass was enabled.
+    m_opaqueRuns.clear();
+    Element *e = first;
+    while (e < last) {
+        if (isOpaque(e) && !e->instanced) {
+            Element *begin = e;
+            for (; e < last && isOpaque(e) && !e->instanced; ++e) {
+                float z = float(elementDepth(e) * 2.0 - 1.0);
+                const float depths[4] = { z, z, z, z };
+                m_vertexDepthBuffer.write(e->vboOffset, depths, 4);
+            }
+            m_opaqueRuns.push_back(begin);
+            m_opaqueRuns.push_back(e);
+        } else if (e->layered || e->projection) {
+            e += e->groupSize + 1;
+        } else {
+            ++e;
+        }
+    }
+}
+
+/*!
+
+    Draws the runs of opaque elements found by prepareOpaque(),
+    front-to-back and without blending. The elements that are drawn are
+    marked as completed, so render() skips them afterwards.
+
+ */
+inline void OpenGLRenderer::renderOpaque()
+{
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_reversedQuadIndexBuffer);
+    for (int i=int(m_opaqueRuns.size())-2; i>=0; i-=2) {
+        Element *begin = m_opaqueRuns[i];
+        Element *e = m_opaqueRuns[i+1];
+        m_opaquePassElements += e - begin;
+        while (e > begin)
+            e = drawOpaqueBatch(begin, e);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIndexBuffer);
+}
+
+/*!
+
+    Draws the run of opaque elements which ends right before \a last, going
+    back no further than \a first, using a single draw call. The run is
+    limited the same way as in drawColorQuadBatch() and
+    drawTextureQuadBatch(). The quads are drawn last one first, using the
+    reversed index buffer, and each carries the depth of its element, so
+    the elements in the run are depth tested against each other too.
+
+    Returns the first element of the run.
+
+ */
+inline OpenGLRenderer::Element *OpenGLRenderer::drawOpaqueBatch(Element *first, Element *last)
+{
+    Element *e = last - 1;
+    Node::Type type = e->node->type();
+    GLuint id = 0;
+    bool bgr = false;
+    if (type == Node::TextureNodeType) {
+        const Texture *texture = static_cast<TextureNode *>(e->node)->texture();
+        id = texture->textureId();
+        bgr = texture->format() == Texture::BGRA_32 || texture->format() == Texture::BGRx_32;
+    }
+
+    unsigned maxQuads = m_batching ? RENGINE_RENDERER_MAX_BATCH_QUADS : 1;
+    unsigned quads = 1;
+    e->completed = true;
+    while (e > first && quads < maxQuads) {
+        Element *previous = e - 1;
+        if (previous->node->type() != type || previous->vboOffset + 4 != e->vboOffset)
+            break;
+        if (type == Node::TextureNodeType) {
+            const Texture *t = static_cast<TextureNode *>(previous->node)->texture();
+            if (t->textureId() != id || bgr != (t->format() == Texture::BGRA_32 || t->format() == Texture::BGRx_32))
+                break;
+        }
+        e = previous;
+        e->completed = true;
+        ++quads;
+    }
+
+    m_state.bindArrayBuffer(m_vertexBuffer.id);
+    m_state.attribute(0, 2, GL_FLOAT, GL_FALSE, 0, e->vboOffset * sizeof(vec2));
+    if (type == Node::TextureNodeType) {
+        if (bgr) {
+            activateShader(&prog_textureBgrOpaque);
+            ensureMatrixUpdated(UpdateTextureBgrOpaqueProgram, &prog_textureBgrOpaque);
+        } else {
+            activateShader(&prog_textureOpaque);
+            ensureMatrixUpdated(UpdateTextureOpaqueProgram, &prog_textureOpaque);
+        }
+        m_state.bindArrayBuffer(m_vertexTexCoordBuffer.id);
+        m_state.attribute(1, 2, GL_FLOAT, GL_FALSE, 0, e->vboOffset * sizeof(vec2));
+        m_state.bindTexture(id);
+    } else {
+        activateShader(&prog_solidOpaque);
+        ensureMatrixUpdated(UpdateSolidOpaqueProgram, &prog_solidOpaque);
+        m_state.bindArrayBuffer(m_vertexColorBuffer.id);
+        m_state.attribute(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, e->vboOffset * sizeof(PackedColor));
+    }
+    m_state.bindArrayBuffer(m_vertexDepthBuffer.id);
+    m_state.attribute(2, 1, GL_FLOAT, GL_FALSE, 0, e->vboOffset * sizeof(float));
+
+    size_t offset = (RENGINE_RENDERER_MAX_BATCH_QUADS - quads) * 6 * sizeof(GLushort);
+    glDrawElements(GL_TRIANGLES, quads * 6, GL_UNSIGNED_SHORT, (void *) offset);
+    ++m_frameStats.drawCalls;
+
+    m_drawCallsSaved += quads - 1;
+
+    return e;
+}
+
 inline void OpenGLRenderer::setDefaultOpenGLState()
 {
+    // Whatever ran before us may have changed anything
+    m_state.invalidate();
+
     // Assign our static texture coordinate buffer to attribute 1.
-    glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    m_state.bindArrayBuffer(m_texCoordBuffer);
+    m_state.attribute(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
-    // Bind the vertices
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    // Bind the vertices and the index buffer used for batches
+    m_state.bindArrayBuffer(m_vertexBuffer.id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIndexBuffer);
 
     // Set our default GL state..
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_STENCIL_TEST);
     glDepthMask(false);
-    glEnable(GL_BLEND);
+    m_state.setBlending(true);
     glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
 }
 
 inline bool OpenGLRenderer::render()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    m_frameStats = FrameStats();
+
+    bool rendered = renderFrame();
+
+    FrameStats &stats = m_frameStats;
+    stats.rectangleNodes = m_numRectangleNodes;
+    stats.textureNodes = m_numTextureNodes;
+    stats.transformNodes = m_numTransformNodes;
+    stats.transformNodesWith3d = m_numTransformNodesWith3d;
+    stats.layeredNodes = m_numLayeredNodes;
+    stats.renderNodes = m_numRenderNodes;
+    stats.culledNodes = m_culledNodes;
+    stats.elements = m_builtElements.size();
+    stats.sceneRebuilt = m_sceneRebuilt;
+    stats.vertexBytesUploaded = m_vertexBytesUploaded;
+    stats.layersCached = m_layerCacheHits;
+    stats.texturePoolTextures = m_texturePool.entries.size();
+    stats.texturePoolMemory = m_texturePool.memory;
+    stats.renderTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                       - stats.prepassTime - stats.buildTime;
+    return rendered;
+}
+
+inline bool OpenGLRenderer::renderFrame()
 {
     if (sceneRoot() == 0) {
         logw << " - no 'sceneRoot', surely this is not what you intended?" << std::endl;
@@ -958,43 +3103,184 @@ inline bool OpenGLRenderer::render()
 
     vec4 c = fillColor();
     glClearColor(c.x, c.y, c.z, c.w);
-    glClear(GL_COLOR_BUFFER_BIT);
 
     logd << std::endl;
 
-    m_numLayeredNodes = 0;
-    m_numTextureNodes = 0;
-    m_numRectangleNodes = 0;
-    m_numTransformNodes = 0;
-    m_numTransformNodesWith3d = 0;
-    m_numRenderNodes = 0;
-    m_additionalQuads = 0;
-    m_vertexIndex = 0;
-    m_elementIndex = 0;
-    prepass(sceneRoot());
-
-    unsigned vertexCount = (m_numTextureNodes
+    m_drawCallsSaved = 0;
+    m_vertexBytesUploaded = 0;
+    m_state.issued = 0;
+    m_state.skipped = 0;
+    m_layerCacheHits = 0;
+    m_opaquePassElements = 0;
+
+    // Without a buffer age, we don't know what the buffer contains
+    int bufferAge = targetSurface()->bufferAge();
+    m_damageTracking = m_damageTrackingEnabled && bufferAge > 0;
+    if (!m_damageTracking)
+        resetDamage();
+
+    // Nodes mark themselves and their ancestors dirty when they change, so
+    // if the root is clean, the elements and vertices from the last frame
+    // are still valid. Where the nodes were drawn is only recorded while
+    // tracking damage, so the first frame with it builds everything.
+    vec2 size = targetSurface()->size();
+    bool fullDamage = sceneRoot() != m_builtSceneRoot
+                      || size != m_builtSurfaceSize
+                      || !(c == m_builtFillColor)
+                      || (m_damageTracking && m_damageHistory.empty());
+    m_sceneRebuilt = fullDamage || sceneRoot()->isDirty();
+    m_builtFillColor = c;
+    const float inf = std::numeric_limits<float>::infinity();
+    m_damage = rect2d(inf, inf, -inf, -inf);
+    m_repaintRect = rect2d(vec2(), size);
+
+    if (m_sceneRebuilt) {
+        m_numLayeredNodes = 0;
+        m_numTextureNodes = 0;
+        m_numRectangleNodes = 0;
+        m_numTransformNodes = 0;
+        m_numTransformNodesWith3d = 0;
+        m_numRenderNodes = 0;
+        m_numProjectedQuads = 0;
+        m_additionalQuads = 0;
+        m_vertexIndex = 0;
+        m_instanceIndex = 0;
+        m_elementIndex = 0;
+        m_culledNodes = 0;
+        m_builtSceneRoot = sceneRoot();
+        m_builtSurfaceSize = targetSurface()->size();
+        m_builtElements.clear();
+        // The opaque pass needs its elements in the vertex buffers, as
+        // instances can't be drawn in reverse order
+        m_instancing = m_instancingEnabled && m_instancingSupported && !(m_opaquePass && m_depthBits > 0);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        prepass(sceneRoot());
+        m_frameStats.prepassTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // With instancing, only the rectangles and textures inside 3D
+    // projections need vertices
+    unsigned quadCount = m_numTextureNodes + m_numRectangleNodes;
+    unsigned instanceCount = m_instancing ? quadCount - m_numProjectedQuads : 0;
+    unsigned vertexCount = ((m_instancing ? m_numProjectedQuads : quadCount)
                             + m_numLayeredNodes
-                            + m_numRectangleNodes
                             + m_additionalQuads) * 4;
-    if (vertexCount == 0)
+    if (vertexCount == 0 && instanceCount == 0) {
+        resetDamage();
+        glClear(GL_COLOR_BUFFER_BIT);
         return true;
+    }
 
-    m_vertices = (vec2 *) alloca(vertexCount * sizeof(vec2));
     unsigned elementCount = (m_numLayeredNodes + m_numTextureNodes + m_numRectangleNodes + m_numTransformNodesWith3d + m_numRenderNodes);
-    m_elements = (Element *) alloca(elementCount * sizeof(Element));
-    memset(m_elements, 0, elementCount * sizeof(Element));
-    // std::cout << "render: " << m_numTextureNodes << " textures, "
-    //                    << m_numRectangleNodes << " rects, "
-    //                    << m_numTransformNodes << " xforms, "
-    //                    << m_numTransformNodesWith3d << " xforms3D, "
-    //                    << m_numLayeredNodes << " layered nodes (opacity, colorfilter, blur or shadow), "
-    //                    << vertexCount * sizeof(vec2) << " bytes (" << vertexCount << " vertices), "
-    //                    << elementCount * sizeof(Element) << " bytes (" << elementCount << " elements)"
-    //                    << std::endl;
-    build(sceneRoot());
-    assert(elementCount > 0);
-    assert(m_elementIndex == elementCount);
+    if (m_sceneRebuilt) {
+        m_vertexBuffer.resize(vertexCount);
+        m_vertexColorBuffer.resize(vertexCount);
+        m_vertexTexCoordBuffer.resize(vertexCount);
+        m_vertexDepthBuffer.resize(vertexCount);
+        m_instanceRectBuffer.resize(instanceCount);
+        m_instanceTransformBuffer.resize(instanceCount);
+        m_instanceColorBuffer.resize(instanceCount);
+        m_instanceTexRectBuffer.resize(instanceCount);
+        m_vertices = m_vertexBuffer.data.data();
+        m_builtElements.resize(elementCount);
+        m_elements = m_builtElements.data();
+        memset(m_elements, 0, elementCount * sizeof(Element));
+        // std::cout << "render: " << m_numTextureNodes << " textures, "
+        //                    << m_numRectangleNodes << " rects, "
+        //                    << m_numTransformNodes << " xforms, "
+        //                    << m_numTransformNodesWith3d << " xforms3D, "
+        //                    << m_numLayeredNodes << " layered nodes (opacity, colorfilter, blur or shadow), "
+        //                    << vertexCount * sizeof(vec2) << " bytes (" << vertexCount << " vertices), "
+        //                    << elementCount * sizeof(Element) << " bytes (" << elementCount << " elements)"
+        //                    << std::endl;
+        m_cullRect = rect2d(vec2(), m_builtSurfaceSize);
+        m_changedAncestor = false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        build(sceneRoot());
+        m_frameStats.buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        assert(m_elementIndex <= elementCount);
+        assert(m_vertexIndex <= vertexCount);
+        assert(m_instanceIndex <= instanceCount);
+
+        // Nodes which are no longer drawn leave damage where they were
+        for (auto &i : m_damageBounds)
+            addDamage(i.second);
+        m_damageBounds.clear();
+        std::swap(m_damageBounds, m_newDamageBounds);
+
+        // Culled nodes leave the end of the elements unused
+        m_builtElements.resize(m_elementIndex);
+
+        // Drop cached layers which are no longer part of the scene
+        for (auto i = m_layerCache.begin(); i != m_layerCache.end(); ) {
+            if (i->second.used) {
+                i->second.used = false;
+                ++i;
+            } else {
+                releaseCachedLayer(&i->second);
+                i = m_layerCache.erase(i);
+            }
+        }
+        for (auto i = m_projectionOrders.begin(); i != m_projectionOrders.end(); ) {
+            if (i->second.used) {
+                i->second.used = false;
+                ++i;
+            } else {
+                i = m_projectionOrders.erase(i);
+            }
+        }
+    }
+    elementCount = m_builtElements.size();
+    if (elementCount == 0) {
+        resetDamage();
+        glClear(GL_COLOR_BUFFER_BIT);
+        m_vertices = 0;
+        m_elements = 0;
+        return true;
+    }
+
+    // The buffer has to be repainted where it differs from the current
+    // frame, which is what changed in this frame and in the frames after
+    // the buffer was last used.
+    if (m_damageTracking) {
+        rect2d surfaceRect(vec2(), size);
+        if (fullDamage || m_numRenderNodes > 0 || m_numTransformNodesWith3d > 0)
+            m_damage = surfaceRect;
+        m_damageHistory.insert(m_damageHistory.begin(), m_damage.aligned() & surfaceRect);
+        if (unsigned(bufferAge) <= m_damageHistory.size()) {
+            m_repaintRect = rect2d(inf, inf, -inf, -inf);
+            for (int i=0; i<bufferAge; ++i) {
+                rect2d r = m_damageHistory[i];
+                if (r.width() > 0 && r.height() > 0)
+                    m_repaintRect |= r;
+            }
+        }
+        if (m_repaintRect.width() <= 0 || m_repaintRect.height() <= 0)
+            m_repaintRect = rect2d();
+        targetSurface()->setDamage(m_repaintRect);
+        if (m_repaintRect.width() == 0) {
+            // The frame isn't presented, so the buffer ages stay as they are
+            m_damageHistory.erase(m_damageHistory.begin());
+            m_frameStats.surfaceUnchanged = true;
+            return true;
+        }
+        if (m_damageHistory.size() > RENGINE_RENDERER_MAX_BUFFER_AGE)
+            m_damageHistory.pop_back();
+        m_scissoring = !(m_repaintRect == surfaceRect);
+        if (m_scissoring) {
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(m_repaintRect.left(), size.y - m_repaintRect.bottom(), m_repaintRect.width(), m_repaintRect.height());
+        }
+    }
+    m_gpuTimer.beginFrame();
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Rendering sorts the elements and marks them as completed, so it works
+    // on a copy and leaves the built elements intact for the next frame.
+    m_vertices = m_vertexBuffer.data.data();
+    m_frameElements.assign(m_builtElements.begin(), m_builtElements.end());
+    m_elements = m_frameElements.data();
+
     // for (unsigned i=0; i<m_elementIndex; ++i) {
     //     const Element &e = m_elements[i];
     //     std::cout << " " << std::setw(5) << i << ": " << "element=" << &e << " node=" << e.node << " " << e.node->type() << " "
@@ -1006,10 +3292,28 @@ inline bool OpenGLRenderer::render()
     // for (unsigned i=0; i<m_vertexIndex; ++i)
     //     std::cout << "vertex[" << std::setw(5) << i << "]=" << m_vertices[i] << std::endl;
 
-    setDefaultOpenGLState();
+    // The opaque pass writes the depth of its elements' vertices, so it is
+    // set up before the upload
+    m_depthTesting = m_opaquePass
+                     && m_depthBits > 0
+                     && m_numRenderNodes == 0
+                     && elementCount < RENGINE_RENDERER_DEPTH_STEPS;
+    if (m_depthTesting)
+        prepareOpaque(m_elements, m_elements + elementCount);
+
+    // Only the parts of the retained buffers which changed since the last
+    // frame are uploaded.
+    if (m_depthTesting)
+        m_vertexBytesUploaded += m_vertexDepthBuffer.upload();
+    m_vertexBytesUploaded += m_vertexColorBuffer.upload();
+    m_vertexBytesUploaded += m_vertexTexCoordBuffer.upload();
+    m_vertexBytesUploaded += m_instanceRectBuffer.upload();
+    m_vertexBytesUploaded += m_instanceTransformBuffer.upload();
+    m_vertexBytesUploaded += m_instanceColorBuffer.upload();
+    m_vertexBytesUploaded += m_instanceTexRectBuffer.upload();
+    m_vertexBytesUploaded += m_vertexBuffer.upload();
 
-    // setDefaultOpenGLState will leave m_vertexBuffer bound, so we just upload into it..
-    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(vec2), m_vertices, GL_STATIC_DRAW);
+    setDefaultOpenGLState();
 
     m_surfaceSize = targetSurface()->size();
     m_proj = mat4::translate2D(-1.0, 1.0)
@@ -1017,9 +3321,41 @@ inline bool OpenGLRenderer::render()
 
     assert(!m_layered);
     assert(!m_render3d);
+
+    if (m_depthTesting) {
+        glDepthMask(true);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LEQUAL);
+        m_state.setBlending(false);
+        renderOpaque();
+
+        // The rest is blended and only tested against the opaque elements
+        glDepthMask(false);
+        glDepthFunc(GL_LESS);
+        m_state.setBlending(true);
+    }
+
     render(m_elements, m_elements + elementCount);
 
+    if (m_depthTesting) {
+        m_depthTesting = false;
+        glDisable(GL_DEPTH_TEST);
+#ifdef RENGINE_OPENGL_DESKTOP
+        glDepthRange(0, 1);
+#else
+        glDepthRangef(0, 1);
+#endif
+    }
+
+    if (m_scissoring) {
+        m_scissoring = false;
+        glDisable(GL_SCISSOR_TEST);
+    }
+
     activateShader(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    m_gpuTimer.endFrame();
 
     assert(m_fbo == 0);
     m_vertices = 0;
@@ -27,6 +27,13 @@
 
 #include "opengl.h"
 
+#include <cmath>
+#include <iomanip>
+#include <locale>
+#include <sstream>
+#include <string>
+#include <vector>
+
 inline const char *openglrenderer_vsh_solid() { return RENGINE_GLSL(
    attribute highp vec2 aV;
    uniform highp mat4 m;
@@ -42,6 +49,87 @@ inline const char *openglrenderer_fsh_solid() { return RENGINE_GLSL(
     }
 ); }
 
+// Used when drawing a run of rectangles in one go. The color is passed
+// premultiplied per vertex so the batch does not need to touch uniforms.
+inline const char *openglrenderer_vsh_solid_batched() { return RENGINE_GLSL(
+   attribute highp vec2 aV;
+   attribute lowp vec4 aC;
+   uniform highp mat4 m;
+   varying lowp vec4 vC;
+   void main() {
+       gl_Position = m * vec4(aV, 0, 1);
+       vC = aC;
+   }
+); }
+
+inline const char *openglrenderer_fsh_solid_batched() { return RENGINE_GLSL(
+    varying lowp vec4 vC;
+    void main() {
+        gl_FragColor = vC;
+    }
+); }
+
+// Used by the opaque pass. Each vertex carries the depth of its element, so
+// a whole batch can be drawn front-to-back with depth writes.
+inline const char *openglrenderer_vsh_solid_opaque() { return RENGINE_GLSL(
+   attribute highp vec2 aV;
+   attribute lowp vec4 aC;
+   attribute highp float aZ;
+   uniform highp mat4 m;
+   varying lowp vec4 vC;
+   void main() {
+       gl_Position = m * vec4(aV, 0, 1);
+       gl_Position.z = aZ;
+       vC = aC;
+   }
+); }
+
+inline const char *openglrenderer_vsh_texture_opaque() { return RENGINE_GLSL(
+   attribute highp vec2 aV;
+   attribute highp vec2 aT;
+   attribute highp float aZ;
+   uniform highp mat4 m;
+   varying highp vec2 vT;
+   void main() {
+       gl_Position = m * vec4(aV, 0, 1);
+       gl_Position.z = aZ;
+       vT = aT;
+   }
+); }
+
+// Used when rectangles and textures are drawn with instancing. Each quad's
+// geometry, 2D transform and color or texture sub-rect are per-instance
+// attributes, aT is the corner of the quad and the transform happens here.
+inline const char *openglrenderer_vsh_solid_instanced() { return RENGINE_GLSL(
+   attribute highp vec4 aR;
+   attribute highp vec2 aT;
+   attribute highp vec3 aM0;
+   attribute highp vec3 aM1;
+   attribute lowp vec4 aC;
+   uniform highp mat4 m;
+   varying lowp vec4 vC;
+   void main() {
+       highp vec3 p = vec3(aR.xy * (1.0 - aT) + aR.zw * aT, 1.0);
+       gl_Position = m * vec4(dot(aM0, p), dot(aM1, p), 0, 1);
+       vC = aC;
+   }
+); }
+
+inline const char *openglrenderer_vsh_texture_instanced() { return RENGINE_GLSL(
+   attribute highp vec4 aR;
+   attribute highp vec2 aT;
+   attribute highp vec3 aM0;
+   attribute highp vec3 aM1;
+   attribute highp vec4 aS;
+   uniform highp mat4 m;
+   varying highp vec2 vT;
+   void main() {
+       highp vec3 p = vec3(aR.xy * (1.0 - aT) + aR.zw * aT, 1.0);
+       gl_Position = m * vec4(dot(aM0, p), dot(aM1, p), 0, 1);
+       vT = aS.xy * (1.0 - aT) + aS.zw * aT;
+   }
+); }
+
 inline const char *openglrenderer_vsh_texture() { return RENGINE_GLSL(
     attribute highp vec2 aV;
     attribute highp vec2 aT;
@@ -53,6 +141,20 @@ inline const char *openglrenderer_vsh_texture() { return RENGINE_GLSL(
     }
 ); }
 
+// Used for layers, which only cover the top-left 'scale' part of their
+// texture.
+inline const char *openglrenderer_vsh_layer() { return RENGINE_GLSL(
+    attribute highp vec2 aV;
+    attribute highp vec2 aT;
+    uniform highp mat4 m;
+    uniform highp vec2 scale;
+    varying highp vec2 vT;
+    void main() {
+        gl_Position = m * vec4(aV, 0, 1);
+        vT = aT * scale;
+    }
+); }
+
 inline const char *openglrenderer_fsh_texture() { return RENGINE_GLSL(
     uniform lowp sampler2D t;
     varying highp vec2 vT;
@@ -87,77 +189,70 @@ inline const char *openglrenderer_fsh_texture_colorfilter() { return RENGINE_GLS
     }
 ); }
 
-// ### Naive implementation with a lot of room for improvement...
-//
-// Compatibility wise, there are several older and lower-end chips that do not
-// support using a uniform in a loop condition. This is not mandated by the
-// GLSL spec, so it won't work everywhere.
 inline const char *openglrenderer_vsh_blur() { return RENGINE_GLSL(
     attribute highp vec2 aV;
     attribute highp vec2 aT;
     uniform highp mat4 m;
-    uniform int radius;
     uniform highp vec4 dims;
+    uniform highp vec2 scale;
     varying highp vec2 vT;
     void main() {
         gl_Position = m * vec4(aV, 0, 1);
         highp vec2 aw = dims.xy;
         highp vec2 cw = dims.zw;
         highp vec2 diff = (aw - cw) / aw;
-        vT = (aT - diff/2.0) * (aw / cw);
+        vT = (aT - diff/2.0) * (aw / cw) * scale;
     }
 ); }
 
-inline const char *openglrenderer_fsh_blur() { return RENGINE_GLSL(
-    uniform lowp sampler2D t;
-    uniform highp vec4 dims;
-    uniform highp vec2 step;
-    uniform highp float sigma;
-    uniform int radius;
-    varying highp vec2 vT;
-    highp float gauss(float x) { return exp(-(x*x)/sigma); }
-    void main() {
-        highp float r = float(radius);
-        highp float weights = 0.5 * gauss(r);
-        highp vec4 result = weights * texture2D(t, vT - float(radius) * step);
-        for (int i=-radius+1; i<=radius; i+=2) {
-            highp float p1 = float(i);
-            highp float w1 = gauss(p1);
-            highp float p2 = float(i+1);
-            highp float w2 = gauss(p2);
-            highp float w = w1 + w2;
-            highp float p = (p1 * w1 + p2 * w2) / w;
-            result += w * texture2D(t, vT + p * step);
-            weights += w;
-        }
-        gl_FragColor = result / weights;
+// The blur and shadow fragment shaders are generated for each radius. The
+// gaussian weights are computed here and pairs of samples are merged into
+// one linearly filtered texture lookup, so the shader is a fixed sequence of
+// lookups, without loops or exp() per pixel.
+inline std::string openglrenderer_fsh_blur(unsigned radius, bool shadow)
+{
+    float sigma = 0.3f * radius + 0.8f;
+    sigma = sigma * sigma * 2.0f;
+    auto gauss = [sigma](float x) { return std::exp(-(x*x)/sigma); };
+
+    std::vector<float> offsets;
+    std::vector<float> weights;
+    float r = float(radius);
+    offsets.push_back(-r);
+    weights.push_back(0.5f * gauss(r));
+    for (int i=-int(radius)+1; i<=int(radius); i+=2) {
+        float p1 = float(i);
+        float w1 = gauss(p1);
+        float p2 = float(i+1);
+        float w2 = gauss(p2);
+        float w = w1 + w2;
+        offsets.push_back((p1 * w1 + p2 * w2) / w);
+        weights.push_back(w);
     }
-); }
+    float total = 0;
+    for (float w : weights)
+        total += w;
 
-inline const char *openglrenderer_fsh_shadow() { return RENGINE_GLSL(
-    uniform lowp sampler2D t;
-    uniform highp vec4 color;
-    uniform highp vec4 dims;
-    uniform highp vec2 step;
-    uniform highp float sigma;
-    uniform int radius;
-    varying highp vec2 vT;
-    highp float gauss(float x) { return exp(-(x*x)/sigma); }
-    void main() {
-        highp float r = float(radius);
-        highp float weights = 0.5 * gauss(r);
-        highp float result = weights * texture2D(t, vT - float(radius) * step).a;
-        for (int i=-radius+1; i<=radius; i+=2) {
-            highp float p1 = float(i);
-            highp float w1 = gauss(p1);
-            highp float p2 = float(i+1);
-            highp float w2 = gauss(p2);
-            highp float w = w1 + w2;
-            highp float p = (p1 * w1 + p2 * w2) / w;
-            result += w * texture2D(t, vT + p * step).a;
-            weights += w;
-        }
-        gl_FragColor = color * (result / weights);
+    // GLSL wants '.' as the decimal separator, whatever the global locale
+    std::ostringstream s;
+    s.imbue(std::locale::classic());
+    s << std::showpoint << std::setprecision(9)
+      << RENGINE_GLSL() << "\n"
+      << "uniform lowp sampler2D t;\n"
+      << "uniform highp vec2 step;\n"
+      << "varying highp vec2 vT;\n";
+    if (shadow)
+        s << "uniform highp vec4 color;\n";
+    s << "void main() {\n";
+    const char *type = shadow ? "highp float" : "highp vec4";
+    const char *channel = shadow ? ".a" : "";
+    for (unsigned i=0; i<weights.size(); ++i) {
+        s << "    " << (i == 0 ? type : "") << (i == 0 ? " result = " : "result += ")
+          << weights[i] / total << " * texture2D(t, vT + " << offsets[i] << " * step)" << channel << ";\n";
     }
-); }
+    s << (shadow ? "    gl_FragColor = color * result;\n" : "    gl_FragColor = result;\n")
+      << "}\n";
+    return s.str();
+}
+
 
@@ -29,25 +29,41 @@
 #include "common/logging.h"
 
 #include "opengl.h"
+#include "openglprogramcache.h"
 
+#include <chrono>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <cstring>
 #include <cassert>
 
 RENGINE_BEGIN_NAMESPACE
 
+// From GL_KHR_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 class OpenGLShaderProgram
 {
 public:
     OpenGLShaderProgram()
         : m_id(0)
         , m_attributeCount(0)
+        , m_vid(0)
+        , m_fid(0)
+        , m_key(0)
+        , m_cache(0)
+        , m_time(0)
+        , m_linking(false)
     {
     }
 
     ~OpenGLShaderProgram()
     {
+        glDeleteShader(m_vid);
+        glDeleteShader(m_fid);
         glDeleteProgram(m_id);
     }
 
@@ -62,27 +78,98 @@ public:
         return id;
     }
 
-    void initialize(const char *vsh, const char *fsh, const std::vector<const char *> &attrs)
+    /*!
+        Compiles and links the program. With a \a cache, the program is
+        loaded from there if it has been stored before and stored there
+        after it has been linked otherwise.
+     */
+    void initialize(const char *vsh, const char *fsh, const std::vector<const char *> &attrs, OpenGLProgramCache *cache = 0)
+    {
+        startCompile(vsh, fsh, attrs, cache);
+        finishCompile();
+    }
+
+    /*!
+        Hands the program to the driver to compile and link, without waiting
+        for the result. Drivers with GL_KHR_parallel_shader_compile do the
+        work in the background, see isCompileComplete(). finishCompile()
+        must be called before the program is used.
+     */
+    void startCompile(const char *vsh, const char *fsh, const std::vector<const char *> &attrs, OpenGLProgramCache *cache = 0)
     {
         assert(m_id == 0);
 
-        GLuint vid = createShader(vsh, GL_VERTEX_SHADER);
-        GLuint fid = createShader(fsh, GL_FRAGMENT_SHADER);
-        assert(vid);
-        assert(fid);
+        auto start = std::chrono::steady_clock::now();
+        m_attributeCount = attrs.size();
+        m_cache = cache;
+        m_linking = true;
+        if (cache && cache->isActive()) {
+            m_key = cache->keyFor(vsh, fsh, attrs);
+            m_id = glCreateProgram();
+            if (cache->load(m_id, m_key)) {
+                m_linking = false;
+                cache->recordLoad(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                return;
+            }
+            glDeleteProgram(m_id);
+        }
+
+        m_vsh = vsh;
+        m_fsh = fsh;
+        m_vid = createShader(vsh, GL_VERTEX_SHADER);
+        m_fid = createShader(fsh, GL_FRAGMENT_SHADER);
 
         m_id = glCreateProgram();
-        glAttachShader(m_id, vid);
-        glAttachShader(m_id, fid);
+        glAttachShader(m_id, m_vid);
+        glAttachShader(m_id, m_fid);
 
         for (unsigned i=0; i<attrs.size(); ++i)
             glBindAttribLocation(m_id, i, attrs.at(i));
 
+        if (cache)
+            cache->prepare(m_id);
         glLinkProgram(m_id);
 
+        m_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /*!
+        Returns true if startCompile() has been called and the program is
+        not waiting for finishCompile().
+     */
+    bool isCompiled() const { return m_id != 0 && !m_linking; }
+    bool isCompiling() const { return m_linking; }
+
+    /*!
+        Returns true if finishCompile() will not have to wait for the
+        driver. Without \a parallelCompile, that is GL_KHR_parallel_shader_compile,
+        there is no way to tell and this always returns true.
+     */
+    bool isCompileComplete(bool parallelCompile) const
+    {
+        if (!m_linking || !parallelCompile)
+            return true;
+        GLint done = GL_FALSE;
+        glGetProgramiv(m_id, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+
+    /*!
+        Waits for the program started with startCompile() to be linked and
+        checks the result.
+     */
+    void finishCompile()
+    {
+        if (!m_linking)
+            return;
+
+        auto start = std::chrono::steady_clock::now();
+
         int param = 0;
         glGetProgramiv(m_id, GL_LINK_STATUS, &param);
         if (param == GL_FALSE) {
+            checkShader(m_vid, GL_VERTEX_SHADER, m_vsh);
+            checkShader(m_fid, GL_FRAGMENT_SHADER, m_fsh);
             glGetProgramiv(m_id, GL_INFO_LOG_LENGTH, &param);
             char *str = (char *) malloc(param + 1);
             int l = 0;
@@ -90,8 +177,8 @@ public:
             assert(l < param);
             str[l] = '\0';
             loge << "Failed to link shader program:" << std::endl
-                 << "Vertex Shader:" << std::endl << vsh << std::endl
-                 << "FragmentShader:" << std::endl << fsh << std::endl
+                 << "Vertex Shader:" << std::endl << m_vsh << std::endl
+                 << "FragmentShader:" << std::endl << m_fsh << std::endl
                  << "error: " << str << std::endl;
             free(str);
             assert(false);
@@ -99,7 +186,21 @@ public:
 
         assert(glGetError() == GL_NO_ERROR);
 
-        m_attributeCount = attrs.size();
+        m_linking = false;
+        glDetachShader(m_id, m_vid);
+        glDetachShader(m_id, m_fid);
+        glDeleteShader(m_vid);
+        glDeleteShader(m_fid);
+        m_vid = 0;
+        m_fid = 0;
+        m_vsh.clear();
+        m_fsh.clear();
+
+        if (m_cache) {
+            m_cache->store(m_id, m_key);
+            m_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            m_cache->recordCompile(m_time);
+        }
     }
 
     int attributeCount() const { return m_attributeCount; }
@@ -111,6 +212,12 @@ private:
         int len = std::strlen(sh);
         glShaderSource(id, 1, &sh, &len);
         glCompileShader(id);
+        assert(id);
+        return id;
+    }
+
+    void checkShader(GLuint id, GLenum type, const std::string &sh)
+    {
         int param = 0;
         glGetShaderiv(id, GL_COMPILE_STATUS, &param);
         if (param == GL_FALSE) {
@@ -126,11 +233,20 @@ private:
             free(str);
             assert(false);
         }
-        return id;
     }
 
     GLuint m_id;
     int m_attributeCount;
+
+    // Only valid while the program is compiling
+    GLuint m_vid;
+    GLuint m_fid;
+    std::string m_vsh;
+    std::string m_fsh;
+    uint64_t m_key;
+    OpenGLProgramCache *m_cache;
+    double m_time;
+    bool m_linking;
 };
 
 RENGINE_END_NAMESPACE
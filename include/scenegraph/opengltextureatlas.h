@@ -0,0 +1,217 @@
+/*
+    Copyright (c) 2017, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "texture.h"
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Packs small images into larger texture pages, so that textured quads
+    using them can be drawn together in a single batch.
+
+    Each page is filled using a shelf packer. Space is not reclaimed when
+    individual textures are deleted, but once all textures in a page are
+    gone, the page is reset and filled up again from the top.
+ */
+class OpenGLTextureAtlas
+{
+public:
+    struct Page
+    {
+        struct Shelf {
+            int y;
+            int height;
+            int x;
+        };
+
+        ~Page()
+        {
+            glDeleteTextures(1, &id);
+        }
+
+        bool allocate(int w, int h, int *x, int *y);
+        void release()
+        {
+            assert(liveCount > 0);
+            if (--liveCount == 0)
+                shelves.clear();
+        }
+
+        GLuint id = 0;
+        int size = 0;
+        unsigned liveCount = 0;
+        std::vector<Shelf> shelves;
+    };
+
+    OpenGLTextureAtlas(int pageSize = 1024, int maxImageSize = 128)
+        : m_pageSize(pageSize)
+        , m_maxImageSize(maxImageSize)
+    {
+    }
+
+    /*!
+        Creates a texture from \a data inside the atlas. Returns null if
+        the image is too large to be put into the atlas.
+     */
+    Texture *create(vec2 size, Texture::Format format, void *data);
+
+    void setPageSize(int size) { m_pageSize = size; }
+    int pageSize() const { return m_pageSize; }
+
+    int maxImageSize() const { return m_maxImageSize; }
+    unsigned pageCount() const { return m_pages.size(); }
+
+private:
+    std::vector<std::shared_ptr<Page>> m_pages;
+    int m_pageSize;
+    int m_maxImageSize;
+};
+
+class OpenGLAtlasTexture : public Texture
+{
+public:
+    OpenGLAtlasTexture(const std::shared_ptr<OpenGLTextureAtlas::Page> &page, rect2d textureRect, vec2 size, Format format)
+        : m_page(page)
+        , m_textureRect(textureRect)
+        , m_size(size)
+        , m_format(format)
+    {
+    }
+
+    ~OpenGLAtlasTexture()
+    {
+        m_page->release();
+    }
+
+    vec2 size() const override { return m_size; }
+    Format format() const override { return m_format; }
+    GLuint textureId() const override { return m_page->id; }
+    rect2d textureRect() const override { return m_textureRect; }
+
+private:
+    std::shared_ptr<OpenGLTextureAtlas::Page> m_page;
+    rect2d m_textureRect;
+    vec2 m_size;
+    Format m_format;
+};
+
+inline bool OpenGLTextureAtlas::Page::allocate(int w, int h, int *x, int *y)
+{
+    if (w > size || h > size)
+        return false;
+
+    // Best fit among the existing shelves..
+    Shelf *best = 0;
+    for (Shelf &s : shelves) {
+        if (s.height >= h && s.x + w <= size && (!best || s.height < best->height))
+            best = &s;
+    }
+
+    // Open a new shelf if there was no match or the match would waste more
+    // than half of its height, as long as there is room for it.
+    int top = shelves.empty() ? 0 : shelves.back().y + shelves.back().height;
+    if ((!best || best->height > h * 2) && top + h <= size) {
+        shelves.push_back({ top, h, 0 });
+        best = &shelves.back();
+    }
+
+    if (!best)
+        return false;
+
+    *x = best->x;
+    *y = best->y;
+    best->x += w;
+    ++liveCount;
+    return true;
+}
+
+inline Texture *OpenGLTextureAtlas::create(vec2 size, Texture::Format format, void *data)
+{
+    int w = size.x;
+    int h = size.y;
+    if (w <= 0 || h <= 0 || w > m_maxImageSize || h > m_maxImageSize)
+        return 0;
+
+    // Pad by one pixel on all sides, replicating the edges, so linear
+    // filtering doesn't pick up texels from the neighbours.
+    int pw = w + 2;
+    int ph = h + 2;
+
+    std::shared_ptr<Page> page;
+    int x = 0;
+    int y = 0;
+    for (const std::shared_ptr<Page> &p : m_pages) {
+        if (p->allocate(pw, ph, &x, &y)) {
+            page = p;
+            break;
+        }
+    }
+
+    if (!page) {
+        page = std::make_shared<Page>();
+        page->size = m_pageSize;
+        glGenTextures(1, &page->id);
+        glBindTexture(GL_TEXTURE_2D, page->id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, page->size, page->size, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        m_pages.push_back(page);
+        bool ok = page->allocate(pw, ph, &x, &y);
+        assert(ok);
+        (void) ok;
+    }
+
+    const unsigned *src = (const unsigned *) data;
+    std::vector<unsigned> padded(pw * ph);
+    for (int py=0; py<ph; ++py) {
+        const unsigned *line = src + std::min(std::max(py - 1, 0), h - 1) * w;
+        unsigned *dst = padded.data() + py * pw;
+        dst[0] = line[0];
+        memcpy(dst + 1, line, w * sizeof(unsigned));
+        dst[pw - 1] = line[w - 1];
+    }
+
+    glBindTexture(GL_TEXTURE_2D, page->id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, pw, ph, GL_RGBA, GL_UNSIGNED_BYTE, padded.data());
+
+    // The page may be older than the current page size
+    float s = page->size;
+    rect2d textureRect = rect2d::fromXywh((x + 1) / s, (y + 1) / s, w / s, h / s);
+    return new OpenGLAtlasTexture(page, textureRect, size, format);
+}
+
+RENGINE_END_NAMESPACE
@@ -29,6 +29,9 @@
 #include "common/mathtypes.h"
 #include "scenegraph/texture.h"
 
+#include <memory>
+#include <vector>
+
 RENGINE_BEGIN_NAMESPACE
 
 class Node;
@@ -36,6 +39,83 @@ class Surface;
 
 #define RENGINE_RENDERER_ALPHA_THRESHOLD 0.001
 
+/*!
+    Statistics about the last frame a Renderer rendered, see
+    Renderer::frameStats(). Renderers leave what doesn't apply to them at 0.
+ */
+struct FrameStats
+{
+    // The nodes which are drawn, as of the last time the scene was built
+    unsigned rectangleNodes = 0;
+    unsigned textureNodes = 0;
+    unsigned transformNodes = 0;
+    unsigned transformNodesWith3d = 0;
+    unsigned layeredNodes = 0;          // opacity, color filter, blur and shadow nodes which need a layer
+    unsigned renderNodes = 0;
+    unsigned culledNodes = 0;
+    unsigned elements = 0;              // what the nodes were turned into, elements or quads
+
+    bool sceneRebuilt = false;
+    bool surfaceUnchanged = false;      // nothing was repainted, so there is nothing new to present
+    unsigned vertexBytesUploaded = 0;
+    unsigned drawCalls = 0;
+    unsigned shaderSwitches = 0;
+    unsigned layersRendered = 0;
+    unsigned layersCached = 0;          // layers reused from an earlier frame
+    unsigned texturePoolTextures = 0;
+    unsigned texturePoolMemory = 0;     // bytes
+
+    // CPU time in milliseconds. prepassTime and buildTime are 0 when the
+    // scene was not rebuilt.
+    double prepassTime = 0;
+    double buildTime = 0;
+    double renderTime = 0;              // the rest of render()
+};
+
+/*!
+    Pixels read back with Renderer::readPixelsAsync().
+
+    The read completes some time after it was started, typically a frame or
+    two later, at which point isReady() returns true and pixels() holds the
+    pixels in the same layout as Renderer::readPixels() writes them.
+ */
+class PixelReadback
+{
+public:
+    PixelReadback(int x, int y, int width, int height)
+        : m_x(x)
+        , m_y(y)
+        , m_width(width)
+        , m_height(height)
+        , m_pixels(width * height)
+        , m_ready(false)
+    {
+    }
+
+    int x() const { return m_x; }
+    int y() const { return m_y; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    bool isReady() const { return m_ready; }
+    void setReady() { m_ready = true; }
+
+    const std::vector<unsigned> &pixels() const { return m_pixels; }
+
+    /*!
+        Where the renderer writes the pixels, width() * height() of them.
+     */
+    unsigned *bits() { return m_pixels.data(); }
+
+private:
+    int m_x;
+    int m_y;
+    int m_width;
+    int m_height;
+    std::vector<unsigned> m_pixels;
+    bool m_ready;
+};
+
 class Renderer
 {
 public:
@@ -83,6 +163,25 @@ public:
      */
     virtual bool readPixels(int x, int y, int width, int height, unsigned *bytes) = 0;
 
+    /*!
+        Starts reading back pixels without waiting for the frame to finish
+        rendering. The returned readback becomes ready in a later call to
+        frameSwapped(), or in finishReadbacks().
+
+        The default implementation reads the pixels right away.
+     */
+    virtual std::shared_ptr<PixelReadback> readPixelsAsync(int x, int y, int width, int height) {
+        std::shared_ptr<PixelReadback> readback = std::make_shared<PixelReadback>(x, y, width, height);
+        if (readPixels(x, y, width, height, readback->bits()))
+            readback->setReady();
+        return readback;
+    }
+
+    /*!
+        Blocks until all reads started with readPixelsAsync() are ready.
+     */
+    virtual void finishReadbacks() { }
+
     /*!
         Called after the frame has been swapped. The renderer can use this
         to perform post-frame cleanup, for instance...
@@ -92,6 +191,11 @@ public:
     void setFillColor(vec4 c) { m_fillColor = c; }
     vec4 fillColor() const { return m_fillColor; }
 
+    /*!
+        Returns statistics about the last call to render().
+     */
+    const FrameStats &frameStats() const { return m_frameStats; }
+
 #if 0
     Texture *createTextureFromSubtree(Node *node, rect2d sourceRect);
     Texture *createTextureWithBlurFromTexture(Texture *texture, int kernelRadius);
@@ -120,6 +224,9 @@ protected:
     virtual Texture *closeRenderTarget() = 0;
 #endif
 
+protected:
+    FrameStats m_frameStats;
+
 private:
     Node *m_sceneRoot;
     Surface *m_surface;
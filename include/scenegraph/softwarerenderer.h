@@ -0,0 +1,1115 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "renderer.h"
+
+#include "common/logging.h"
+
+#include "softwaretexture.h"
+#include "node.h"
+
+#include "windowsystem/surface.h"
+
+#include "util/workqueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+// The height of the bands of rows which the render threads share out
+#define RENGINE_SOFTWARE_RENDERER_BAND_HEIGHT 16
+
+/*!
+    Scales all four channels of the premultiplied pixel \a p by \a a / 255,
+    rounded to nearest, two channels at a time.
+ */
+inline unsigned rengine_scalePixel(unsigned p, unsigned a)
+{
+    unsigned rb = (p & 0x00ff00ff) * a + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    unsigned ag = ((p >> 8) & 0x00ff00ff) * a + 0x00800080;
+    ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+    return rb | ag;
+}
+
+/*!
+    Blends the premultiplied pixel \a src on top of \a dst, the same as
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA).
+ */
+inline unsigned rengine_blendPixel(unsigned src, unsigned dst)
+{
+    return src + rengine_scalePixel(dst, 255 - (src >> 24));
+}
+
+/*!
+    Interpolates between \a a and \a b, with \a f going from 0 to 256.
+ */
+inline unsigned rengine_interpolatePixel(unsigned a, unsigned b, unsigned f)
+{
+    unsigned rb = ((a & 0x00ff00ff) * (256 - f) + (b & 0x00ff00ff) * f) >> 8;
+    unsigned ag = ((a >> 8) & 0x00ff00ff) * (256 - f) + ((b >> 8) & 0x00ff00ff) * f;
+    return (rb & 0x00ff00ff) | (ag & 0xff00ff00);
+}
+
+#if defined(RENGINE_MATH_SSE2)
+// x / 255 for eight 16-bit products, rounded like rengine_scalePixel()
+inline __m128i rengine_div255_sse2(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+#elif defined(RENGINE_MATH_NEON)
+inline uint8x8_t rengine_div255_neon(uint16x8_t x)
+{
+    return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+}
+#endif
+
+/*!
+    Blends the premultiplied \a color on top of \a count pixels at \a dst.
+ */
+inline void rengine_fillSpan(unsigned *dst, int count, unsigned color)
+{
+    unsigned alpha = color >> 24;
+    if (alpha == 255) {
+        std::fill(dst, dst + count, color);
+        return;
+    }
+    if (color == 0)
+        return;
+
+    int i = 0;
+#if defined(RENGINE_MATH_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ia = _mm_set1_epi16(255 - alpha);
+    const __m128i c = _mm_set1_epi32(color);
+    for (; i + 4 <= count; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i lo = rengine_div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia));
+        __m128i hi = rengine_div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_add_epi8(_mm_packus_epi16(lo, hi), c));
+    }
+#elif defined(RENGINE_MATH_NEON)
+    const uint8x8_t ia = vdup_n_u8(255 - alpha);
+    uint8x8_t c[4];
+    for (int j=0; j<4; ++j)
+        c[j] = vdup_n_u8((color >> (8 * j)) & 0xff);
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t d = vld4_u8((const uint8_t *) (dst + i));
+        for (int j=0; j<4; ++j)
+            d.val[j] = vadd_u8(c[j], rengine_div255_neon(vmull_u8(d.val[j], ia)));
+        vst4_u8((uint8_t *) (dst + i), d);
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = rengine_blendPixel(color, dst[i]);
+}
+
+/*!
+    Blends \a count premultiplied pixels from \a src on top of \a dst, with
+    the source scaled by \a opacity, going from 0 to 255.
+ */
+inline void rengine_blendSpan(unsigned *dst, const unsigned *src, int count, unsigned opacity = 255)
+{
+    int i = 0;
+#if defined(RENGINE_MATH_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i op = _mm_set1_epi16(opacity);
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i slo = _mm_unpacklo_epi8(s, zero);
+        __m128i shi = _mm_unpackhi_epi8(s, zero);
+        if (opacity < 255) {
+            slo = rengine_div255_sse2(_mm_mullo_epi16(slo, op));
+            shi = rengine_div255_sse2(_mm_mullo_epi16(shi, op));
+        }
+        // Broadcast the alpha of each pixel into all four of its channels
+        __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xff), 0xff);
+        __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xff), 0xff);
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i dlo = rengine_div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, alo)));
+        __m128i dhi = rengine_div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, ahi)));
+        _mm_storeu_si128((__m128i *) (dst + i),
+                         _mm_packus_epi16(_mm_add_epi16(slo, dlo), _mm_add_epi16(shi, dhi)));
+    }
+#elif defined(RENGINE_MATH_NEON)
+    const uint8x8_t op = vdup_n_u8(opacity);
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t *) (src + i));
+        if (opacity < 255) {
+            for (int j=0; j<4; ++j)
+                s.val[j] = rengine_div255_neon(vmull_u8(s.val[j], op));
+        }
+        uint8x8_t ia = vmvn_u8(s.val[3]);
+        uint8x8x4_t d = vld4_u8((const uint8_t *) (dst + i));
+        for (int j=0; j<4; ++j)
+            d.val[j] = vadd_u8(s.val[j], rengine_div255_neon(vmull_u8(d.val[j], ia)));
+        vst4_u8((uint8_t *) (dst + i), d);
+    }
+#endif
+    for (; i < count; ++i) {
+        unsigned s = opacity < 255 ? rengine_scalePixel(src[i], opacity) : src[i];
+        dst[i] = rengine_blendPixel(s, dst[i]);
+    }
+}
+
+/*!
+    The SoftwareRenderer draws the scene graph into memory on the CPU, so
+    it works without a GPU and gives a baseline to measure the OpenGL
+    renderer against.
+
+    It draws rectangles and textures, opacity, color filter, blur and
+    shadow layers and both 2D transforms and 3D projections. RenderNodes
+    need OpenGL and are skipped. Textures must be created with
+    createTextureFromImageData() and are sampled bilinearly with their
+    edges clamped.
+
+    Rendering happens in two phases. The scene is first walked on the
+    calling thread and turned into a list of quads in surface coordinates
+    for the surface and for each layer. The quads are then rasterized with
+    the surface split into bands of RENGINE_SOFTWARE_RENDERER_BAND_HEIGHT
+    rows, which are shared out between the calling thread and
+    renderThreadCount() worker threads, and the layer filters are run
+    the same way.
+
+    The frame is kept as premultiplied 32-bit RGBA, with red in the lowest
+    byte, in pixels(), with the top row first.
+ */
+class SoftwareRenderer : public Renderer
+{
+public:
+    // A block of premultiplied pixels, positioned in surface coordinates
+    struct Image {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned> pixels;
+
+        void resize(int x, int y, int w, int h);
+        unsigned *scanLine(int row) { return pixels.data() + (row - y) * width - x; }
+        const unsigned *scanLine(int row) const { return pixels.data() + (row - y) * width - x; }
+    };
+
+    struct Quad {
+        enum Type : unsigned char {
+            Solid,
+            Textured,
+            Composite
+        };
+
+        enum Mapping : unsigned char {
+            AxisAligned,
+            Affine,
+            Projective
+        };
+
+        Type type = Solid;
+        Mapping mapping = AxisAligned;
+        int x0 = 0;                 // The pixels the quad can cover, [x0, x1) x [y0, y1)
+        int y0 = 0;
+        int x1 = 0;
+        int y1 = 0;
+        float inverse[9];           // Maps pixel centers onto the unit square of the quad
+        float z = 0;                // For depth sorting inside 3D projections
+        unsigned color = 0;         // Premultiplied, for solid quads
+        unsigned opacity = 255;     // For composited layers
+        const SoftwareTexture *texture = 0;
+        rect2d textureRect;
+        const Image *image = 0;     // For composited layers
+    };
+
+    struct Layer {
+        Node *node = 0;
+        std::vector<Quad> quads;
+        rect2d clip;                // The part of the surface the content matters for
+        rect2d bounds;              // The pixels the quads cover
+        Image image;
+        Image shadow;
+        std::vector<unsigned> scratch;
+    };
+
+    SoftwareRenderer();
+
+    Texture *createTextureFromImageData(vec2 size, Texture::Format format, void *data) override;
+    void initialize() override { }
+    bool render() override;
+    bool readPixels(int x, int y, int width, int height, unsigned *bytes) override;
+
+    /*!
+        The size of the frame, when there is no target surface. With a target
+        surface, the frame is as large as the surface.
+     */
+    void setSize(vec2 size) { m_size = size; }
+
+    /*!
+        Sets the number of worker threads which render together with the
+        calling thread. Defaults to one less than the number of hardware
+        threads.
+     */
+    void setRenderThreadCount(unsigned count) { m_renderThreadCount = count; }
+    unsigned renderThreadCount() const { return m_renderThreadCount; }
+
+    const unsigned *pixels() const { return m_surface.image.pixels.data(); }
+    int width() const { return m_surface.image.width; }
+    int height() const { return m_surface.image.height; }
+
+    /*!
+        The number of quads and layers drawn in the last frame.
+     */
+    unsigned quadCount() const { return m_quadCount; }
+    unsigned layerCount() const { return m_layerOrder.size(); }
+
+    static bool setupQuad(Quad *q, const vec2 *v, bool projected);
+    static unsigned sample(const SoftwareTexture *texture, int fx, int fy);
+    static void drawQuad(const Quad &q, Image *target, int y0, int y1);
+    static std::vector<unsigned> blurWeights(unsigned radius);
+
+    void collect(Node *n, Layer *target);
+    void collectChildren(Node *n, Layer *target);
+    void addQuad(Layer *target, const Quad &q);
+    void finishLayer(Layer *layer, Layer *target);
+    void renderLayer(Layer *layer);
+    void rasterize(const std::vector<Quad> &quads, Image *target);
+    void colorFilter(Image *image, const mat4 &matrix);
+    void blur(Image *image, std::vector<unsigned> *scratch, unsigned radius);
+    void shadow(const Image &source, Image *shadow, std::vector<unsigned> *scratch, unsigned radius, vec4 color);
+    void parallelFor(int rows, const std::function<void(int, int)> &work);
+
+    struct Band : public WorkQueue::Job {
+        void onExecute() override;
+        const std::function<void(int, int)> *work = 0;
+        int first = 0;
+        int step = 0;
+        int rows = 0;
+    };
+
+    vec2 m_size;
+    Layer m_surface;
+    std::vector<std::unique_ptr<Layer>> m_layers;
+    std::vector<Layer *> m_layerOrder;          // Layers in the order they are rendered, children first
+    unsigned m_layerCount;
+    unsigned m_quadCount;
+
+    mat4 m_m2d;
+    mat4 m_m3d;
+    float m_farPlane;
+    bool m_render3d;
+    bool m_warnedRenderNodes;
+
+    unsigned m_renderThreadCount;
+    std::vector<std::unique_ptr<WorkQueue>> m_renderQueues;    // one per render thread, created on demand
+    std::vector<std::shared_ptr<Band>> m_bands;
+};
+
+inline void SoftwareRenderer::Image::resize(int left, int top, int w, int h)
+{
+    x = left;
+    y = top;
+    width = w;
+    height = h;
+    pixels.assign(w * h, 0);
+}
+
+inline SoftwareRenderer::SoftwareRenderer()
+    : m_layerCount(0)
+    , m_quadCount(0)
+    , m_farPlane(0)
+    , m_render3d(false)
+    , m_warnedRenderNodes(false)
+    , m_renderThreadCount(std::max(std::thread::hardware_concurrency(), 1u) - 1)
+{
+    initialize();
+}
+
+inline Texture *SoftwareRenderer::createTextureFromImageData(vec2 size, Texture::Format format, void *data)
+{
+    return new SoftwareTexture(size, format, data);
+}
+
+inline bool SoftwareRenderer::render()
+{
+    if (!sceneRoot()) {
+        logw << " - no 'sceneRoot', surely this is not what you intended?" << std::endl;
+        return false;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    m_frameStats = FrameStats();
+    m_frameStats.sceneRebuilt = true;
+
+    vec2 size = targetSurface() ? targetSurface()->size() : m_size;
+    int w = std::max(0, int(size.x));
+    int h = std::max(0, int(size.y));
+
+    m_layerCount = 0;
+    m_quadCount = 0;
+    m_layerOrder.clear();
+    m_surface.quads.clear();
+    m_surface.clip = rect2d(0, 0, w, h);
+    m_m2d = mat4();
+    m_m3d = mat4();
+
+    collect(sceneRoot(), &m_surface);
+    m_frameStats.buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (Layer *layer : m_layerOrder)
+        renderLayer(layer);
+
+    // glClearColor() takes the fill color as it is
+    vec4 c = fillColor() * 255.0f + 0.5f;
+    unsigned clearColor = (unsigned(c.w) << 24) | (unsigned(c.z) << 16) | (unsigned(c.y) << 8) | unsigned(c.x);
+    Image *frame = &m_surface.image;
+    if (frame->width != w || frame->height != h)
+        frame->resize(0, 0, w, h);
+    parallelFor(h, [frame, clearColor](int y0, int y1) {
+        std::fill(frame->scanLine(y0), frame->scanLine(y1), clearColor);
+    });
+    rasterize(m_surface.quads, frame);
+
+    m_frameStats.elements = m_quadCount;
+    m_frameStats.layersRendered = m_layerOrder.size();
+    m_frameStats.renderTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                              - m_frameStats.buildTime;
+    return true;
+}
+
+/*!
+    Reads back pixels the way glReadPixels() does, with \a y counted from
+    the bottom of the frame, so the rows come out bottom-up in OpenGL terms
+    and top-down in the frame.
+ */
+inline bool SoftwareRenderer::readPixels(int x, int y, int width, int height, unsigned *bytes)
+{
+    const Image &frame = m_surface.image;
+    if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > frame.width || y + height > frame.height)
+        return false;
+    int top = frame.height - y - height;
+    for (int row=0; row<height; ++row)
+        std::copy(frame.scanLine(top + row) + x, frame.scanLine(top + row) + x + width, bytes + row * width);
+    return true;
+}
+
+inline void SoftwareRenderer::collectChildren(Node *n, Layer *target)
+{
+    for (Node *c = n->child(); c; c = c->sibling())
+        collect(c, target);
+}
+
+inline void SoftwareRenderer::collect(Node *n, Layer *target)
+{
+    n->preprocess();
+
+    switch (n->type()) {
+    case Node::TextureNodeType:
+    case Node::RectangleNodeType: {
+        rect2d geometry = static_cast<RectangleNodeBase *>(n)->geometry();
+        if (geometry.width() == 0 || geometry.height() == 0)
+            break;
+
+        Quad q;
+        if (n->type() == Node::RectangleNodeType) {
+            vec4 c = static_cast<RectangleNode *>(n)->color();
+            if (c.w < RENGINE_RENDERER_ALPHA_THRESHOLD)
+                break;
+            q.type = Quad::Solid;
+            vec4 pc = vec4(c.x * c.w, c.y * c.w, c.z * c.w, c.w) * 255.0f + 0.5f;
+            q.color = (unsigned(pc.w) << 24) | (unsigned(pc.z) << 16) | (unsigned(pc.y) << 8) | unsigned(pc.x);
+        } else {
+            TextureNode *tn = static_cast<TextureNode *>(n);
+            if (!tn->texture())
+                break;
+            q.type = Quad::Textured;
+            q.texture = dynamic_cast<const SoftwareTexture *>(tn->texture());
+            q.textureRect = tn->textureRect();
+            if (!q.texture) {
+                logw << " - texture was not created by the software renderer" << std::endl;
+                break;
+            }
+        }
+
+        if (n->type() == Node::RectangleNodeType)
+            ++m_frameStats.rectangleNodes;
+        else
+            ++m_frameStats.textureNodes;
+
+        vec2 v[4];
+        if (m_render3d) {
+            q.z = (m_m3d * vec3(geometry.center())).z;
+            projectQuad(m_m3d, m_farPlane, m_m2d, geometry, v);
+        } else {
+            transformQuad2D(m_m2d, geometry, v);
+        }
+        if (setupQuad(&q, v, m_render3d))
+            addQuad(target, q);
+    } break;
+
+    case Node::TransformNodeType: {
+        TransformNode *tn = static_cast<TransformNode *>(n);
+        bool projection = tn->projectionDepth() && !m_render3d;
+        unsigned first = target->quads.size();
+        ++m_frameStats.transformNodes;
+        if (tn->projectionDepth() > 0)
+            ++m_frameStats.transformNodesWith3d;
+        if (projection) {
+            m_render3d = true;
+            m_farPlane = tn->projectionDepth();
+        }
+
+        mat4 *m = m_render3d ? &m_m3d : &m_m2d;
+        mat4 old = *m;
+        *m = *m * tn->matrix();
+        collectChildren(n, target);
+        *m = old;
+
+        if (projection) {
+            m_render3d = false;
+            m_farPlane = 0;
+            std::stable_sort(target->quads.begin() + first, target->quads.end(), [] (const Quad &a, const Quad &b) {
+                return a.z < b.z;
+            });
+        }
+    } return;
+
+    case Node::OpacityNodeType:
+    case Node::ColorFilterNodeType:
+    case Node::BlurNodeType:
+    case Node::ShadowNodeType: {
+        bool layered =
+            (n->type() == Node::OpacityNodeType && static_cast<OpacityNode *>(n)->opacity() < 1.0f)
+            || (n->type() == Node::ColorFilterNodeType && !static_cast<ColorFilterNode *>(n)->colorMatrix().isIdentity())
+            || (n->type() == Node::BlurNodeType && static_cast<BlurNode *>(n)->radius() > 0)
+            || (n->type() == Node::ShadowNodeType && static_cast<ShadowNode *>(n)->color().w > 0);
+        if (!layered)
+            break;
+        ++m_frameStats.layeredNodes;
+        if (n->type() == Node::OpacityNodeType && static_cast<OpacityNode *>(n)->opacity() < RENGINE_RENDERER_ALPHA_THRESHOLD)
+            return;
+
+        if (m_layerCount == m_layers.size())
+            m_layers.push_back(std::unique_ptr<Layer>(new Layer()));
+        Layer *layer = m_layers[m_layerCount++].get();
+        layer->node = n;
+        layer->quads.clear();
+
+        // Blurs and shadows pull in content from outside the area they cover
+        float margin = 0;
+        if (n->type() == Node::BlurNodeType) {
+            margin = static_cast<BlurNode *>(n)->radius();
+        } else if (n->type() == Node::ShadowNodeType) {
+            ShadowNode *shadow = static_cast<ShadowNode *>(n);
+            vec2 offset = shadow->offset();
+            margin = shadow->radius() + std::ceil(std::max(std::abs(offset.x), std::abs(offset.y)));
+        }
+        layer->clip = rect2d(target->clip.tl - margin, target->clip.br + margin);
+        const float inf = std::numeric_limits<float>::infinity();
+        layer->bounds = rect2d(inf, inf, -inf, -inf);
+
+        collectChildren(n, layer);
+        finishLayer(layer, target);
+    } return;
+
+    case Node::RenderNodeType:
+        if (!m_warnedRenderNodes) {
+            logw << " - RenderNodes need OpenGL and are not drawn" << std::endl;
+            m_warnedRenderNodes = true;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    collectChildren(n, target);
+}
+
+/*!
+    Fills in the pixel bounds and the inverse mapping of \a q from its corners
+    \a v, which are top-left, bottom-left, top-right and bottom-right. Returns
+    false if the quad covers no area.
+ */
+inline bool SoftwareRenderer::setupQuad(Quad *q, const vec2 *v, bool projected)
+{
+    // The mapping from the unit square to the quad, with (0, 0) at v[0],
+    // (1, 0) at v[2] and (0, 1) at v[1]. See Heckbert, "Fundamentals of
+    // Texture Mapping and Image Warping".
+    float dx3 = v[0].x - v[2].x + v[3].x - v[1].x;
+    float dy3 = v[0].y - v[2].y + v[3].y - v[1].y;
+    float a, b, c, d, e, f, g, h;
+    if (!projected || (std::abs(dx3) < 0.0001f && std::abs(dy3) < 0.0001f)) {
+        a = v[2].x - v[0].x; b = v[1].x - v[0].x; c = v[0].x;
+        d = v[2].y - v[0].y; e = v[1].y - v[0].y; f = v[0].y;
+        g = 0; h = 0;
+        bool aligned = b == 0 && d == 0;
+        q->mapping = aligned ? Quad::AxisAligned : Quad::Affine;
+    } else {
+        float dx1 = v[2].x - v[3].x, dx2 = v[1].x - v[3].x;
+        float dy1 = v[2].y - v[3].y, dy2 = v[1].y - v[3].y;
+        float den = dx1 * dy2 - dx2 * dy1;
+        if (den == 0)
+            return false;
+        g = (dx3 * dy2 - dx2 * dy3) / den;
+        h = (dx1 * dy3 - dx3 * dy1) / den;
+        a = v[2].x - v[0].x + g * v[2].x; b = v[1].x - v[0].x + h * v[1].x; c = v[0].x;
+        d = v[2].y - v[0].y + g * v[2].y; e = v[1].y - v[0].y + h * v[1].y; f = v[0].y;
+        q->mapping = Quad::Projective;
+    }
+
+    // The inverse is the adjugate, scaled so that it is exact for the affine cases
+    float *m = q->inverse;
+    m[0] = e - f * h;   m[1] = c * h - b;   m[2] = b * f - c * e;
+    m[3] = f * g - d;   m[4] = a - c * g;   m[5] = c * d - a * f;
+    m[6] = d * h - e * g; m[7] = b * g - a * h; m[8] = a * e - b * d;
+    float det = m[8];
+    if (q->mapping != Quad::Projective) {
+        if (det == 0)
+            return false;
+        for (int i=0; i<9; ++i)
+            m[i] /= det;
+    } else if (a * m[0] + b * m[3] + c * m[6] == 0) {
+        return false;
+    }
+
+    rect2d bounds = rect2d(v[0], v[0]) | v[1] | v[2] | v[3];
+    if (q->mapping == Quad::AxisAligned) {
+        // A pixel is inside if its center is, as with OpenGL
+        q->x0 = int(std::ceil(bounds.tl.x - 0.5f));
+        q->y0 = int(std::ceil(bounds.tl.y - 0.5f));
+        q->x1 = int(std::ceil(bounds.br.x - 0.5f));
+        q->y1 = int(std::ceil(bounds.br.y - 0.5f));
+    } else {
+        q->x0 = int(std::floor(bounds.tl.x));
+        q->y0 = int(std::floor(bounds.tl.y));
+        q->x1 = int(std::ceil(bounds.br.x));
+        q->y1 = int(std::ceil(bounds.br.y));
+    }
+    return q->x0 < q->x1 && q->y0 < q->y1;
+}
+
+inline void SoftwareRenderer::addQuad(Layer *target, const Quad &q)
+{
+    rect2d bounds(q.x0, q.y0, q.x1, q.y1);
+    if (!bounds.intersects(target->clip))
+        return;
+    target->bounds |= bounds;
+    target->quads.push_back(q);
+}
+
+/*!
+    Positions the image of \a layer now that all of its content is known and
+    adds the quads which composite it into \a target.
+ */
+inline void SoftwareRenderer::finishLayer(Layer *layer, Layer *target)
+{
+    if (layer->quads.empty())
+        return;
+
+    Node *n = layer->node;
+    float radius = 0;
+    if (n->type() == Node::BlurNodeType)
+        radius = static_cast<BlurNode *>(n)->radius();
+    else if (n->type() == Node::ShadowNodeType)
+        radius = static_cast<ShadowNode *>(n)->radius();
+
+    rect2d box = rect2d(layer->bounds.tl - radius, layer->bounds.br + radius) & layer->clip.aligned();
+    if (box.width() <= 0 || box.height() <= 0)
+        return;
+    Image *image = &layer->image;
+    image->x = box.tl.x;
+    image->y = box.tl.y;
+    image->width = box.width();
+    image->height = box.height();
+    m_layerOrder.push_back(layer);
+
+    Quad q;
+    q.type = Quad::Composite;
+    q.x0 = image->x;
+    q.y0 = image->y;
+    q.x1 = image->x + image->width;
+    q.y1 = image->y + image->height;
+
+    if (n->type() == Node::ShadowNodeType) {
+        vec2 offset = static_cast<ShadowNode *>(n)->offset();
+        Image *shadow = &layer->shadow;
+        shadow->x = image->x + int(std::round(offset.x));
+        shadow->y = image->y + int(std::round(offset.y));
+        shadow->width = image->width;
+        shadow->height = image->height;
+        Quad sq = q;
+        sq.image = shadow;
+        sq.x0 = shadow->x;
+        sq.y0 = shadow->y;
+        sq.x1 = shadow->x + shadow->width;
+        sq.y1 = shadow->y + shadow->height;
+        addQuad(target, sq);
+    }
+
+    if (n->type() == Node::OpacityNodeType)
+        q.opacity = unsigned(static_cast<OpacityNode *>(n)->opacity() * 255.0f + 0.5f);
+    q.image = image;
+    addQuad(target, q);
+}
+
+inline void SoftwareRenderer::renderLayer(Layer *layer)
+{
+    Image *image = &layer->image;
+    image->pixels.assign(image->width * image->height, 0);
+    rasterize(layer->quads, image);
+
+    Node *n = layer->node;
+    switch (n->type()) {
+    case Node::ColorFilterNodeType:
+        colorFilter(image, static_cast<ColorFilterNode *>(n)->colorMatrix());
+        break;
+    case Node::BlurNodeType:
+        blur(image, &layer->scratch, static_cast<BlurNode *>(n)->radius());
+        break;
+    case Node::ShadowNodeType: {
+        ShadowNode *sn = static_cast<ShadowNode *>(n);
+        shadow(*image, &layer->shadow, &layer->scratch, sn->radius(), sn->color());
+    }   break;
+    default:
+        break;
+    }
+}
+
+inline void SoftwareRenderer::rasterize(const std::vector<Quad> &quads, Image *target)
+{
+    m_quadCount += quads.size();
+    parallelFor(target->height, [&quads, target](int y0, int y1) {
+        for (const Quad &q : quads)
+            drawQuad(q, target, target->y + y0, target->y + y1);
+    });
+}
+
+/*!
+    Returns the bilinearly filtered texel at \a fx, \a fy, which are in
+    16.16 fixed point texels with 0 at the center of the first texel, with
+    the edges clamped.
+ */
+inline unsigned SoftwareRenderer::sample(const SoftwareTexture *texture, int fx, int fy)
+{
+    int w = texture->pixelWidth();
+    int h = texture->pixelHeight();
+    int x = fx >> 16;
+    int y = fy >> 16;
+    unsigned ax = (fx >> 8) & 0xff;
+    unsigned ay = (fy >> 8) & 0xff;
+    int x0 = std::min(std::max(x, 0), w - 1);
+    int x1 = std::min(std::max(x + 1, 0), w - 1);
+    int y0 = std::min(std::max(y, 0), h - 1);
+    int y1 = std::min(std::max(y + 1, 0), h - 1);
+    const unsigned *top = texture->pixels() + y0 * w;
+    const unsigned *bottom = texture->pixels() + y1 * w;
+    return rengine_interpolatePixel(rengine_interpolatePixel(top[x0], top[x1], ax),
+                                    rengine_interpolatePixel(bottom[x0], bottom[x1], ax),
+                                    ay);
+}
+
+/*!
+    Draws the rows of \a q which fall in [y0, y1) into \a target.
+ */
+inline void SoftwareRenderer::drawQuad(const Quad &q, Image *target, int y0, int y1)
+{
+    int top = std::max(q.y0, y0);
+    int bottom = std::min(q.y1, y1);
+    int left = std::max(q.x0, target->x);
+    int right = std::min(q.x1, target->x + target->width);
+    if (top >= bottom || left >= right)
+        return;
+
+    if (q.type == Quad::Composite) {
+        for (int y=top; y<bottom; ++y)
+            rengine_blendSpan(target->scanLine(y) + left, q.image->scanLine(y) + left, right - left, q.opacity);
+        return;
+    }
+
+    const float *m = q.inverse;
+    const int w = q.texture ? q.texture->pixelWidth() : 0;
+    const int h = q.texture ? q.texture->pixelHeight() : 0;
+    const float sx = q.textureRect.width();
+    const float sy = q.textureRect.height();
+
+    // Texels which land exactly on pixels are copied rather than filtered
+    bool copy = false;
+    if (q.type == Quad::Textured && q.mapping == Quad::AxisAligned) {
+        float tx = (q.textureRect.tl.x + (m[0] * (left + 0.5f) + m[2]) * sx) * w - 0.5f;
+        float ty = (q.textureRect.tl.y + (m[4] * (top + 0.5f) + m[5]) * sy) * h - 0.5f;
+        copy = std::abs(m[0] * sx * w - 1.0f) < 0.0001f
+               && std::abs(m[4] * sy * h - 1.0f) < 0.0001f
+               && std::abs(tx - std::round(tx)) < 0.001f
+               && std::abs(ty - std::round(ty)) < 0.001f
+               && std::round(tx) >= 0 && std::round(tx) + (right - left) <= w;
+    }
+
+    const int chunk = 64;
+    unsigned buffer[chunk];
+
+    for (int y=top; y<bottom; ++y) {
+        unsigned *line = target->scanLine(y);
+        float py = y + 0.5f;
+        int xs = left;
+        int xe = right;
+
+        if (q.mapping == Quad::Affine) {
+            // Solve 0 <= u < 1 and 0 <= v < 1 for x along this row
+            for (int i=0; i<2; ++i) {
+                float dx = m[3 * i];
+                float u0 = dx * 0.5f + m[3 * i + 1] * py + m[3 * i + 2];
+                if (dx > 0) {
+                    xs = std::max(xs, int(std::ceil(-u0 / dx)));
+                    xe = std::min(xe, int(std::ceil((1.0f - u0) / dx)));
+                } else if (dx < 0) {
+                    xs = std::max(xs, int(std::floor((1.0f - u0) / dx)) + 1);
+                    xe = std::min(xe, int(std::floor(-u0 / dx)) + 1);
+                } else if (u0 < 0 || u0 >= 1) {
+                    xe = xs;
+                }
+            }
+        }
+        if (xs >= xe)
+            continue;
+
+        if (q.type == Quad::Solid && q.mapping != Quad::Projective) {
+            rengine_fillSpan(line + xs, xe - xs, q.color);
+            continue;
+        }
+
+        if (copy) {
+            float tx = (q.textureRect.tl.x + (m[0] * (xs + 0.5f) + m[2]) * sx) * w - 0.5f;
+            float ty = (q.textureRect.tl.y + (m[4] * py + m[5]) * sy) * h - 0.5f;
+            int row = std::min(std::max(int(std::round(ty)), 0), h - 1);
+            rengine_blendSpan(line + xs, q.texture->pixels() + row * w + int(std::round(tx)), xe - xs);
+            continue;
+        }
+
+        // Textures are stepped through in 16.16 fixed point. The texels are
+        // gathered into a buffer which is then blended as a span.
+        auto texel = [&q, sx, sy, w, h](float u, float v, int *fx, int *fy) {
+            *fx = int(((q.textureRect.tl.x + u * sx) * w - 0.5f) * 65536.0f);
+            *fy = int(((q.textureRect.tl.y + v * sy) * h - 0.5f) * 65536.0f);
+        };
+        if (q.mapping != Quad::Projective) {
+            int fx, fy;
+            texel(m[0] * (xs + 0.5f) + m[1] * py + m[2], m[3] * (xs + 0.5f) + m[4] * py + m[5], &fx, &fy);
+            int dfx = int(m[0] * sx * w * 65536.0f);
+            int dfy = int(m[3] * sy * h * 65536.0f);
+            for (int x0=xs; x0<xe; x0 += chunk) {
+                int count = std::min(chunk, xe - x0);
+                for (int i=0; i<count; ++i, fx += dfx, fy += dfy)
+                    buffer[i] = sample(q.texture, fx, fy);
+                rengine_blendSpan(line + x0, buffer, count);
+            }
+            continue;
+        }
+
+        // Projected quads are tested a pixel at a time, and the pixels
+        // outside the quad are left transparent.
+        for (int x0=xs; x0<xe; x0 += chunk) {
+            int count = std::min(chunk, xe - x0);
+            for (int i=0; i<count; ++i) {
+                float px = x0 + i + 0.5f;
+                float W = m[6] * px + m[7] * py + m[8];
+                float u = (m[0] * px + m[1] * py + m[2]) / W;
+                float v = (m[3] * px + m[4] * py + m[5]) / W;
+                if (!(u >= 0 && u < 1 && v >= 0 && v < 1)) {
+                    buffer[i] = 0;
+                } else if (q.type == Quad::Solid) {
+                    buffer[i] = q.color;
+                } else {
+                    int fx, fy;
+                    texel(u, v, &fx, &fy);
+                    buffer[i] = sample(q.texture, fx, fy);
+                }
+            }
+            rengine_blendSpan(line + x0, buffer, count);
+        }
+    }
+}
+
+inline void SoftwareRenderer::colorFilter(Image *image, const mat4 &matrix)
+{
+    parallelFor(image->height, [image, &matrix](int y0, int y1) {
+        for (unsigned *p = image->pixels.data() + y0 * image->width; p < image->pixels.data() + y1 * image->width; ++p) {
+            unsigned s = *p;
+            if (s == 0)
+                continue;
+            vec4 c = matrix * vec4(s & 0xff, (s >> 8) & 0xff, (s >> 16) & 0xff, s >> 24);
+            unsigned a = unsigned(std::min(std::max(c.w, 0.0f), 255.0f) + 0.5f);
+            unsigned r = unsigned(std::min(std::max(c.x, 0.0f), 255.0f) + 0.5f);
+            unsigned g = unsigned(std::min(std::max(c.y, 0.0f), 255.0f) + 0.5f);
+            unsigned b = unsigned(std::min(std::max(c.z, 0.0f), 255.0f) + 0.5f);
+            *p = (a << 24) | (b << 16) | (g << 8) | r;
+        }
+    });
+}
+
+/*!
+    Returns the 2 * \a radius + 1 weights of the gaussian kernel for
+    \a radius, with the same sigma as the OpenGL renderer's blur, in 16.16
+    fixed point.
+ */
+inline std::vector<unsigned> SoftwareRenderer::blurWeights(unsigned radius)
+{
+    float sigma = 0.3f * radius + 0.8f;
+    std::vector<float> kernel(2 * radius + 1);
+    float sum = 0;
+    for (int i=0; i<int(kernel.size()); ++i) {
+        float x = i - float(radius);
+        kernel[i] = std::exp(-x * x / (2.0f * sigma * sigma));
+        sum += kernel[i];
+    }
+    std::vector<unsigned> weights(kernel.size());
+    for (unsigned i=0; i<kernel.size(); ++i)
+        weights[i] = unsigned(kernel[i] / sum * 65536.0f + 0.5f);
+    return weights;
+}
+
+inline void SoftwareRenderer::blur(Image *image, std::vector<unsigned> *scratch, unsigned radius)
+{
+    // The weights are below 32768 for all radii, so they fit in the 16-bit
+    // multiplies below.
+    std::vector<unsigned> weights = blurWeights(radius);
+    int r = radius;
+    int w = image->width;
+    int h = image->height;
+    scratch->resize(w * h);
+    unsigned *src = image->pixels.data();
+    unsigned *tmp = scratch->data();
+
+    // Layers are often mostly empty, so each pass only covers the part of
+    // a row which has something in it, or which the kernel reaches from
+    // something. The extent [first, last) of each row is kept for the
+    // vertical pass.
+    std::vector<int> first(h);
+    std::vector<int> last(h);
+
+    // Horizontally from the image into scratch..
+    parallelFor(h, [&](int y0, int y1) {
+        for (int y=y0; y<y1; ++y) {
+            const unsigned *in = src + y * w;
+            unsigned *out = tmp + y * w;
+            int left = 0;
+            while (left < w && in[left] == 0)
+                ++left;
+            int right = w;
+            while (right > left && in[right - 1] == 0)
+                --right;
+            if (left == right) {
+                first[y] = last[y] = 0;
+                std::fill(out, out + w, 0);
+                continue;
+            }
+            first[y] = std::max(left - r, 0);
+            last[y] = std::min(right + r, w);
+            std::fill(out, out + first[y], 0);
+            std::fill(out + last[y], out + w, 0);
+
+            for (int x=first[y]; x<last[y]; ++x) {
+                int k0 = std::max(-r, left - x);
+                int k1 = std::min(r, right - 1 - x);
+#if defined(RENGINE_MATH_SSE2)
+                const __m128i zero = _mm_setzero_si128();
+                __m128i acc = _mm_set1_epi32(0x8000);
+                for (int k=k0; k<=k1; ++k) {
+                    __m128i p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(in[x + k]), zero), zero);
+                    acc = _mm_add_epi32(acc, _mm_madd_epi16(p, _mm_set1_epi32(weights[k + r])));
+                }
+                acc = _mm_packs_epi32(_mm_srli_epi32(acc, 16), zero);
+                out[x] = _mm_cvtsi128_si32(_mm_packus_epi16(acc, zero));
+#elif defined(RENGINE_MATH_NEON)
+                uint32x4_t acc = vdupq_n_u32(0x8000);
+                for (int k=k0; k<=k1; ++k)
+                    acc = vmlal_n_u16(acc, vget_low_u16(vmovl_u8(vcreate_u8(in[x + k]))), weights[k + r]);
+                uint16x4_t n = vqshrn_n_u32(acc, 16);
+                out[x] = vget_lane_u32(vreinterpret_u32_u8(vqmovn_u16(vcombine_u16(n, n))), 0);
+#else
+                unsigned acc[4] = { 0x8000, 0x8000, 0x8000, 0x8000 };
+                for (int k=k0; k<=k1; ++k) {
+                    unsigned p = in[x + k];
+                    unsigned wk = weights[k + r];
+                    acc[0] += (p & 0xff) * wk;
+                    acc[1] += ((p >> 8) & 0xff) * wk;
+                    acc[2] += ((p >> 16) & 0xff) * wk;
+                    acc[3] += (p >> 24) * wk;
+                }
+                out[x] = std::min(acc[0] >> 16, 255u)
+                         | (std::min(acc[1] >> 16, 255u) << 8)
+                         | (std::min(acc[2] >> 16, 255u) << 16)
+                         | (std::min(acc[3] >> 16, 255u) << 24);
+#endif
+            }
+        }
+    });
+
+    // .. and then vertically back into the image, a row at a time with one
+    // accumulator per channel.
+    parallelFor(h, [&](int y0, int y1) {
+        std::vector<unsigned> acc(4 * w);
+        for (int y=y0; y<y1; ++y) {
+            int k0 = std::max(-r, -y);
+            int k1 = std::min(r, h - 1 - y);
+            int left = w;
+            int right = 0;
+            for (int k=k0; k<=k1; ++k) {
+                if (first[y + k] < last[y + k]) {
+                    left = std::min(left, first[y + k]);
+                    right = std::max(right, last[y + k]);
+                }
+            }
+            unsigned *out = src + y * w;
+            if (left >= right) {
+                std::fill(out, out + w, 0);
+                continue;
+            }
+
+            std::fill(acc.begin() + 4 * left, acc.begin() + 4 * right, 0x8000);
+            for (int k=k0; k<=k1; ++k) {
+                const unsigned *in = tmp + (y + k) * w;
+                unsigned wk = weights[k + r];
+                int x = first[y + k];
+                int end = last[y + k];
+#if defined(RENGINE_MATH_SSE2)
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i weight = _mm_set1_epi32(wk);
+                for (; x + 4 <= end; x += 4) {
+                    __m128i p = _mm_loadu_si128((const __m128i *) (in + x));
+                    __m128i lo = _mm_unpacklo_epi8(p, zero);
+                    __m128i hi = _mm_unpackhi_epi8(p, zero);
+                    __m128i *a = (__m128i *) (acc.data() + 4 * x);
+                    _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_madd_epi16(_mm_unpacklo_epi16(lo, zero), weight)));
+                    _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_madd_epi16(_mm_unpackhi_epi16(lo, zero), weight)));
+                    _mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2), _mm_madd_epi16(_mm_unpacklo_epi16(hi, zero), weight)));
+                    _mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3), _mm_madd_epi16(_mm_unpackhi_epi16(hi, zero), weight)));
+                }
+#elif defined(RENGINE_MATH_NEON)
+                for (; x + 2 <= end; x += 2) {
+                    uint16x8_t p = vmovl_u8(vld1_u8((const uint8_t *) (in + x)));
+                    unsigned *a = acc.data() + 4 * x;
+                    vst1q_u32(a, vmlal_n_u16(vld1q_u32(a), vget_low_u16(p), wk));
+                    vst1q_u32(a + 4, vmlal_n_u16(vld1q_u32(a + 4), vget_high_u16(p), wk));
+                }
+#endif
+                for (; x<end; ++x) {
+                    unsigned p = in[x];
+                    acc[4 * x] += (p & 0xff) * wk;
+                    acc[4 * x + 1] += ((p >> 8) & 0xff) * wk;
+                    acc[4 * x + 2] += ((p >> 16) & 0xff) * wk;
+                    acc[4 * x + 3] += (p >> 24) * wk;
+                }
+            }
+
+            std::fill(out, out + left, 0);
+            std::fill(out + right, out + w, 0);
+            for (int x=left; x<right; ++x) {
+                out[x] = std::min(acc[4 * x] >> 16, 255u)
+                         | (std::min(acc[4 * x + 1] >> 16, 255u) << 8)
+                         | (std::min(acc[4 * x + 2] >> 16, 255u) << 16)
+                         | (std::min(acc[4 * x + 3] >> 16, 255u) << 24);
+            }
+        }
+    });
+}
+
+/*!
+    Renders the shadow of \a source into \a shadow, which is the blurred
+    alpha channel of the source multiplied by \a color.
+ */
+inline void SoftwareRenderer::shadow(const Image &source, Image *shadow, std::vector<unsigned> *scratch, unsigned radius, vec4 color)
+{
+    shadow->pixels.resize(source.pixels.size());
+    std::transform(source.pixels.begin(), source.pixels.end(), shadow->pixels.begin(), [] (unsigned p) {
+        return p & 0xff000000;
+    });
+    blur(shadow, scratch, radius);
+
+    vec4 c = min(max(color, vec4(0.0f)), vec4(1.0f)) * 255.0f + 0.5f;
+    unsigned packed = (unsigned(c.w) << 24) | (unsigned(c.z) << 16) | (unsigned(c.y) << 8) | unsigned(c.x);
+    int w = shadow->width;
+    parallelFor(shadow->height, [shadow, packed, w](int y0, int y1) {
+        for (unsigned *p = shadow->pixels.data() + y0 * w; p < shadow->pixels.data() + y1 * w; ++p) {
+            if (*p)
+                *p = rengine_scalePixel(packed, *p >> 24);
+        }
+    });
+}
+
+/*!
+    Calls \a work for bands of RENGINE_SOFTWARE_RENDERER_BAND_HEIGHT rows out
+    of \a rows, spread over the calling thread and the render threads, and
+    returns when all of them are done. The bands are interleaved between the
+    threads so that each gets a share of the busier parts of the frame.
+ */
+inline void SoftwareRenderer::parallelFor(int rows, const std::function<void(int, int)> &work)
+{
+    const int bandHeight = RENGINE_SOFTWARE_RENDERER_BAND_HEIGHT;
+    int bands = (rows + bandHeight - 1) / bandHeight;
+    unsigned jobs = std::min<unsigned>(m_renderThreadCount, std::max(bands - 1, 0));
+    if (jobs == 0) {
+        if (rows > 0)
+            work(0, rows);
+        return;
+    }
+
+    while (m_renderQueues.size() < jobs)
+        m_renderQueues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+    while (m_bands.size() < jobs)
+        m_bands.push_back(std::make_shared<Band>());
+
+    int step = jobs + 1;
+    for (unsigned i=0; i<jobs; ++i) {
+        Band *band = m_bands[i].get();
+        band->work = &work;
+        band->first = i + 1;
+        band->step = step;
+        band->rows = rows;
+        m_renderQueues[i]->schedule(m_bands[i]);
+    }
+
+    for (int b=0; b<bands; b += step)
+        work(b * bandHeight, std::min(rows, (b + 1) * bandHeight));
+
+    for (unsigned i=0; i<jobs; ++i)
+        m_bands[i]->waitForCompletion();
+}
+
+inline void SoftwareRenderer::Band::onExecute()
+{
+    const int bandHeight = RENGINE_SOFTWARE_RENDERER_BAND_HEIGHT;
+    for (int b=first; b * bandHeight < rows; b += step)
+        (*work)(b * bandHeight, std::min(rows, (b + 1) * bandHeight));
+}
+
+RENGINE_END_NAMESPACE
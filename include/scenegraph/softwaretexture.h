@@ -0,0 +1,78 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "texture.h"
+
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    A texture which lives in memory, for the SoftwareRenderer. The pixels are
+    kept as premultiplied RGBA, with red in the lowest byte, so BGR formats
+    are swizzled once when the texture is created rather than when it is
+    sampled.
+ */
+class SoftwareTexture : public Texture
+{
+public:
+    SoftwareTexture(vec2 size, Format format, const void *data)
+        : m_width(size.x)
+        , m_height(size.y)
+        , m_format(format)
+        , m_pixels(m_width * m_height)
+    {
+        const unsigned *src = static_cast<const unsigned *>(data);
+        bool bgr = format == BGRA_32 || format == BGRx_32;
+        for (unsigned i=0; i<m_pixels.size(); ++i) {
+            unsigned p = src[i];
+            if (bgr)
+                p = (p & 0xff00ff00) | ((p & 0x00ff0000) >> 16) | ((p & 0x000000ff) << 16);
+            m_pixels[i] = p;
+        }
+    }
+
+    vec2 size() const override { return vec2(m_width, m_height); }
+    Format format() const override { return m_format; }
+
+    /*!
+        Software textures have no GL texture, so this is always 0.
+     */
+    GLuint textureId() const override { return 0; }
+
+    int pixelWidth() const { return m_width; }
+    int pixelHeight() const { return m_height; }
+    const unsigned *pixels() const { return m_pixels.data(); }
+
+private:
+    int m_width;
+    int m_height;
+    Format m_format;
+    std::vector<unsigned> m_pixels;
+};
+
+RENGINE_END_NAMESPACE
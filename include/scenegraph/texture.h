@@ -69,6 +69,13 @@ public:
      */
     virtual GLuint textureId() const = 0;
 
+    /*!
+        Returns the normalized sub-rectangle of textureId() which holds the
+        pixels of this texture. This is the entire texture unless the texture
+        lives in an atlas.
+     */
+    virtual rect2d textureRect() const { return rect2d(0, 0, 1, 1); }
+
 
     /*!
         A pointer to the backend that created this texture. Can be
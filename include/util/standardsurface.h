@@ -100,7 +100,9 @@ public:
         m_renderer->render();
         onAfterRender();
 
-        commitRender();
+        // Presenting a frame with nothing repainted would only cost a swap
+        if (!m_renderer->frameStats().surfaceUnchanged)
+            commitRender();
         m_renderer->frameSwapped();
 
         // Schedule a repaint again if there are animations running...
@@ -199,8 +199,7 @@ inline bool WorkQueue::Job::hasCompleted() const
 inline void WorkQueue::Job::waitForCompletion()
 {
     std::unique_lock<std::mutex> locker(m_mutex);
-    if (!m_completed)
-        m_condition.wait(locker);
+    m_condition.wait(locker, [this] { return m_completed; });
 }
 
 
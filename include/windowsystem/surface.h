@@ -66,6 +66,21 @@ public:
      */
     virtual bool commitRender() = 0;
 
+    /*!
+        Implement in the backend to report how many frames old the content
+        of the buffer being rendered into is, as with EGL_EXT_buffer_age. The
+        default, 0, means the content is undefined and the renderer repaints
+        the whole surface.
+     */
+    virtual int bufferAge() const { return 0; }
+
+    /*!
+        Called by the renderer before commitRender() with the part of the
+        surface which was repainted. Implement in the backend to present only
+        that part, for instance with EGL_KHR_swap_buffers_with_damage.
+     */
+    virtual void setDamage(rect2d) { }
+
     /*!
         Implement in the backend to report the size of a surface to the application
      */
@@ -116,6 +131,10 @@ public:
 
     bool commitRender() { return m_impl->commitRender(); }
 
+    int bufferAge() const { return m_impl->bufferAge(); }
+
+    void setDamage(rect2d damage) { m_impl->setDamage(damage); }
+
     vec2 size() const { return m_impl->size(); }
 
     void requestSize(vec2 size) { m_impl->requestSize(size); }
@@ -217,6 +217,15 @@ public:
         free(pixels);
     }
 
+    /*!
+        Runs the tests with \a renderer instead of the one created by the
+        backend. The surface takes ownership of it.
+     */
+    void setRenderer(Renderer *renderer) {
+        renderer->setTargetSurface(this);
+        m_renderer.reset(renderer);
+    }
+
     bool leaveRunning;
 
 private:
@@ -262,6 +262,59 @@ void tst_rect2d_intersect()
     check_equal(r.tl, vec2(-4, -8));
     check_equal(r.br, vec2(-1, -2));
 
+    r = rect2d(0, 0, 10, 10) & rect2d(5, -5, 20, 8);
+    check_equal(r.tl, vec2(5, 0));
+    check_equal(r.br, vec2(10, 8));
+    check_true(rect2d(0, 0, 10, 10).intersects(rect2d(5, -5, 20, 8)));
+    check_true(!rect2d(0, 0, 10, 10).intersects(rect2d(10, 0, 20, 10)));
+    check_true(!rect2d(0, 0, 10, 10).intersects(rect2d(-5, 20, 5, 30)));
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
+
+void tst_transformQuad()
+{
+    // The quad kernels must match the scalar operators exactly
+    mat4 matrices[] = {
+        mat4(),
+        mat4::translate2D(10.5, -3.25),
+        mat4::translate2D(100, 50) * mat4::rotate2D(0.7) * mat4::scale2D(1.3, 0.9),
+        mat4::translate(1, 2, 3) * mat4::rotateAroundY(0.4) * mat4::rotateAroundX(-0.3)
+    };
+    rect2d rects[] = {
+        rect2d(0, 0, 1, 1),
+        rect2d(-17.3, 4.1, 33.7, 90.01),
+        rect2d::fromXywh(1000.25, -2000.5, 0.1, 7)
+    };
+    const unsigned rectCount = sizeof(rects) / sizeof(rect2d);
+
+    for (const mat4 &m : matrices) {
+        vec2 batch[4 * rectCount];
+        transformQuads2D(m, rects, rectCount, batch);
+        for (unsigned i=0; i<rectCount; ++i) {
+            rect2d r = rects[i];
+            vec2 expected[4] = { m * r.tl, m * vec2(r.tl.x, r.br.y), m * vec2(r.br.x, r.tl.y), m * r.br };
+            vec2 v[4];
+            transformQuad2D(m, r, v);
+            for (int c=0; c<4; ++c) {
+                check_equal(v[c], expected[c]);
+                check_equal(batch[4 * i + c], expected[c]);
+            }
+
+            mat4 m2d = mat4::translate2D(5, 7) * mat4::scale2D(2, 3);
+            float farPlane = 1000;
+            vec2 projected[4] = {
+                m2d * ((m * vec3(r.tl)).project2D(farPlane)),
+                m2d * ((m * vec3(r.tl.x, r.br.y)).project2D(farPlane)),
+                m2d * ((m * vec3(r.br.x, r.tl.y)).project2D(farPlane)),
+                m2d * ((m * vec3(r.br)).project2D(farPlane))
+            };
+            projectQuad(m, farPlane, m2d, r, v);
+            for (int c=0; c<4; ++c)
+                check_equal(v[c], projected[c]);
+        }
+    }
+
     cout << __PRETTY_FUNCTION__ << ": ok" << endl;
 }
 
@@ -274,6 +327,7 @@ int main(int, char **)
     tst_mat4_invert();
     tst_rect2d();
     tst_rect2d_intersect();
+    tst_transformQuad();
 
     return 0;
 }
@@ -1,5 +1,8 @@
 #include "test.h"
 
+#include <dirent.h>
+#include <unistd.h>
+
 class ColorsAndPositions : public StaticRenderTest
 {
 public:
@@ -209,6 +212,1222 @@ public:
     }
 };
 
+class BatchedRectangles : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "BatchedRectangles"; }
+    Node *build() override {
+        Node *root = Node::create();
+
+        *root
+            // A run of overlapping rects, painting order must be preserved
+            << RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1))
+            << RectangleNode::create(rect2d::fromXywh(15, 10, 10, 10), vec4(0, 1, 0, 1))
+            << RectangleNode::create(rect2d::fromXywh(20, 10, 10, 10), vec4(0, 0, 1, 0.5))
+
+            // A layer in the middle of the run breaks it up
+            << &(*OpacityNode::create(0.5)
+                 << RectangleNode::create(rect2d::fromXywh(10, 30, 10, 10), vec4(1, 1, 1, 1))
+                 << RectangleNode::create(rect2d::fromXywh(15, 30, 10, 10), vec4(1, 0, 0, 1))
+                )
+            << RectangleNode::create(rect2d::fromXywh(18, 30, 10, 10), vec4(0, 1, 0, 1))
+            << &(*TransformNode::create(mat4::translate2D(40, 0))
+                 << RectangleNode::create(rect2d::fromXywh(0, 30, 10, 10), vec4(0, 0, 1, 1))
+                )
+            ;
+
+        return root;
+    }
+
+    void check() override {
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+        check_pixel(15, 10, vec4(0, 1, 0, 1));
+        check_pixel(22, 10, vec4(0, 0.5, 0.5, 1));
+        check_pixel(27, 10, vec4(0, 0, 0.5, 1));
+
+        check_pixel(10, 30, vec4(0.5, 0.5, 0.5, 1));
+        check_pixel(16, 30, vec4(0.5, 0, 0, 1));
+        check_pixel(20, 30, vec4(0, 1, 0, 1));
+        check_pixel(40, 30, vec4(0, 0, 1, 1));
+        check_pixel(49, 39, vec4(0, 0, 1, 1));
+        check_pixel(50, 40, vec4(0, 0, 0, 1));
+    }
+};
+
+class AtlasedTextures : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "AtlasedTextures"; }
+
+    Texture *createTexture(unsigned a, unsigned b) {
+        // 4x1 pixels, left half is 'a', right half is 'b'
+        unsigned pixels[] = { a, a, b, b };
+        Renderer *renderer = static_cast<StandardSurface *>(surface())->renderer();
+        Texture *texture = renderer->createTextureFromImageData(vec2(4, 1), Texture::RGBA_32, pixels);
+        m_textures.push_back(std::unique_ptr<Texture>(texture));
+        return texture;
+    }
+
+    Node *build() override {
+        Texture *red = createTexture(0xff0000ff, 0xff0000ff);
+        Texture *green = createTexture(0xff00ff00, 0xff00ff00);
+        Texture *split = createTexture(0xff0000ff, 0xffff0000);
+
+        // Small textures share an atlas page and use a sub-rect of it
+        if (dynamic_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer())) {
+            check_equal(red->textureId(), green->textureId());
+            check_true(!(red->textureRect() == rect2d(0, 0, 1, 1)));
+        }
+
+        TextureNode *leftHalf = TextureNode::create(rect2d::fromXywh(10, 30, 10, 10), split);
+        leftHalf->setTextureRect(rect2d(0, 0, 0.5, 1));
+        TextureNode *rightHalf = TextureNode::create(rect2d::fromXywh(30, 30, 10, 10), split);
+        rightHalf->setTextureRect(rect2d(0.5, 0, 1, 1));
+
+        Node *root = Node::create();
+        *root
+            << TextureNode::create(rect2d::fromXywh(10, 10, 10, 10), red)
+            << TextureNode::create(rect2d::fromXywh(15, 10, 10, 10), green)
+            << TextureNode::create(rect2d::fromXywh(20, 10, 10, 10), red)
+            << leftHalf
+            << rightHalf
+            ;
+        return root;
+    }
+
+    void check() override {
+        // Scaled up, but the edges must not bleed from neighbours in the atlas
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+        check_pixel(14, 19, vec4(1, 0, 0, 1));
+        check_pixel(15, 10, vec4(0, 1, 0, 1));
+        check_pixel(19, 19, vec4(0, 1, 0, 1));
+        check_pixel(20, 10, vec4(1, 0, 0, 1));
+        check_pixel(29, 19, vec4(1, 0, 0, 1));
+        check_pixel(30, 10, vec4(0, 0, 0, 1));
+
+        // Only check the parts of the sub-rects that are not filtered
+        // against the other half of the texture
+        check_pixel(10, 30, vec4(1, 0, 0, 1));
+        check_pixel(14, 39, vec4(1, 0, 0, 1));
+        check_pixel(35, 30, vec4(0, 0, 1, 1));
+        check_pixel(39, 39, vec4(0, 0, 1, 1));
+    }
+
+private:
+    std::vector<std::unique_ptr<Texture>> m_textures;
+};
+
+class LayerFilters : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "LayerFilters"; }
+    Node *build() override {
+        // Moves red into green
+        mat4 redToGreen(0, 0, 0, 0,
+                        1, 0, 0, 0,
+                        0, 0, 0, 0,
+                        0, 0, 0, 1);
+
+        ColorFilterNode *filter = ColorFilterNode::create();
+        filter->setColorMatrix(redToGreen);
+
+        TransformNode *projection = TransformNode::create(mat4::translate(240, 60, 0) * mat4::rotateAroundY(0.5));
+        projection->setProjectionDepth(1000);
+
+        Node *root = Node::create();
+        *root
+            << &(*filter << RectangleNode::create(rect2d::fromXywh(10, 10, 20, 20), vec4(1, 0, 0, 1)))
+            << &(*BlurNode::create(4) << RectangleNode::create(rect2d::fromXywh(40, 10, 20, 20), vec4(1, 1, 1, 1)))
+
+            // A blue shadow on white
+            << RectangleNode::create(rect2d::fromXywh(70, 0, 60, 60), vec4(1, 1, 1, 1))
+            << &(*ShadowNode::create(2, vec2(10, 10), vec4(0, 0, 1, 1)) << RectangleNode::create(rect2d::fromXywh(80, 10, 20, 20), vec4(1, 0, 0, 1)))
+
+            << &(*TransformNode::create(mat4::translate2D(160, 40) * mat4::rotate2D(M_PI / 4))
+                 << RectangleNode::create(rect2d::fromXywh(-10, -10, 20, 20), vec4(0, 1, 0, 1)))
+
+            << &(*projection << RectangleNode::create(rect2d::fromXywh(-20, -20, 40, 40), vec4(0, 0, 1, 1)))
+            ;
+        return root;
+    }
+
+    void check() override {
+        check_pixel(20, 20, vec4(0, 1, 0, 1));
+
+        check_true(pixel(50, 20).x > 0.9);
+        check_true(pixel(40, 20).x > 0.3 && pixel(40, 20).x < 0.7);
+        check_true(pixel(30, 20).x < 0.05);
+
+        check_pixel(90, 20, vec4(1, 0, 0, 1));
+        check_true(fuzzy_equals(pixel(105, 25), vec4(0, 0, 1, 1), 0.05));
+        check_pixel(120, 50, vec4(1, 1, 1, 1));
+
+        check_pixel(160, 40, vec4(0, 1, 0, 1));
+        check_pixel(160, 28, vec4(0, 1, 0, 1));
+        check_pixel(151, 31, vec4(0, 0, 0, 1));
+
+        check_pixel(240, 60, vec4(0, 0, 1, 1));
+        check_pixel(240, 20, vec4(0, 0, 0, 1));
+    }
+};
+
+class Readback : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Readback"; }
+    Node *build() override {
+        Node *root = Node::create();
+        *root << RectangleNode::create(rect2d::fromXywh(0, 0, 20, 10), vec4(1, 0, 0, 1))
+              << RectangleNode::create(rect2d::fromXywh(15, 5, 10, 30), vec4(0, 0, 1, 1));
+        return root;
+    }
+
+    void check() override {
+        check_pixel(0, 0, vec4(1, 0, 0, 1));
+        check_pixel(0, 10, vec4(0, 0, 0, 1));
+        check_pixel(20, 34, vec4(0, 0, 1, 1));
+
+        Renderer *renderer = static_cast<StandardSurface *>(surface())->renderer();
+        OpenGLRenderer *glRenderer = dynamic_cast<OpenGLRenderer *>(renderer);
+        bool async = glRenderer && glRenderer->asyncReadbackSupported();
+
+        // Like readPixels(), the rect has bottom-up coordinates and the
+        // pixels come out top row first
+        std::shared_ptr<PixelReadback> full = renderer->readPixelsAsync(0, 0, m_w, m_h);
+        std::shared_ptr<PixelReadback> part = renderer->readPixelsAsync(10, m_h - 30, 20, 20);
+        renderer->readPixelsAsync(0, 0, m_w, m_h).reset(); // nobody wants this one
+        if (async) {
+            check_true(!full->isReady());
+            check_equal(glRenderer->readbacksPending(), 3u);
+        }
+
+        renderer->finishReadbacks();
+        if (glRenderer)
+            check_equal(glRenderer->readbacksPending(), 0u);
+        check_true(full->isReady());
+        check_true(part->isReady());
+        check_true(full->pixels() == std::vector<unsigned>(m_pixels, m_pixels + m_w * m_h));
+        for (int y=0; y<20; ++y)
+            for (int x=0; x<20; ++x)
+                check_equal_hex(part->pixels()[y * 20 + x], m_pixels[(y + 10) * m_w + x + 10]);
+
+        // The buffers are reused
+        std::shared_ptr<PixelReadback> again = renderer->readPixelsAsync(10, m_h - 30, 20, 20);
+        renderer->finishReadbacks();
+        check_true(again->pixels() == part->pixels());
+    }
+};
+
+class FrameStatistics : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "FrameStatistics"; }
+    Node *build() override {
+        Node *root = Node::create();
+        *root << RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1))
+              << &(*TransformNode::create(mat4::translate2D(20, 0))
+                   << RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(0, 1, 0, 1)))
+              << &(*OpacityNode::create(0.5)
+                   << RectangleNode::create(rect2d::fromXywh(50, 10, 10, 10), vec4(0, 0, 1, 1)));
+        return root;
+    }
+
+    void check() override {
+        Renderer *renderer = static_cast<StandardSurface *>(surface())->renderer();
+        FrameStats stats = renderer->frameStats();
+        check_true(stats.sceneRebuilt);
+        check_equal(stats.rectangleNodes, 3u);
+        check_equal(stats.textureNodes, 0u);
+        check_equal(stats.transformNodes, 1u);
+        check_equal(stats.transformNodesWith3d, 0u);
+        check_equal(stats.layeredNodes, 1u);
+        check_equal(stats.layersRendered, 1u);
+        check_true(stats.elements >= 3u);
+        check_true(stats.buildTime >= 0);
+        check_true(stats.renderTime >= 0);
+
+        OpenGLRenderer *glRenderer = dynamic_cast<OpenGLRenderer *>(renderer);
+        if (!glRenderer)
+            return;
+        check_true(stats.drawCalls > 0);
+        check_true(stats.shaderSwitches > 0);
+        check_true(stats.texturePoolTextures > 0);
+        check_true(stats.texturePoolMemory > 0);
+
+        // Nothing changed, so nothing is built. Layer caching is off by
+        // default, so the layer is rendered again.
+        glRenderer->render();
+        stats = glRenderer->frameStats();
+        check_true(!stats.sceneRebuilt);
+        check_equal(stats.rectangleNodes, 3u);
+        check_equal(stats.prepassTime, 0.0);
+        check_equal(stats.buildTime, 0.0);
+        check_equal(stats.vertexBytesUploaded, 0u);
+        check_equal(stats.layersRendered, 1u);
+        check_equal(stats.layersCached, 0u);
+        check_true(stats.drawCalls > 0);
+    }
+};
+
+class ProjectionSorting : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "ProjectionSorting"; }
+    Node *build() override {
+        TransformNode *projection = TransformNode::create(mat4::translate2D(160, 120));
+        projection->setProjectionDepth(1000);
+
+        // Many elements at the same depth are drawn in the scene's order
+        for (int i=0; i<40; ++i)
+            *projection << RectangleNode::create(rect2d::fromXywh(-60, -20, 40, 40), i % 2 ? vec4(0, 1, 0, 1) : vec4(1, 0, 0, 1));
+
+        // Elements further back are drawn first, regardless of their order
+        m_near = TransformNode::create(offset(40, 50));
+        m_far = TransformNode::create(offset(40, -50));
+        *projection << &(*m_near << RectangleNode::create(rect2d::fromXywh(-20, -20, 40, 40), vec4(0, 0, 1, 1)))
+                    << &(*m_far << RectangleNode::create(rect2d::fromXywh(-20, -20, 40, 40), vec4(1, 1, 0, 1)));
+
+        Node *root = Node::create();
+        *root << projection;
+        return root;
+    }
+
+    void check() override {
+        check_pixel(120, 120, vec4(0, 1, 0, 1));
+        check_pixel(200, 120, vec4(0, 0, 1, 1));
+
+        // Swapping the depths flips the order, also when the last frame's
+        // order is where the sort starts from
+        m_near->setMatrix(offset(40, -50));
+        m_far->setMatrix(offset(40, 50));
+        Renderer *renderer = static_cast<StandardSurface *>(surface())->renderer();
+        for (int i=0; i<2; ++i) {
+            renderer->render();
+            unsigned pixel = 0;
+            check_true(renderer->readPixels(200, m_h - 121, 1, 1, &pixel));
+            check_equal_hex(pixel, 0xff00ffffu);
+            check_true(renderer->readPixels(120, m_h - 121, 1, 1, &pixel));
+            check_equal_hex(pixel, 0xff00ff00u);
+        }
+
+        // Once they are back in the same plane, the scene's order applies
+        // again rather than the order they had while apart
+        m_near->setMatrix(offset(40, 50));
+        m_far->setMatrix(offset(40, -50));
+        renderer->render();
+        unsigned pixel = 0;
+        check_true(renderer->readPixels(200, m_h - 121, 1, 1, &pixel));
+        check_equal_hex(pixel, 0xffff0000u);
+        m_near->setMatrix(offset(40, 0));
+        m_far->setMatrix(offset(40, 0));
+        renderer->render();
+        check_true(renderer->readPixels(200, m_h - 121, 1, 1, &pixel));
+        check_equal_hex(pixel, 0xff00ffffu);
+    }
+
+private:
+    // mat4::translate() is tagged as a 2D translation, which drops 'dz'
+    static mat4 offset(float dx, float dz) {
+        return mat4(1, 0, 0, dx,
+                    0, 1, 0, 0,
+                    0, 0, 1, dz,
+                    0, 0, 0, 1);
+    }
+
+    TransformNode *m_near = nullptr;
+    TransformNode *m_far = nullptr;
+};
+
+class RetainedVertices : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "RetainedVertices"; }
+    Node *build() override {
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1));
+        Node *root = Node::create();
+        *root
+            << RectangleNode::create(rect2d::fromXywh(0, 0, 10, 10), vec4(0, 0, 1, 1))
+            << m_rect
+            << RectangleNode::create(rect2d::fromXywh(20, 20, 10, 10), vec4(0, 1, 0, 1))
+            ;
+        return root;
+    }
+
+    void check() override {
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+
+        // Rendering the same scene again uploads nothing
+        renderer->render();
+        check_equal(renderer->vertexBytesUploaded(), 0u);
+
+        // Changing a color only uploads that rectangle's colors
+        m_rect->setColor(vec4(1, 1, 0, 1));
+        renderer->render();
+        check_true(renderer->vertexBytesUploaded() > 0);
+        check_true(renderer->vertexBytesUploaded() <= 4 * 4);
+
+        // Moving it only uploads its positions
+        m_rect->setGeometry(rect2d::fromXywh(40, 10, 10, 10));
+        renderer->render();
+        check_true(renderer->vertexBytesUploaded() > 0);
+        check_true(renderer->vertexBytesUploaded() <= 4 * sizeof(vec2));
+
+        // readPixels() uses bottom-up coordinates
+        unsigned pixel = 0;
+        check_true(renderer->readPixels(40, surface()->size().y - 11, 1, 1, &pixel));
+        check_equal(pixel, 0xff00ffffu);
+    }
+
+private:
+    RectangleNode *m_rect = nullptr;
+};
+
+class UnchangedScene : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "UnchangedScene"; }
+    Node *build() override {
+        m_xform = TransformNode::create(mat4());
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1));
+        Node *root = Node::create();
+        *root << &(*m_xform << m_rect);
+        return root;
+    }
+
+    void check() override {
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        Node *root = renderer->sceneRoot();
+        check_true(!root->isDirty());
+        check_true(!m_rect->isDirty());
+
+        // Nothing changed, the previous frame's state is reused
+        renderer->render();
+        check_true(!renderer->sceneRebuilt());
+
+        // Changes deep in the tree propagate to the root
+        m_rect->setColor(vec4(0, 1, 0, 1));
+        check_true(m_rect->isDirty());
+        check_true(m_xform->isDirty());
+        check_true(root->isDirty());
+        renderer->render();
+        check_true(renderer->sceneRebuilt());
+        check_true(!root->isDirty());
+
+        m_xform->setMatrix(mat4::translate2D(20, 0));
+        renderer->render();
+        check_true(renderer->sceneRebuilt());
+        renderer->render();
+        check_true(!renderer->sceneRebuilt());
+        unsigned pixel = 0;
+        check_true(renderer->readPixels(30, surface()->size().y - 11, 1, 1, &pixel));
+        check_equal(pixel, 0xff00ff00u);
+
+        // Writing the same translation again changes nothing
+        m_xform->setMatrix_x(20);
+        m_xform->setMatrix_y(0);
+        check_true(!root->isDirty());
+        m_xform->setMatrix_x(21);
+        check_true(root->isDirty());
+        m_xform->setMatrix_x(20);
+        renderer->render();
+        check_true(renderer->sceneRebuilt());
+
+        // Structural changes too
+        RectangleNode *added = RectangleNode::create(rect2d::fromXywh(0, 0, 5, 5), vec4(0, 0, 1, 1));
+        *m_xform << added;
+        check_true(root->isDirty());
+        renderer->render();
+        check_true(renderer->sceneRebuilt());
+        added->destroy();
+        check_true(root->isDirty());
+        renderer->render();
+        check_true(renderer->sceneRebuilt());
+    }
+
+private:
+    TransformNode *m_xform = nullptr;
+    RectangleNode *m_rect = nullptr;
+};
+
+class CachedLayers : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "CachedLayers"; }
+    Node *build() override {
+        m_xform = TransformNode::create(mat4());
+        m_opacity = OpacityNode::create(0.5);
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1));
+        m_blur = BlurNode::create(2);
+        Node *root = Node::create();
+        *root
+            << &(*m_xform << &(*m_opacity << m_rect))
+            << &(*m_blur << RectangleNode::create(rect2d::fromXywh(50, 10, 20, 20), vec4(1, 1, 1, 1)));
+        return root;
+    }
+
+    // Renders another frame and makes check_pixel() look at it
+    void renderAgain(OpenGLRenderer *renderer) {
+        renderer->render();
+        m_frame.resize(m_w * m_h);
+        renderer->readPixels(0, 0, m_w, m_h, m_frame.data());
+        m_pixels = m_frame.data();
+    }
+
+    void check() override {
+        check_pixel(10, 10, vec4(0.5, 0, 0, 1));
+
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        vec4 blurEdge = pixel(50, 20);
+        check_true(blurEdge.x > 0 && blurEdge.x < 1);
+
+        // Caching is off by default, the first frame with it fills the cache
+        check_true(!renderer->layerCachingEnabled());
+        renderer->setLayerCachingEnabled(true);
+        renderAgain(renderer);
+        check_equal(renderer->layerCacheHits(), 0u);
+
+        // Both layers are reused when nothing changes
+        renderAgain(renderer);
+        check_equal(renderer->layerCacheHits(), 2u);
+        check_pixel(10, 10, vec4(0.5, 0, 0, 1));
+        check_pixel(50, 20, blurEdge);
+
+        // Opacity only changes how the layer is composited
+        m_opacity->setOpacity(0.25);
+        renderAgain(renderer);
+        check_equal(renderer->layerCacheHits(), 2u);
+        check_pixel(10, 10, vec4(0.25, 0, 0, 1));
+
+        // Changing the content renders it again
+        m_rect->setColor(vec4(0, 1, 0, 1));
+        renderAgain(renderer);
+        check_equal(renderer->layerCacheHits(), 1u);
+        check_pixel(10, 10, vec4(0, 0.25, 0, 1));
+
+        // Whole pixel translation keeps the cached layer, scaling does not
+        m_xform->setMatrix(mat4::translate2D(5, 0));
+        renderAgain(renderer);
+        check_equal(renderer->layerCacheHits(), 2u);
+        check_pixel(14, 10, vec4(0, 0, 0, 1));
+        check_pixel(15, 10, vec4(0, 0.25, 0, 1));
+        m_xform->setMatrix(mat4::scale2D(2, 2));
+        renderAgain(renderer);
+        check_equal(renderer->layerCacheHits(), 1u);
+        check_pixel(39, 39, vec4(0, 0.25, 0, 1));
+        check_pixel(40, 40, vec4(0, 0, 0, 1));
+
+        // Layers which are rendered again reuse framebuffers from the pool
+        unsigned fboHits = renderer->framebufferPoolHits();
+        unsigned fboMisses = renderer->framebufferPoolMisses();
+        renderer->setLayerCachingEnabled(false);
+        renderAgain(renderer);
+        check_equal(renderer->layerCacheHits(), 0u);
+        check_pixel(50, 20, blurEdge);
+        check_equal(renderer->framebufferPoolHits(), fboHits + 2);
+        check_equal(renderer->framebufferPoolMisses(), fboMisses);
+
+        // Layers of a similar size reuse pooled textures without allocating
+        unsigned textureMisses = renderer->texturePoolMisses();
+        m_rect->setGeometry(rect2d::fromXywh(10, 10, 12, 12));
+        renderAgain(renderer);
+        check_pixel(39, 39, vec4(0, 0.25, 0, 1));
+        check_pixel(43, 43, vec4(0, 0.25, 0, 1));
+        check_equal(renderer->texturePoolMisses(), textureMisses);
+
+        // Without caching, all layer textures are free after the frame
+        check_true(renderer->texturePoolMemory() > 0);
+        unsigned limit = renderer->texturePoolLimit();
+        renderer->setTexturePoolLimit(0);
+        check_equal(renderer->texturePoolMemory(), 0u);
+        renderer->setTexturePoolLimit(limit);
+    }
+
+private:
+    TransformNode *m_xform = nullptr;
+    OpacityNode *m_opacity = nullptr;
+    RectangleNode *m_rect = nullptr;
+    BlurNode *m_blur = nullptr;
+    std::vector<unsigned> m_frame;
+};
+
+class DownsampledBlur : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "DownsampledBlur"; }
+    Node *build() override {
+        Node *root = Node::create();
+        *root << &(*BlurNode::create(24) << RectangleNode::create(rect2d::fromXywh(60, 60, 40, 40), vec4(1, 1, 1, 1)));
+        return root;
+    }
+
+    void renderAgain(OpenGLRenderer *renderer) {
+        renderer->render();
+        m_frame.resize(m_w * m_h);
+        renderer->readPixels(0, 0, m_w, m_h, m_frame.data());
+        m_pixels = m_frame.data();
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        check_equal(renderer->blurMode(), OpenGLRenderer::AutomaticBlur);
+        check_equal(renderer->blurLevels(8), 0u);
+        check_equal(renderer->blurLevels(9), 1u);
+        check_equal(renderer->blurLevels(24), 2u);
+        check_equal(renderer->blurLevels(1000), unsigned(RENGINE_RENDERER_BLUR_MAX_LEVELS));
+
+        // The automatic blur is downsampled for this radius, compare it to
+        // the full resolution one.
+        const int xs[] = { 40, 50, 60, 70, 80 };
+        vec4 downsampled[5];
+        for (int i=0; i<5; ++i)
+            downsampled[i] = pixel(xs[i], 80);
+
+        renderer->setBlurMode(OpenGLRenderer::FullResolutionBlur);
+        check_equal(renderer->blurLevels(24), 0u);
+        renderAgain(renderer);
+        for (int i=0; i<5; ++i) {
+            vec4 full = pixel(xs[i], 80);
+            check_true(fuzzy_equals(full, downsampled[i], 0.1));
+        }
+
+        // Fades out from the center towards the edges
+        check_true(pixel(80, 80).x > 0.9);
+        check_true(pixel(60, 80).x > 0.3 && pixel(60, 80).x < 0.7);
+        check_true(pixel(40, 80).x < 0.1);
+
+        renderer->setBlurMode(OpenGLRenderer::DownsampledBlur);
+        check_equal(renderer->blurLevels(2), 1u);
+        renderer->setBlurMode(OpenGLRenderer::AutomaticBlur);
+    }
+
+private:
+    std::vector<unsigned> m_frame;
+};
+
+class OpaquePass : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "OpaquePass"; }
+    Node *build() override {
+        Node *root = Node::create();
+        *root
+            << RectangleNode::create(rect2d::fromXywh(10, 10, 40, 40), vec4(1, 0, 0, 1))
+            << RectangleNode::create(rect2d::fromXywh(20, 20, 40, 40), vec4(0, 1, 0, 0.5))
+            << RectangleNode::create(rect2d::fromXywh(30, 30, 40, 40), vec4(0, 0, 1, 1))
+            << RectangleNode::create(rect2d::fromXywh(35, 35, 10, 10), vec4(1, 1, 1, 1))
+            << &(*OpacityNode::create(0.5)
+                 << RectangleNode::create(rect2d::fromXywh(40, 40, 40, 40), vec4(1, 1, 0, 1)))
+            << RectangleNode::create(rect2d::fromXywh(60, 60, 40, 40), vec4(0, 1, 1, 1));
+        return root;
+    }
+
+    void renderAgain(OpenGLRenderer *renderer) {
+        renderer->render();
+        m_frame.resize(m_w * m_h);
+        renderer->readPixels(0, 0, m_w, m_h, m_frame.data());
+        m_pixels = m_frame.data();
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        check_equal(renderer->opaquePassElements(), 0u);
+        std::vector<unsigned> reference(m_pixels, m_pixels + m_w * m_h);
+
+        GLint depthBits = 0;
+        glGetIntegerv(GL_DEPTH_BITS, &depthBits);
+        if (depthBits == 0) {
+            cout << "no depth buffer, skipping OpaquePass" << endl;
+            return;
+        }
+
+        // The opaque rectangles outside the layer go in the opaque pass and
+        // the result is the same. The unchanged frame is drawn in full.
+        renderer->setOpaquePassEnabled(true);
+        renderAgain(renderer);
+        check_equal(renderer->opaquePassElements(), 4u);
+        check_true(m_frame == reference);
+        check_pixel(37, 37, vec4(1, 1, 1, 1));
+        check_pixel(40, 40, vec4(1, 1, 0.5, 1));
+        check_pixel(25, 25, vec4(0.5, 0.5, 0, 1));
+        check_pixel(65, 65, vec4(0, 1, 1, 1));
+
+        renderer->setOpaquePassEnabled(false);
+    }
+
+private:
+    std::vector<unsigned> m_frame;
+};
+
+class CulledNodes : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "CulledNodes"; }
+    Node *build() override {
+        Node *root = Node::create();
+
+        // Rows scrolled out above the surface
+        Node *rows = TransformNode::create(mat4::translate2D(0, -100000));
+        for (int i=0; i<1000; ++i)
+            *rows << RectangleNode::create(rect2d::fromXywh(0, i * 20, 100, 20), vec4(1, 0, 0, 1));
+        *root << rows;
+
+        *root
+            // A layer which is entirely outside
+            << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(-100, 10, 50, 50), vec4(0, 1, 0, 1)))
+
+            // A layer far larger than any texture, clamped to the surface
+            << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(-50000, -50000, 100000, 100000), vec4(0, 0, 1, 1)))
+
+            // Just outside, but the blur spills onto the surface
+            << &(*BlurNode::create(4) << RectangleNode::create(rect2d::fromXywh(-4, 100, 4, 20), vec4(1, 1, 1, 1)));
+
+        return root;
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        // The rows, the outside layer and its rectangle
+        check_equal(renderer->culledNodes(), 1000u + 2u);
+        check_pixel(10, 10, vec4(0, 0, 0.5, 1));
+        check_pixel(m_w - 1, m_h - 1, vec4(0, 0, 0.5, 1));
+        check_true(pixel(0, 110).x > 0.1);
+        check_pixel(20, 110, vec4(0, 0, 0.5, 1));
+    }
+};
+
+class DamageRegions : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "DamageRegions"; }
+    Node *build() override {
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1));
+        m_xform = TransformNode::create(mat4::translate2D(100, 10));
+        m_opacity = OpacityNode::create(0.5);
+        Node *root = Node::create();
+        *root
+            << m_rect
+            << &(*m_xform << RectangleNode::create(rect2d::fromXywh(0, 0, 10, 10), vec4(0, 1, 0, 1)))
+            << &(*m_opacity << RectangleNode::create(rect2d::fromXywh(200, 10, 10, 10), vec4(0, 0, 1, 1)));
+        return root;
+    }
+
+    // Renders another frame and makes check_pixel() look at it
+    void renderAgain(OpenGLRenderer *renderer) {
+        renderer->render();
+        m_frame.resize(m_w * m_h);
+        renderer->readPixels(0, 0, m_w, m_h, m_frame.data());
+        m_pixels = m_frame.data();
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        rect2d all(vec2(), surface()->size());
+        check_equal(renderer->repaintedRect(), all);
+        if (surface()->bufferAge() == 0) {
+            cout << "   - buffer age is unknown, skipping..." << endl;
+            return;
+        }
+
+        // Damage tracking is off by default. The first frame with it
+        // repaints everything, as nothing is known about the last frame.
+        renderer->setDamageTrackingEnabled(true);
+        renderAgain(renderer);
+        check_equal(renderer->repaintedRect(), all);
+        check_true(!renderer->frameStats().surfaceUnchanged);
+
+        // Nothing changed, nothing is repainted and there is nothing to present
+        for (int i=0; i<surface()->bufferAge(); ++i)
+            renderAgain(renderer);
+        check_equal(renderer->repaintedRect().width(), 0);
+        check_true(renderer->frameStats().surfaceUnchanged);
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+
+        // Only the rectangle which changed
+        m_rect->setColor(vec4(1, 1, 0, 1));
+        renderAgain(renderer);
+        check_equal(renderer->repaintedRect(), rect2d::fromXywh(10, 10, 10, 10));
+        check_pixel(10, 10, vec4(1, 1, 0, 1));
+        check_pixel(100, 10, vec4(0, 1, 0, 1));
+
+        // Both where a moved node was and where it is now
+        m_xform->setMatrix(mat4::translate2D(120, 10));
+        renderAgain(renderer);
+        check_equal(renderer->repaintedRect(), rect2d::fromXywh(100, 10, 30, 10));
+        check_pixel(100, 10, vec4(0, 0, 0, 1));
+        check_pixel(120, 10, vec4(0, 1, 0, 1));
+
+        // A layer is repainted in full
+        m_opacity->setOpacity(0.25);
+        renderAgain(renderer);
+        check_equal(renderer->repaintedRect(), rect2d::fromXywh(200, 10, 10, 10));
+        check_pixel(200, 10, vec4(0, 0, 0.25, 1));
+        check_pixel(10, 10, vec4(1, 1, 0, 1));
+
+        // Removed nodes leave damage behind
+        m_rect->destroy();
+        renderAgain(renderer);
+        check_equal(renderer->repaintedRect(), rect2d::fromXywh(10, 10, 10, 10));
+        check_pixel(10, 10, vec4(0, 0, 0, 1));
+        check_pixel(120, 10, vec4(0, 1, 0, 1));
+        check_pixel(200, 10, vec4(0, 0, 0.25, 1));
+
+        renderer->setDamageTrackingEnabled(false);
+    }
+
+private:
+    RectangleNode *m_rect = nullptr;
+    TransformNode *m_xform = nullptr;
+    OpacityNode *m_opacity = nullptr;
+    std::vector<unsigned> m_frame;
+};
+
+class MillionRectangles : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "MillionRectangles"; }
+    Node *build() override {
+        // Far more elements than fit on the stack. They are added in groups,
+        // as appending a child checks all existing ones in debug builds.
+        Node *root = Node::create();
+        for (int g=0; g<1000; ++g) {
+            Node *group = Node::create();
+            for (int i=g*1000; i<(g+1)*1000; ++i) {
+                vec4 color = i % 2 ? vec4(1, 0, 0, 1) : vec4(0, 0, 1, 1);
+                *group << RectangleNode::create(rect2d::fromXywh(i % 100, (i / 100) % 100, 10, 10), color);
+            }
+            *root << group;
+        }
+        return root;
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        check_pixel(0, 0, vec4(0, 0, 1, 1));
+        check_pixel(1, 0, vec4(1, 0, 0, 1));
+        check_pixel(150, 150, vec4(0, 0, 0, 1));
+
+        // Unchanged frames reuse what the last one allocated
+        renderer->render();
+        check_true(!renderer->sceneRebuilt());
+    }
+};
+
+class ParallelBuild : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "ParallelBuild"; }
+    Node *build() override {
+        unsigned pixels[] = { 0xff00ff00, 0xff0000ff, 0xffff0000, 0xffffffff };
+        Renderer *renderer = static_cast<StandardSurface *>(surface())->renderer();
+        m_texture.reset(renderer->createTextureFromImageData(vec2(2, 2), Texture::RGBA_32, pixels));
+
+        // Enough rectangles in enough groups to be split up, with a layer in
+        // one of the groups, which can't be built in parallel, and some
+        // rectangles which are culled or transparent.
+        Node *root = Node::create();
+        Node *groups = TransformNode::create(mat4::translate2D(2, 3));
+        for (int g=0; g<64; ++g) {
+            Node *group = TransformNode::create(mat4::translate2D((g % 8) * 40, (g / 8) * 30));
+            for (int i=0; i<80; ++i) {
+                vec4 color((i % 3) / 2.0f, (g % 5) / 4.0f, (i % 7) / 6.0f, i % 11 ? 1.0f : 0.0f);
+                *group << RectangleNode::create(rect2d::fromXywh(i % 10 * 3, i / 10 * 3, 5, 5), color);
+            }
+            *group << RectangleNode::create(rect2d::fromXywh(-1000, 0, 10, 10), vec4(1, 0, 0, 1));
+            *group << TextureNode::create(rect2d::fromXywh(10, 10, 8, 8), m_texture.get());
+            if (g == 10)
+                *group << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(0, 0, 20, 20), vec4(1, 1, 1, 1)));
+            *groups << group;
+        }
+        *root << groups;
+        return root;
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        check_equal(renderer->buildThreadCount(), 0u);
+        std::vector<unsigned> reference(m_pixels, m_pixels + m_w * m_h);
+        std::vector<OpenGLRenderer::Element> elements = renderer->m_builtElements;
+        std::vector<vec2> vertices = renderer->m_vertexBuffer.data;
+        std::vector<vec2> texCoords = renderer->m_vertexTexCoordBuffer.data;
+        std::vector<OpenGLRenderer::PackedColor> colors = renderer->m_vertexColorBuffer.data;
+        std::vector<rect2d> instanceRects = renderer->m_instanceRectBuffer.data;
+        std::vector<OpenGLRenderer::InstanceTransform> instanceTransforms = renderer->m_instanceTransformBuffer.data;
+        std::vector<OpenGLRenderer::PackedColor> instanceColors = renderer->m_instanceColorBuffer.data;
+        std::vector<rect2d> instanceTexRects = renderer->m_instanceTexRectBuffer.data;
+        unsigned culled = renderer->culledNodes();
+        check_true(culled >= 64u);
+
+        // Clear the retained vertices, so that anything the parallel build
+        // fails to write shows up.
+        std::fill(renderer->m_vertexBuffer.data.begin(), renderer->m_vertexBuffer.data.end(), vec2(0, 0));
+        std::fill(renderer->m_vertexTexCoordBuffer.data.begin(), renderer->m_vertexTexCoordBuffer.data.end(), vec2(0, 0));
+        std::fill(renderer->m_vertexColorBuffer.data.begin(), renderer->m_vertexColorBuffer.data.end(), OpenGLRenderer::PackedColor());
+        std::fill(renderer->m_instanceRectBuffer.data.begin(), renderer->m_instanceRectBuffer.data.end(), rect2d());
+        std::fill(renderer->m_instanceTransformBuffer.data.begin(), renderer->m_instanceTransformBuffer.data.end(), OpenGLRenderer::InstanceTransform());
+        std::fill(renderer->m_instanceColorBuffer.data.begin(), renderer->m_instanceColorBuffer.data.end(), OpenGLRenderer::PackedColor());
+        std::fill(renderer->m_instanceTexRectBuffer.data.begin(), renderer->m_instanceTexRectBuffer.data.end(), rect2d());
+
+        renderer->setBuildThreadCount(4);
+        renderer->render();
+        check_true(renderer->sceneRebuilt());
+        check_equal(renderer->culledNodes(), culled);
+        check_equal(renderer->m_builtElements.size(), elements.size());
+        check_true(memcmp(renderer->m_builtElements.data(), elements.data(), elements.size() * sizeof(OpenGLRenderer::Element)) == 0);
+        for (const OpenGLRenderer::Element &e : elements) {
+            if (e.layered)
+                continue;
+            unsigned o = e.vboOffset;
+            if (e.instanced) {
+                check_true(memcmp(&renderer->m_instanceRectBuffer.data[o], &instanceRects[o], sizeof(rect2d)) == 0);
+                check_true(memcmp(&renderer->m_instanceTransformBuffer.data[o], &instanceTransforms[o], sizeof(OpenGLRenderer::InstanceTransform)) == 0);
+                if (e.node->type() == Node::RectangleNodeType) {
+                    check_true(memcmp(&renderer->m_instanceColorBuffer.data[o], &instanceColors[o], sizeof(OpenGLRenderer::PackedColor)) == 0);
+                } else {
+                    check_true(memcmp(&renderer->m_instanceTexRectBuffer.data[o], &instanceTexRects[o], sizeof(rect2d)) == 0);
+                }
+                continue;
+            }
+            check_true(memcmp(&renderer->m_vertexBuffer.data[o], &vertices[o], 4 * sizeof(vec2)) == 0);
+            if (e.node->type() == Node::RectangleNodeType) {
+                check_true(memcmp(&renderer->m_vertexColorBuffer.data[o], &colors[o], 4 * sizeof(OpenGLRenderer::PackedColor)) == 0);
+            } else {
+                check_true(memcmp(&renderer->m_vertexTexCoordBuffer.data[o], &texCoords[o], 4 * sizeof(vec2)) == 0);
+            }
+        }
+
+        std::vector<unsigned> frame(m_w * m_h);
+        renderer->readPixels(0, 0, m_w, m_h, frame.data());
+        check_true(frame == reference);
+
+        renderer->setBuildThreadCount(0);
+    }
+
+private:
+    std::unique_ptr<Texture> m_texture;
+};
+
+class InstancedRendering : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "InstancedRendering"; }
+    Node *build() override {
+        unsigned pixels[] = { 0xff0000ff, 0xff00ff00, 0xffff0000, 0xffffffff };
+        Renderer *renderer = static_cast<StandardSurface *>(surface())->renderer();
+        m_texture.reset(renderer->createTextureFromImageData(vec2(2, 2), Texture::RGBA_32, pixels));
+
+        // Rectangles and textures at the top level, below a transform and
+        // inside a layer are instanced, the ones in the 3D projection are not.
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1));
+        m_transform = TransformNode::create(mat4::translate2D(30, 10) * mat4::scale2D(2, 2));
+        Node *root = Node::create();
+        *root
+            << m_rect
+            << &(*m_transform
+                 << RectangleNode::create(rect2d::fromXywh(0, 0, 5, 5), vec4(0, 0, 1, 1))
+                 << TextureNode::create(rect2d::fromXywh(5, 0, 4, 4), m_texture.get()))
+            << &(*OpacityNode::create(0.5)
+                 << RectangleNode::create(rect2d::fromXywh(10, 30, 10, 10), vec4(0, 1, 0, 1)))
+            << &(*TransformNode::create(mat4::translate2D(60, 40) * mat4::rotateAroundY(0.3), 500)
+                 << RectangleNode::create(rect2d::fromXywh(0, 0, 20, 20), vec4(1, 1, 0, 1)));
+        return root;
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        check_true(renderer->instancingEnabled());
+
+        check_pixel(15, 15, vec4(1, 0, 0, 1));
+        check_pixel(35, 15, vec4(0, 0, 1, 1));
+        check_pixel(15, 35, vec4(0, 0.5, 0, 1));
+        check_pixel(65, 50, vec4(1, 1, 0, 1));
+
+        if (!renderer->instancingSupported())
+            return;
+
+        bool rectanglesInstanced = true;
+        bool projectionInstanced = false;
+        for (const OpenGLRenderer::Element &e : renderer->m_builtElements) {
+            if (e.node->type() == Node::RectangleNodeType && static_cast<RectangleNode *>(e.node)->color() == vec4(1, 1, 0, 1))
+                projectionInstanced = e.instanced;
+            else if (e.node->type() == Node::RectangleNodeType || e.node->type() == Node::TextureNodeType)
+                rectanglesInstanced = rectanglesInstanced && e.instanced;
+        }
+        check_true(rectanglesInstanced);
+        check_true(!projectionInstanced);
+
+        // The same scene drawn from vertices gives the same pixels
+        std::vector<unsigned> instanced(m_pixels, m_pixels + m_w * m_h);
+        std::vector<unsigned> frame(m_w * m_h);
+        renderer->setInstancingEnabled(false);
+        renderer->render();
+        renderer->readPixels(0, 0, m_w, m_h, frame.data());
+        check_true(frame == instanced);
+        renderer->setInstancingEnabled(true);
+        renderer->render();
+
+        // Moving a rectangle only uploads its geometry and changing its
+        // color only its color
+        m_rect->setGeometry(rect2d::fromXywh(12, 10, 10, 10));
+        renderer->render();
+        check_equal(renderer->vertexBytesUploaded(), sizeof(rect2d));
+        m_rect->setColor(vec4(0, 1, 1, 1));
+        renderer->render();
+        check_equal(renderer->vertexBytesUploaded(), sizeof(OpenGLRenderer::PackedColor));
+
+        // Changing a transform uploads the transforms of the nodes below it
+        m_transform->setMatrix(mat4::translate2D(31, 10) * mat4::scale2D(2, 2));
+        renderer->render();
+        check_equal(renderer->vertexBytesUploaded(), 2 * sizeof(OpenGLRenderer::InstanceTransform));
+        renderer->readPixels(0, 0, m_w, m_h, frame.data());
+        check_equal(frame[15 * m_w + 30], 0xff000000u);
+        check_equal(frame[15 * m_w + 40], 0xffff0000u);
+        check_equal(frame[15 * m_w + 21], 0xffffff00u);
+    }
+
+private:
+    std::unique_ptr<Texture> m_texture;
+    RectangleNode *m_rect = nullptr;
+    TransformNode *m_transform = nullptr;
+};
+
+// Compiles all of the renderer's fixed programs, a frame at a time
+static void warmUpAllPrograms(OpenGLRenderer *renderer)
+{
+    renderer->warmUpPrograms(OpenGLRenderer::UpdateAllPrograms);
+    while (renderer->programsWarmingUp() > 0)
+        renderer->frameSwapped();
+}
+
+class ProgramCache : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "ProgramCache"; }
+    Node *build() override {
+        m_root = Node::create();
+        *m_root
+            << RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1))
+            << &(*OpacityNode::create(0.5)
+                 << RectangleNode::create(rect2d::fromXywh(30, 10, 10, 10), vec4(0, 1, 0, 1)));
+        return m_root;
+    }
+
+    void check() override {
+        char directory[] = "/tmp/tst_render_programcacheXXXXXX";
+        check_true(mkdtemp(directory) != 0);
+        OpenGLProgramCache::setDefaultDirectory(directory);
+
+        // The first renderer compiles its programs and stores them
+        OpenGLRenderer *first = new OpenGLRenderer();
+        warmUpAllPrograms(first);
+        const OpenGLProgramCache *cache = first->programCache();
+        if (!cache->isActive()) {
+            // No binary formats, nothing to test
+            delete first;
+            OpenGLProgramCache::setDefaultDirectory(std::string());
+            rmdir(directory);
+            return;
+        }
+        unsigned programs = cache->compiledPrograms();
+        check_true(programs > 0);
+        check_equal(cache->loadedPrograms(), 0u);
+        delete first;
+
+        // The second one loads all of them and renders the same
+        OpenGLRenderer *second = new OpenGLRenderer();
+        warmUpAllPrograms(second);
+        check_equal(second->programCache()->compiledPrograms(), 0u);
+        check_equal(second->programCache()->loadedPrograms(), programs);
+        second->setTargetSurface(surface());
+        second->setSceneRoot(m_root);
+        second->render();
+        std::vector<unsigned> frame(m_w * m_h);
+        second->readPixels(0, 0, m_w, m_h, frame.data());
+        check_true(std::equal(frame.begin(), frame.end(), m_pixels));
+        delete second;
+
+        // A broken binary is thrown away and the program compiled again
+        std::vector<std::string> files;
+        DIR *dir = opendir(directory);
+        while (dirent *entry = readdir(dir)) {
+            if (entry->d_name[0] != '.')
+                files.push_back(std::string(directory) + "/" + entry->d_name);
+        }
+        closedir(dir);
+        check_equal(files.size(), programs);
+        FILE *file = fopen(files.front().c_str(), "r+b");
+        fputs("junk", file);
+        fclose(file);
+        OpenGLRenderer *third = new OpenGLRenderer();
+        warmUpAllPrograms(third);
+        check_equal(third->programCache()->compiledPrograms(), 1u);
+        check_equal(third->programCache()->loadedPrograms(), programs - 1);
+        delete third;
+
+        OpenGLProgramCache::setDefaultDirectory(std::string());
+        for (const std::string &f : files)
+            remove(f.c_str());
+        check_equal(rmdir(directory), 0);
+    }
+
+private:
+    Node *m_root = nullptr;
+};
+
+class ProgramWarmUp : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "ProgramWarmUp"; }
+    Node *build() override {
+        m_root = Node::create();
+        *m_root << RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1));
+        return m_root;
+    }
+
+    void check() override {
+        // Nothing is compiled up front and only what the scene needs after
+        // the first frame, which renders the same as with everything compiled
+        OpenGLRenderer *renderer = new OpenGLRenderer();
+        const OpenGLProgramCache *cache = renderer->programCache();
+        check_equal(cache->compiledPrograms(), 0u);
+        renderer->setTargetSurface(surface());
+        renderer->setSceneRoot(m_root);
+        renderer->render();
+        check_equal(cache->compiledPrograms(), 1u);
+        std::vector<unsigned> frame(m_w * m_h);
+        renderer->readPixels(0, 0, m_w, m_h, frame.data());
+        check_true(std::equal(frame.begin(), frame.end(), m_pixels));
+
+        // Warming up compiles the rest, one per frame without parallel
+        // compilation, and also radius specific programs
+        renderer->warmUpPrograms(OpenGLRenderer::UpdateAllPrograms);
+        unsigned fixedPrograms = renderer->programsWarmingUp();
+        check_true(fixedPrograms > 0);
+        std::vector<unsigned> radii = { 4 };
+        renderer->warmUpPrograms(OpenGLRenderer::UpdateBlurProgram, radii);
+        check_equal(renderer->programsWarmingUp(), fixedPrograms + 1);
+        renderer->warmUpPrograms(OpenGLRenderer::UpdateAllPrograms, radii, radii);
+        check_equal(renderer->programsWarmingUp(), fixedPrograms + 2);
+        if (!renderer->parallelCompileSupported()) {
+            renderer->frameSwapped();
+            check_equal(cache->compiledPrograms(), 2u);
+            check_equal(renderer->programsWarmingUp(), fixedPrograms + 1);
+        }
+        while (renderer->programsWarmingUp() > 0)
+            renderer->frameSwapped();
+        check_equal(cache->compiledPrograms(), fixedPrograms + 3);
+
+        // Warming up what is already compiled does nothing
+        renderer->warmUpPrograms(OpenGLRenderer::UpdateAllPrograms, radii, radii);
+        check_equal(renderer->programsWarmingUp(), 0u);
+        delete renderer;
+    }
+
+private:
+    Node *m_root = nullptr;
+};
+
+class StateCache : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "StateCache"; }
+    Node *build() override {
+        m_root = Node::create();
+        *m_root
+            << RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1))
+            << RectangleNode::create(rect2d::fromXywh(30, 10, 10, 10), vec4(1, 0, 0, 1));
+        return m_root;
+    }
+
+    void check() override {
+        // One quad at a time, so every rectangle goes through drawColorQuad()
+        OpenGLRenderer *renderer = new OpenGLRenderer();
+        renderer->setBatchingEnabled(false);
+        renderer->setInstancingEnabled(false);
+        renderer->setTargetSurface(surface());
+        renderer->setSceneRoot(m_root);
+        renderer->render();
+        *m_root << RectangleNode::create(rect2d::fromXywh(50, 10, 10, 10), vec4(1, 0, 0, 1));
+        renderer->render();
+        unsigned issued = renderer->glCallsIssued();
+        unsigned skipped = renderer->glCallsSkipped();
+        check_true(skipped > 0);
+
+        // Another rectangle of the same color only needs its own vertices,
+        // the program, the color and the buffer are already there.
+        *m_root << RectangleNode::create(rect2d::fromXywh(70, 10, 10, 10), vec4(1, 0, 0, 1));
+        renderer->render();
+        check_equal(renderer->glCallsIssued(), issued + 1);
+        check_equal(renderer->glCallsSkipped(), skipped + 3);
+
+        std::vector<unsigned> frame(m_w * m_h);
+        renderer->readPixels(0, 0, m_w, m_h, frame.data());
+        check_equal(frame[15 * m_w + 15], 0xff0000ffu);
+        check_equal(frame[15 * m_w + 75], 0xff0000ffu);
+        check_equal(frame[15 * m_w + 65], m_pixels[15 * m_w + 65]);
+        delete renderer;
+    }
+
+private:
+    Node *m_root = nullptr;
+};
+
+class GpuTiming : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "GpuTiming"; }
+    Node *build() override {
+        m_root = Node::create();
+        *m_root << RectangleNode::create(rect2d::fromXywh(0, 0, 100, 100), vec4(1, 0, 0, 1))
+                << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(10, 10, 50, 50), vec4(0, 1, 0, 1)))
+                << &(*BlurNode::create(8) << RectangleNode::create(rect2d::fromXywh(110, 10, 50, 50), vec4(0, 0, 1, 1)))
+                << &(*ShadowNode::create(4, vec2(2, 2), vec4(0, 0, 0, 1)) << RectangleNode::create(rect2d::fromXywh(170, 10, 50, 50), vec4(1, 1, 0, 1)));
+        return m_root;
+    }
+
+    void check() override {
+        // Every frame renders the layers again
+        OpenGLRenderer *renderer = new OpenGLRenderer();
+        renderer->setLayerCachingEnabled(false);
+        renderer->setDamageTrackingEnabled(false);
+        renderer->setTargetSurface(surface());
+        renderer->setSceneRoot(m_root);
+
+        check_true(!renderer->gpuTimingEnabled());
+        renderer->render();
+        renderer->frameSwapped();
+        check_true(!renderer->gpuTimings().available);
+
+        renderer->setGpuTimingEnabled(true);
+        for (int i=0; i<10 && !renderer->gpuTimings().available; ++i) {
+            renderer->render();
+            glFinish();
+            renderer->frameSwapped();
+        }
+
+        const OpenGLGpuTimer::Timings &timings = renderer->gpuTimings();
+        check_equal(timings.available, renderer->gpuTimingSupported());
+        if (timings.available) {
+            check_true(timings.passes[OpenGLGpuTimer::MainPass] > 0);
+            check_true(timings.passes[OpenGLGpuTimer::OpacityLayers] > 0);
+            check_true(timings.passes[OpenGLGpuTimer::BlurLayers] > 0);
+            check_true(timings.passes[OpenGLGpuTimer::ShadowLayers] > 0);
+            check_equal(timings.passes[OpenGLGpuTimer::ColorFilterLayers], 0.0);
+            check_true(timings.total() >= timings.passes[OpenGLGpuTimer::BlurLayers]);
+        }
+
+        renderer->setGpuTimingEnabled(false);
+        check_true(!renderer->gpuTimings().available);
+        delete renderer;
+    }
+
+private:
+    Node *m_root = nullptr;
+};
+
 int main(int argc, char *argv[])
 {
     RENGINE_BACKEND backend;
@@ -218,6 +1437,41 @@ int main(int argc, char *argv[])
     testBase.addTest(new ColorsAndPositions());
     testBase.addTest(new TexturesOnViewportEdge());
     testBase.addTest(new OpacityTextures());
+    testBase.addTest(new BatchedRectangles());
+    testBase.addTest(new AtlasedTextures());
+    testBase.addTest(new LayerFilters());
+    testBase.addTest(new Readback());
+    testBase.addTest(new FrameStatistics());
+    testBase.addTest(new ProjectionSorting());
+
+    // --software runs the tests above with the SoftwareRenderer, the rest
+    // are about the OpenGL renderer.
+    bool software = argc > 1 && std::string(argv[1]) == "--software";
+#ifdef RENGINE_BACKEND_HEADLESS
+    // The headless backend falls back to software when there is no OpenGL
+    software = software || backend.isSoftware();
+#endif
+    if (software) {
+        testBase.setRenderer(new SoftwareRenderer());
+        testBase.show();
+        backend.run();
+        return 0;
+    }
+
+    testBase.addTest(new RetainedVertices());
+    testBase.addTest(new UnchangedScene());
+    testBase.addTest(new CachedLayers());
+    testBase.addTest(new DownsampledBlur());
+    testBase.addTest(new OpaquePass());
+    testBase.addTest(new CulledNodes());
+    testBase.addTest(new DamageRegions());
+    testBase.addTest(new MillionRectangles());
+    testBase.addTest(new ParallelBuild());
+    testBase.addTest(new InstancedRendering());
+    testBase.addTest(new ProgramCache());
+    testBase.addTest(new ProgramWarmUp());
+    testBase.addTest(new StateCache());
+    testBase.addTest(new GpuTiming());
     testBase.show();
 
     backend.run();